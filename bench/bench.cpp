@@ -0,0 +1,575 @@
+#include "../include/Chip8.h"
+#include "../include/Chip8Aot.h"
+#include "../include/Chip8Batch.h"
+#include "../include/Chip8Engine.h"
+#include "../include/Chip8RomStore.h"
+#if CHIP8_JIT
+#include "../include/Chip8Jit.h"
+#endif
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+struct BenchOptions {
+    uint64_t cycles = 0; // Stop after this many instructions (0 means use frames)
+    uint64_t frames = 600; // Stop after this many 60 Hz frames
+    uint32_t cpu_hz = CHIP8_DEFAULT_CPU_HZ; // Emulated instructions per second, only decides how often timers tick
+    bool hz_given = false;
+    bool vip = false; // Charge COSMAC VIP machine cycles instead of counting instructions, cycles and cpu_hz follow
+    double speed = 1; // Multiple of cpu_hz actually run
+    bool json = false;
+    bool jit = false; // Run through Chip8Jit instead of the interpreter
+    bool jit_verify = false; // Check every JIT block against the interpreter
+    size_t scaling_instances = 0; // Run the first ROM on this many VMs with 1 to all threads instead
+    size_t batch_lanes = 0; // Run the first ROM on this many lanes of a Chip8Batch and as many Chip8s instead
+    std::string profile_path; // Write interpreter counters here, needs a CHIP8_PROFILE build
+    bool profile_folded = false; // Folded stacks instead of the flat summary
+    std::string output_path;
+    std::string pack_path; // Pack every ROM into an archive here instead of running them
+    std::vector<std::string> roms; // ROM files, directories of them or archives
+    std::vector<std::string> aot_modules; // Translated ROMs built by chip8_add_aot()
+    std::vector<const Chip8AotProgram*> aot_programs; // Loaded from aot_modules, used for the ROM they were translated from
+    bool aot_verify = false; // Check every native run of a translated ROM against the interpreter
+};
+
+struct BenchResult {
+    std::string rom;
+    uint64_t instructions = 0; // Executed, the rate is taken over these
+    uint64_t skipped = 0; // Fast-forwarded through idle loops and waits without running
+    uint64_t frames = 0;
+    double wall_seconds = 0;
+    uint64_t verify_mismatches = 0;
+};
+
+struct BatchResult {
+    size_t lanes = 0;
+    // Summed over the lanes. Both sides get the same budget, but a lane halted on FX0A or an unknown opcode
+    // leaves the batch while its Chip8 keeps running the instruction
+    uint64_t batch_instructions = 0; // Executed, the rate is taken over these
+    uint64_t batch_skipped = 0; // Fast-forwarded through idle loops and halts without running
+    uint64_t independent_instructions = 0;
+    uint64_t independent_skipped = 0;
+    double batch_seconds = 0;
+    double independent_seconds = 0;
+    double lanes_per_step = 0; // Lane instructions each instruction the batch issued stood for
+    size_t mismatches = 0; // Lanes whose final state differs from their Chip8
+};
+
+struct ScalingResult {
+    unsigned threads = 0;
+    size_t instances = 0;
+    uint64_t instructions = 0; // Executed, summed over the instances
+    uint64_t skipped = 0; // Fast-forwarded, summed over the instances
+    double wall_seconds = 0;
+};
+
+void printUsage() {
+    std::cout << "Usage: chip8_bench [--cycles N | --frames N] [--hz N] [--format csv|json] [--output file] rom|dir|archive..." << std::endl
+              << std::endl
+              << "  --cycles N   Run each ROM for N instructions" << std::endl
+              << "  --frames N   Run each ROM for N frames of 60 Hz (default 600)" << std::endl
+              << "  --hz N       Emulated instructions per second, used to interleave timer ticks (default 1000)" << std::endl
+              << "  --timing T   instructions (default), or vip to charge each instruction the machine cycles it took on" << std::endl
+              << "               the COSMAC VIP and end frames at draws; --cycles, --hz and the instruction counts" << std::endl
+              << "               reported are then machine cycles (--hz defaults to " << CHIP8_VIP_CPU_HZ << ")" << std::endl
+              << "  --speed X    Run at X times --hz, e.g. 2 for twice the original speed under --timing vip" << std::endl
+              << "  --format F   Output format, csv (default) or json" << std::endl
+              << "  --output P   Write results to P instead of stdout" << std::endl
+              << "  --pack P     Pack every given ROM into the archive P and exit" << std::endl
+              << "  --scaling N  Run the first ROM on N VMs through Chip8Engine, once per thread count" << std::endl
+              << "               from 1 to all cores (--frames or --cycles is the budget per VM)" << std::endl
+              << "  --batch N    Run the first ROM on N lanes of a Chip8Batch, each with its own seed and keys, then on" << std::endl
+              << "               N separate Chip8s, and check every lane ended in the same state as its Chip8" << std::endl
+#if CHIP8_PROFILE
+              << "  --profile P  Write per-instruction and per-address execution counts of each ROM to P" << std::endl
+              << "  --profile-folded P" << std::endl
+              << "               Same as --profile, as folded stacks for flamegraph.pl" << std::endl
+#endif
+#if CHIP8_JIT
+              << "  --jit        Run through the dynamic recompiler" << std::endl
+              << "  --jit-verify Run through the dynamic recompiler, checking each block against the interpreter" << std::endl
+#endif
+#ifndef _WIN32
+              << "  --aot M      Run the ROM translated into module M by chip8_recompile natively, may be repeated" << std::endl
+              << "  --aot-verify Check each native run of the --aot modules against the interpreter" << std::endl
+#endif
+              ;
+}
+
+bool parseOptions(int argc, char* argv[], BenchOptions &options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--cycles" && has_value) {
+            options.cycles = std::stoull(argv[++i]);
+            options.frames = 0;
+        } else if (arg == "--frames" && has_value) {
+            options.frames = std::stoull(argv[++i]);
+            options.cycles = 0;
+        } else if (arg == "--hz" && has_value) {
+            options.cpu_hz = std::stoul(argv[++i]);
+            options.hz_given = true;
+        } else if (arg == "--timing" && has_value) {
+            const std::string timing = argv[++i];
+            if (timing != "instructions" && timing != "vip") return false;
+            options.vip = timing == "vip";
+        } else if (arg == "--speed" && has_value) {
+            options.speed = std::stod(argv[++i]);
+        } else if (arg == "--format" && has_value) {
+            const std::string format = argv[++i];
+            if (format != "csv" && format != "json") return false;
+            options.json = format == "json";
+        } else if (arg == "--output" && has_value) {
+            options.output_path = argv[++i];
+        } else if (arg == "--scaling" && has_value) {
+            options.scaling_instances = std::stoull(argv[++i]);
+        } else if (arg == "--batch" && has_value) {
+            options.batch_lanes = std::stoull(argv[++i]);
+        } else if (arg == "--pack" && has_value) {
+            options.pack_path = argv[++i];
+#if CHIP8_PROFILE
+        } else if ((arg == "--profile" || arg == "--profile-folded") && has_value) {
+            options.profile_path = argv[++i];
+            options.profile_folded = arg == "--profile-folded";
+#endif
+#if CHIP8_JIT
+        } else if (arg == "--jit") {
+            options.jit = true;
+        } else if (arg == "--jit-verify") {
+            options.jit = true;
+            options.jit_verify = true;
+#endif
+#ifndef _WIN32
+        } else if (arg == "--aot" && has_value) {
+            options.aot_modules.push_back(argv[++i]);
+        } else if (arg == "--aot-verify") {
+            options.aot_verify = true;
+#endif
+        } else if (arg.rfind("--", 0) == 0) {
+            return false;
+        } else {
+            options.roms.push_back(arg);
+        }
+    }
+    if (options.vip && !options.hz_given) options.cpu_hz = CHIP8_VIP_CPU_HZ;
+    options.cpu_hz = std::lround(options.cpu_hz * options.speed);
+    // Chip8Batch and the recompilers count instructions, --scaling does not pass the timing on to Chip8Engine
+    if (options.vip && (options.jit || !options.aot_modules.empty() || options.scaling_instances > 0
+                        || options.batch_lanes > 0)) return false;
+    return !options.roms.empty() && options.cpu_hz > 0 && (options.cycles > 0 || options.frames > 0);
+}
+
+// Number of instructions executed in the given frame, spreads cpu_hz evenly over 60 frames without drifting
+uint64_t cyclesInFrame(uint64_t frame, uint32_t cpu_hz) {
+    return (cpu_hz * (frame + 1)) / CHIP8_TIMER_HZ - (cpu_hz * frame) / CHIP8_TIMER_HZ;
+}
+
+// Modules stay loaded until exit, the programs point into them
+bool loadAotModules(BenchOptions &options) {
+#ifndef _WIN32
+    for (const std::string &path : options.aot_modules) {
+        void *module = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!module) {
+            std::cout << "Failed to load " << path << ": " << dlerror() << std::endl;
+            return false;
+        }
+        auto entry = reinterpret_cast<const Chip8AotProgram* (*)()>(dlsym(module, CHIP8_AOT_ENTRY));
+        const Chip8AotProgram *program = entry ? entry() : nullptr;
+        if (!program || program->abi_version != CHIP8_AOT_ABI_VERSION) {
+            std::cout << path << " is not a translated ROM of this version, rebuild it with chip8_recompile" << std::endl;
+            return false;
+        }
+        options.aot_programs.push_back(program);
+    }
+#endif
+    return true;
+}
+
+const Chip8AotProgram* findAotProgram(const Chip8Rom &rom, const BenchOptions &options) {
+    for (const Chip8AotProgram *program : options.aot_programs)
+        if (program->rom_hash == rom.hash) return program;
+    return nullptr;
+}
+
+template <typename Machine>
+BenchResult benchRom(const Chip8Rom &rom, const BenchOptions &options, [[maybe_unused]] std::ostream *profile) {
+    // Machines carry their decoded instruction cache inline, keep it off the stack
+    auto chip8 = std::make_unique<Machine>();
+    chip8->initialize();
+    if (options.vip) chip8->set_timing(Chip8Timing::CosmacVip);
+    chip8->load_program(rom.data, rom.size);
+
+    BenchResult result;
+    result.rom = rom.name;
+#if CHIP8_JIT
+    std::unique_ptr<Chip8Jit> jit;
+    // The recompiler only knows the classic instruction set, the other variants stay on the interpreter
+    if constexpr (std::is_same<Machine, Chip8>::value) {
+        if (options.jit) {
+            jit = std::make_unique<Chip8Jit>(*chip8);
+            jit->set_verify(options.jit_verify);
+        }
+    }
+#endif
+
+    std::unique_ptr<Chip8Aot> aot;
+    if constexpr (std::is_same<Machine, Chip8>::value) {
+        const Chip8AotProgram *program = findAotProgram(rom, options);
+#if CHIP8_JIT
+        if (jit) program = nullptr;
+#endif
+        if (program) {
+            aot = std::make_unique<Chip8Aot>(*chip8, *program);
+            aot->set_verify(options.aot_verify);
+        }
+    }
+
+    // Every instruction budgeted, executed or skipped
+    uint64_t budgeted = 0;
+    const uint64_t skipped_before = chip8->get_skipped_cycles();
+    const auto begin = std::chrono::steady_clock::now();
+    while (true) {
+        const uint64_t frame_cycles = cyclesInFrame(result.frames, options.cpu_hz);
+        uint64_t cycles = frame_cycles;
+        if (options.cycles > 0 && budgeted + cycles > options.cycles) cycles = options.cycles - budgeted;
+
+#if CHIP8_JIT
+        if (jit)
+            jit->run(cycles);
+        else
+#endif
+        if (aot)
+            aot->run(cycles);
+        else
+            chip8->run_cycles(cycles);
+        budgeted += cycles;
+        if (cycles < frame_cycles) break;
+
+        chip8->update_timers();
+        result.frames++;
+        if (options.cycles > 0 ? budgeted >= options.cycles : result.frames >= options.frames) break;
+    }
+    const auto end = std::chrono::steady_clock::now();
+    result.wall_seconds = std::chrono::duration<double>(end - begin).count();
+    result.skipped = chip8->get_skipped_cycles() - skipped_before;
+    result.instructions = budgeted - result.skipped;
+#if CHIP8_JIT
+    if (jit) result.verify_mismatches = jit->get_verify_mismatches();
+#endif
+    if (aot) result.verify_mismatches = aot->get_verify_mismatches();
+#if CHIP8_PROFILE
+    if (profile) {
+        if (!options.profile_folded) *profile << "# " << rom.name << std::endl;
+        chip8->write_profile(*profile, options.profile_folded, rom.name);
+    }
+#endif
+    return result;
+}
+
+// Runs the ROM on the variant detected for it
+BenchResult benchVariant(const Chip8Rom &rom, const BenchOptions &options, std::ostream *profile) {
+    switch (rom.variant) {
+        case Chip8Variant::SuperChip: return benchRom<Chip8SuperChip>(rom, options, profile);
+        case Chip8Variant::XoChip: return benchRom<Chip8XoChip>(rom, options, profile);
+        default: return benchRom<Chip8>(rom, options, profile);
+    }
+}
+
+ScalingResult benchScaling(const Chip8Rom &rom, unsigned threads, const BenchOptions &options) {
+    Chip8Engine engine(options.scaling_instances, threads);
+    engine.set_cpu_hz(options.cpu_hz);
+    for (size_t i = 0; i < engine.size(); ++i)
+        engine.instance(i).load_program(rom.data, rom.size);
+
+    const auto begin = std::chrono::steady_clock::now();
+    if (options.cycles > 0) engine.run_cycles(options.cycles);
+    else engine.run_frames(options.frames);
+    const auto end = std::chrono::steady_clock::now();
+
+    ScalingResult result;
+    result.threads = engine.thread_count();
+    result.instances = engine.size();
+    for (size_t i = 0; i < engine.size(); ++i) {
+        result.instructions += engine.result(i).cycles - engine.result(i).skipped;
+        result.skipped += engine.result(i).skipped;
+    }
+    result.wall_seconds = std::chrono::duration<double>(end - begin).count();
+    return result;
+}
+
+// Keys lane `lane` holds during `frame`: now and then one key for a few frames, different on every lane
+uint16_t batchKeys(size_t lane, uint64_t frame) {
+    uint32_t hash = static_cast<uint32_t>(lane * 0x9E3779B1u) ^ static_cast<uint32_t>(frame / 8 * 0x85EBCA77u);
+    hash ^= hash >> 15;
+    hash *= 0x2C1B3C6Du;
+    hash ^= hash >> 12;
+    return (hash >> 8 & 3) == 0 ? 1 << (hash & 0xF) : 0;
+}
+
+BatchResult benchBatch(const Chip8Rom &rom, const BenchOptions &options) {
+    BatchResult result;
+    result.lanes = options.batch_lanes;
+    Chip8Batch batch(result.lanes);
+    batch.set_cpu_hz(options.cpu_hz);
+    std::vector<std::unique_ptr<Chip8>> machines;
+    for (size_t lane = 0; lane < result.lanes; ++lane) {
+        machines.push_back(std::make_unique<Chip8>());
+        machines.back()->seed(lane + 1);
+        machines.back()->initialize();
+        machines.back()->load_program(rom.data, rom.size);
+        batch.load(lane, *machines.back());
+    }
+
+    // Both sides run the same frames with the same keys, as benchRom() does for one VM
+    auto runFrames = [&](auto &&runFrame) {
+        uint64_t instructions = 0;
+        for (uint64_t frame = 0;; ++frame) {
+            const uint64_t frame_cycles = cyclesInFrame(frame, options.cpu_hz);
+            uint64_t cycles = frame_cycles;
+            if (options.cycles > 0 && instructions + cycles > options.cycles) cycles = options.cycles - instructions;
+            runFrame(frame, cycles, cycles == frame_cycles);
+            instructions += cycles;
+            if (cycles < frame_cycles) break;
+            if (options.cycles > 0 ? instructions >= options.cycles : frame + 1 >= options.frames) break;
+        }
+        return instructions;
+    };
+
+    auto begin = std::chrono::steady_clock::now();
+    runFrames([&](uint64_t frame, uint64_t cycles, bool whole) {
+        for (size_t lane = 0; lane < result.lanes; ++lane) {
+            const uint16_t keys = batchKeys(lane, frame);
+            for (uint8_t key = 0; key < CHIP8_KEY_SIZE; ++key) batch.set_input_key(lane, key, keys >> key & 1);
+        }
+        batch.run_cycles(cycles);
+        if (whole) batch.update_timers();
+    });
+    result.batch_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    begin = std::chrono::steady_clock::now();
+    const uint64_t budgeted = result.lanes * runFrames([&](uint64_t frame, uint64_t cycles, bool whole) {
+        for (size_t lane = 0; lane < result.lanes; ++lane) {
+            Chip8 &chip8 = *machines[lane];
+            const uint16_t keys = batchKeys(lane, frame);
+            for (uint8_t key = 0; key < CHIP8_KEY_SIZE; ++key) chip8.set_input_key(key, keys >> key & 1);
+            chip8.run_cycles(cycles);
+            if (whole) chip8.update_timers();
+        }
+    });
+    result.independent_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    result.batch_instructions = batch.get_lane_instructions();
+    result.batch_skipped = batch.get_lane_skipped();
+    for (const std::unique_ptr<Chip8> &chip8 : machines) result.independent_skipped += chip8->get_skipped_cycles();
+    result.independent_instructions = budgeted - result.independent_skipped;
+    result.lanes_per_step = batch.get_steps() > 0 ? double(batch.get_lane_instructions()) / batch.get_steps() : 0;
+
+    auto lane_state = std::make_unique<Chip8>();
+    std::vector<uint8_t> expected(Chip8::snapshot_size());
+    std::vector<uint8_t> actual(Chip8::snapshot_size());
+    for (size_t lane = 0; lane < result.lanes; ++lane) {
+        batch.store(lane, *lane_state);
+        machines[lane]->snapshot(expected.data(), expected.size());
+        lane_state->snapshot(actual.data(), actual.size());
+        if (expected != actual) result.mismatches++;
+    }
+    return result;
+}
+
+void writeBatchResult(std::ostream &os, const BatchResult &r, bool json) {
+    const double batch_ips = r.batch_seconds > 0 ? r.batch_instructions / r.batch_seconds : 0;
+    const double independent_ips = r.independent_seconds > 0 ? r.independent_instructions / r.independent_seconds : 0;
+    // Both sides ran the same frames, the executed counts may differ
+    const double speedup = r.batch_seconds > 0 ? r.independent_seconds / r.batch_seconds : 0;
+    if (json) {
+        os << "{\"lanes\": " << r.lanes << ", \"batch_instructions\": " << r.batch_instructions
+           << ", \"batch_skipped\": " << r.batch_skipped << ", \"independent_instructions\": "
+           << r.independent_instructions << ", \"independent_skipped\": " << r.independent_skipped
+           << ", \"batch_seconds\": " << r.batch_seconds << ", \"independent_seconds\": " << r.independent_seconds
+           << ", \"batch_instructions_per_sec\": " << batch_ips
+           << ", \"independent_instructions_per_sec\": " << independent_ips << ", \"speedup\": " << speedup
+           << ", \"lanes_per_step\": " << r.lanes_per_step << ", \"mismatches\": " << r.mismatches << "}" << std::endl;
+    } else {
+        os << "lanes,batch_instructions,batch_skipped,independent_instructions,independent_skipped,batch_seconds,"
+           << "independent_seconds,batch_instructions_per_sec,independent_instructions_per_sec,speedup,"
+           << "lanes_per_step,mismatches" << std::endl
+           << r.lanes << "," << r.batch_instructions << "," << r.batch_skipped << "," << r.independent_instructions
+           << "," << r.independent_skipped << "," << r.batch_seconds << "," << r.independent_seconds << ","
+           << batch_ips << "," << independent_ips << "," << speedup << "," << r.lanes_per_step << ","
+           << r.mismatches << std::endl;
+    }
+}
+
+int runBatch(const Chip8Rom &rom, const BenchOptions &options) {
+    if (rom.variant == Chip8Variant::SuperChip || rom.variant == Chip8Variant::XoChip) {
+        std::cout << rom.name << " needs an extended variant, batches only run the original instruction set" << std::endl;
+        return 1;
+    }
+    const BatchResult result = benchBatch(rom, options);
+    if (options.output_path.empty()) {
+        writeBatchResult(std::cout, result, options.json);
+    } else {
+        std::ofstream file(options.output_path);
+        if (!file) {
+            std::cout << "Failed to open output file " << options.output_path << std::endl;
+            return 1;
+        }
+        writeBatchResult(file, result, options.json);
+    }
+    if (result.mismatches > 0) {
+        std::cerr << result.mismatches << " lanes disagreed with their Chip8" << std::endl;
+        return 2;
+    }
+    return 0;
+}
+
+std::string escapeJson(const std::string &value) {
+    std::string escaped;
+    for (const char c : value) {
+        if (c == '"' || c == '\\') escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+void writeResults(std::ostream &os, const std::vector<BenchResult> &results, bool json) {
+    if (json) os << "[" << std::endl;
+    else os << "rom,instructions,skipped,frames,wall_seconds,instructions_per_sec,frames_per_sec" << std::endl;
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult &r = results[i];
+        const double ips = r.wall_seconds > 0 ? r.instructions / r.wall_seconds : 0;
+        const double fps = r.wall_seconds > 0 ? r.frames / r.wall_seconds : 0;
+        if (json) {
+            os << "  {\"rom\": \"" << escapeJson(r.rom) << "\", \"instructions\": " << r.instructions
+               << ", \"skipped\": " << r.skipped << ", \"frames\": " << r.frames << ", \"wall_seconds\": " << r.wall_seconds
+               << ", \"instructions_per_sec\": " << ips << ", \"frames_per_sec\": " << fps << "}"
+               << (i + 1 < results.size() ? "," : "") << std::endl;
+        } else {
+            os << r.rom << "," << r.instructions << "," << r.skipped << "," << r.frames << "," << r.wall_seconds << ","
+               << ips << "," << fps << std::endl;
+        }
+    }
+    if (json) os << "]" << std::endl;
+}
+
+void writeScalingResults(std::ostream &os, const std::vector<ScalingResult> &results, bool json) {
+    if (json) os << "[" << std::endl;
+    else os << "threads,instances,instructions,skipped,wall_seconds,instructions_per_sec,speedup" << std::endl;
+
+    const double base_ips = results.empty() || results[0].wall_seconds <= 0 ? 0 : results[0].instructions / results[0].wall_seconds;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const ScalingResult &r = results[i];
+        const double ips = r.wall_seconds > 0 ? r.instructions / r.wall_seconds : 0;
+        const double speedup = base_ips > 0 ? ips / base_ips : 0;
+        if (json) {
+            os << "  {\"threads\": " << r.threads << ", \"instances\": " << r.instances
+               << ", \"instructions\": " << r.instructions << ", \"skipped\": " << r.skipped
+               << ", \"wall_seconds\": " << r.wall_seconds << ", \"instructions_per_sec\": " << ips
+               << ", \"speedup\": " << speedup << "}"
+               << (i + 1 < results.size() ? "," : "") << std::endl;
+        } else {
+            os << r.threads << "," << r.instances << "," << r.instructions << "," << r.skipped << "," << r.wall_seconds << ","
+               << ips << "," << speedup << std::endl;
+        }
+    }
+    if (json) os << "]" << std::endl;
+}
+
+int runScaling(const Chip8Rom &rom, const BenchOptions &options) {
+    // 1, 2, 4, ... threads, always ending with every hardware thread
+    const unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<ScalingResult> results;
+    for (unsigned threads = 1; threads < max_threads; threads *= 2)
+        results.push_back(benchScaling(rom, threads, options));
+    results.push_back(benchScaling(rom, max_threads, options));
+
+    if (options.output_path.empty()) {
+        writeScalingResults(std::cout, results, options.json);
+        return 0;
+    }
+    std::ofstream file(options.output_path);
+    if (!file) {
+        std::cout << "Failed to open output file " << options.output_path << std::endl;
+        return 1;
+    }
+    writeScalingResults(file, results, options.json);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+    if (!loadAotModules(options)) return 1;
+
+    // Every ROM is mapped once up front, the runs below only copy it into VM memory
+    Chip8RomStore store;
+    for (const std::string &path : options.roms) {
+        if (!store.add(path)) {
+            std::cout << "Failed to load " << path << " (missing, empty or larger than "
+                      << Chip8XoChip::max_program_size << " bytes)" << std::endl;
+            return 1;
+        }
+    }
+    if (store.size() == 0) {
+        std::cout << "No ROMs found" << std::endl;
+        return 1;
+    }
+    if (!options.pack_path.empty()) {
+        if (!store.write_archive(options.pack_path)) {
+            std::cout << "Failed to write archive " << options.pack_path << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (options.scaling_instances > 0)
+        return runScaling(store.rom(0), options);
+    if (options.batch_lanes > 0)
+        return runBatch(store.rom(0), options);
+
+    std::ofstream profile;
+    if (!options.profile_path.empty()) {
+        profile.open(options.profile_path);
+        if (!profile) {
+            std::cout << "Failed to open profile file " << options.profile_path << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<BenchResult> results;
+    uint64_t verify_mismatches = 0;
+    for (size_t i = 0; i < store.size(); ++i) {
+        results.push_back(benchVariant(store.rom(i), options, profile.is_open() ? &profile : nullptr));
+        verify_mismatches += results.back().verify_mismatches;
+    }
+
+    if (options.output_path.empty()) {
+        writeResults(std::cout, results, options.json);
+    } else {
+        std::ofstream file(options.output_path);
+        if (!file) {
+            std::cout << "Failed to open output file " << options.output_path << std::endl;
+            return 1;
+        }
+        writeResults(file, results, options.json);
+    }
+    if (verify_mismatches > 0) {
+        std::cerr << verify_mismatches << " translated blocks disagreed with the interpreter" << std::endl;
+        return 2;
+    }
+    return 0;
+}
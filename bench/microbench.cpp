@@ -0,0 +1,402 @@
+#include "../include/Chip8.h"
+#include "../include/Chip8Render.h"
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+struct MicrobenchOptions {
+    uint32_t cycles = 2000000; // Instructions per repetition of a ROM case
+    uint32_t calls = 2000; // Calls per repetition of a setup case
+    uint32_t renders = 200; // Displays rendered per repetition of a render case
+    // The fastest repetition counts, the others absorb warmup and noise. The fastest of more repetitions is
+    // faster, so a baseline is only comparable with runs of the same count
+    int repetitions = 25;
+    double tolerance = 0.5; // Slowdown against the baseline allowed before a case fails
+    std::string filter; // Only cases whose name contains this
+    bool list = false; // Print the cases instead of running them
+    std::string baseline_path; // Compare against this baseline
+    std::string write_baseline_path; // Write the results as a new baseline here
+};
+
+// A synthetic ROM that loops over one class of instructions forever. Every loop changes a register on each pass,
+// so the interpreter never finds it idle and skips iterations.
+struct RomCase {
+    std::string name;
+    std::string description;
+    std::vector<uint16_t> code; // Loaded at 0x200
+    std::vector<uint8_t> data; // Placed right after the code
+};
+
+// Cost of a call that prepares a VM rather than runs it
+struct SetupCase {
+    std::string name;
+    std::string description;
+    std::function<void(Chip8&)> call;
+};
+
+// Chip8Renderer turning a whole display into texels, alternating between two random displays
+struct RenderCase {
+    std::string name;
+    std::string description;
+    int width;
+    int height;
+    int planes;
+    int scale;
+    uint8_t persistence;
+    Chip8RenderKernel kernel; // Falls back to the fastest the CPU has if it cannot run this one
+};
+
+struct MicrobenchTiming {
+    double ns_per_op = 0; // Per instruction for ROM cases, per call for setup cases, per output pixel for render cases
+    double relative = 0; // ns_per_op in instructions of the calibration loop, see runCalibration()
+};
+
+struct MicrobenchResult {
+    std::string name;
+    std::function<MicrobenchTiming()> time; // Runs the case, a case that looks like a regression runs twice
+    bool render = false; // ns_per_op is per output pixel
+    MicrobenchTiming timing;
+    MicrobenchTiming baseline; // Zero if the baseline has no entry for the case, relative is zero in old baselines
+};
+
+void printUsage() {
+    std::cout << "Usage: chip8_microbench [--cycles N] [--calls N] [--renders N] [--repetitions N] [--filter S] [--list]"
+              << std::endl
+              << "                        [--baseline file [--tolerance F]] [--write-baseline file]" << std::endl
+              << std::endl
+              << "Times each instruction class of the interpreter on a synthetic ROM, plus VM setup calls and display" << std::endl
+              << "rendering. Each repetition is paired with a run of a fixed calibration loop, and --baseline compares" << std::endl
+              << "cases in multiples of it rather than in nanoseconds." << std::endl
+              << "  --cycles N          Instructions per repetition of a ROM case (default 2000000)" << std::endl
+              << "  --calls N           Calls per repetition of a setup case (default 2000)" << std::endl
+              << "  --renders N         Displays rendered per repetition of a render case (default 200)" << std::endl
+              << "  --repetitions N     Repetitions per case, the fastest is reported (default 25). Write and check a" << std::endl
+              << "                      baseline with the same count" << std::endl
+              << "  --filter S          Only run the cases whose name contains S" << std::endl
+              << "  --list              Print the cases and what they exercise" << std::endl
+              << "  --baseline P        Compare against the baseline P, exit with 2 if a case got slower" << std::endl
+              << "  --tolerance F       Slowdown tolerated against the baseline, as a fraction (default 0.5)" << std::endl
+              << "  --write-baseline P  Write the results to P as a new baseline" << std::endl;
+}
+
+bool parseOptions(int argc, char* argv[], MicrobenchOptions &options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--cycles" && has_value) {
+            options.cycles = std::stoul(argv[++i]);
+        } else if (arg == "--calls" && has_value) {
+            options.calls = std::stoul(argv[++i]);
+        } else if (arg == "--renders" && has_value) {
+            options.renders = std::stoul(argv[++i]);
+        } else if (arg == "--repetitions" && has_value) {
+            options.repetitions = std::stoi(argv[++i]);
+        } else if (arg == "--filter" && has_value) {
+            options.filter = argv[++i];
+        } else if (arg == "--list") {
+            options.list = true;
+        } else if (arg == "--baseline" && has_value) {
+            options.baseline_path = argv[++i];
+        } else if (arg == "--tolerance" && has_value) {
+            options.tolerance = std::stod(argv[++i]);
+        } else if (arg == "--write-baseline" && has_value) {
+            options.write_baseline_path = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    return options.cycles > 0 && options.calls > 0 && options.renders > 0 && options.repetitions > 0 && options.tolerance >= 0;
+}
+
+// DXYN loop: I at the sprite, X moves by 3 and Y by 5 every draw so rows land at every bit offset and get clipped
+// at the edges. With `twice` each sprite is drawn again on top of itself, colliding and erasing it.
+RomCase drawCase(int height, bool twice) {
+    const uint16_t draw = 0xD010 | height;
+    RomCase rom;
+    rom.name = "draw_" + std::to_string(height) + (twice ? "_overlap" : "");
+    rom.description = twice ? "DXYN drawn twice at the same spot, every row collides" : "DXYN at moving positions";
+    rom.code = {0xA000, 0x6000, 0x6100, draw, twice ? draw : uint16_t(0x8220), 0x7003, 0x7105, 0x1206};
+    rom.code[0] |= CHIP8_ADDR_PROGRAM_START + rom.code.size() * 2;
+    for (int i = 0; i < height; ++i) rom.data.push_back(i % 2 ? 0xA5 : 0xFF);
+    return rom;
+}
+
+std::vector<RomCase> romCases() {
+    std::vector<RomCase> cases = {
+        {"alu", "8XY0-8XYE and 7XNN",
+            {0x6001, 0x6103, 0x8014, 0x8105, 0x8201, 0x8312, 0x8423, 0x8506, 0x860E, 0x8707, 0x8870, 0x7901, 0x1204}, {}},
+        {"skip", "3XNN, 4XNN, 5XY0 and 9XY0, taken and not taken",
+            {0x6000, 0x7001, 0x3000, 0x4000, 0x6100, 0x5010, 0x9010, 0x6100, 0x1202}, {}},
+        {"call_ret", "2NNN and 00EE around a one instruction subroutine",
+            {0x2206, 0x7001, 0x1200, 0x7101, 0x00EE}, {}},
+        {"jump", "1NNN chains",
+            {0x7001, 0x1204, 0x1206, 0x1208, 0x120A, 0x1200}, {}},
+        {"timers", "FX07, FX15 and FX18",
+            {0x7001, 0xF015, 0xF118, 0xF207, 0x1200}, {}},
+        {"index", "ANNN, FX1E and FX29",
+            {0x7001, 0xA300, 0xF01E, 0xF129, 0x1200}, {}},
+        {"bcd", "FX33",
+            {0xA300, 0xF033, 0x7001, 0x1202}, {}},
+        {"store", "FF55, all 16 registers",
+            {0xA300, 0xFF55, 0x7001, 0x1200}, {}},
+        {"load", "FE65, VF counts the passes",
+            {0xA300, 0xFE65, 0x7F01, 0x1200}, {}},
+        {"rnd", "CXNN",
+            {0xC0FF, 0xC10F, 0x7201, 0x1200}, {}},
+        {"cls", "00E0 after a draw",
+            {0xA000, 0xD015, 0x00E0, 0x7001, 0x1202}, {}},
+        // Game-like: read the delay timer, poll a key, move a sprite around and erase it, with a subroutine call
+        {"mix_game", "DT reads, key polls, two DXYN, CXNN and a call per pass",
+            {0xA000, 0x6020, 0x6110, 0xF207, 0xE59E, 0x7001, 0xD015, 0xD015, 0x8024, 0xC303, 0x8134, 0x2220, 0x1206,
+             0x0000, 0x0000, 0x0000, 0x7401, 0x00EE}, {}},
+        // Compute-like: ALU work with a data dependent branch and BCD output, no drawing
+        {"mix_compute", "ALU, skips, a call and FX33 per pass",
+            {0x6001, 0x6101, 0x8204, 0x8014, 0x8124, 0x3200, 0x7301, 0x8236, 0x9230, 0x7401, 0x2218, 0x1204,
+             0xA300, 0xF333, 0x00EE}, {}},
+    };
+    for (const int height : {1, 5, 15}) cases.push_back(drawCase(height, false));
+    cases.push_back(drawCase(8, true));
+    return cases;
+}
+
+std::vector<SetupCase> setupCases() {
+    static const std::vector<uint8_t> rom(CHIP8_MEMORY_SIZE - CHIP8_ADDR_PROGRAM_START, 0x12);
+    return {
+        {"initialize", "initialize(), whole VM reset", [](Chip8 &chip8) { chip8.initialize(); }},
+        {"reset_program", "reset_program(), program kept", [](Chip8 &chip8) { chip8.reset_program(); }},
+        {"load_program", "load_program() of a full 3584 byte ROM", [](Chip8 &chip8) { chip8.load_program(rom); }},
+    };
+}
+
+std::vector<RenderCase> renderCases() {
+    constexpr auto best = Chip8RenderKernel::Avx2;
+    return {
+        {"render_1x", "64x32 display, unscaled: expanded straight into the output", 64, 32, 1, 1, 0, best},
+        {"render_10x", "64x32 display scaled 10 times, the default window size", 64, 32, 1, 10, 0, best},
+        {"render_10x_scalar", "render_10x with the plain C++ kernels", 64, 32, 1, 10, 0, Chip8RenderKernel::Scalar},
+        {"render_10x_phosphor", "render_10x with phosphor persistence 192/256", 64, 32, 1, 10, 192, best},
+        {"render_hires_10x", "128x64 SUPER-CHIP display scaled 10 times", 128, 64, 1, 10, 0, best},
+        {"render_xo_4x", "128x64 XO-CHIP display with both planes, scaled 4 times", 128, 64, 2, 4, 0, best},
+    };
+}
+
+constexpr uint32_t CALIBRATION_INSTRUCTIONS = 200000; // Per run of the calibration loop
+volatile uint32_t calibration_sink;
+
+// Yardstick for the host: a switch dispatched toy interpreter that shares no code with the emulator. Cases are
+// kept in the baseline as multiples of it, which carries over between hosts far better than nanoseconds do.
+void runCalibration() {
+    // Eight registers, a byte table and a loop of adds, xors, shifts, table loads, a skip and a jump back
+    struct ToyOp {
+        uint8_t code, a, b;
+    };
+    static const ToyOp program[] = {
+        {0, 0, 1}, {1, 2, 0}, {2, 3, 1}, {3, 4, 2}, {0, 5, 4}, {4, 5, 0}, {1, 6, 5}, {3, 7, 6}, {0, 1, 7}, {5, 0, 0},
+    };
+    constexpr uint32_t length = sizeof(program) / sizeof(program[0]);
+    uint32_t table[256];
+    for (uint32_t i = 0; i < 256; ++i) table[i] = i * 0x9E3779B1u;
+    uint32_t regs[8] = {1, 2, 3, 4, 5, 6, 7, calibration_sink};
+
+    uint32_t pc = 0;
+    for (uint32_t i = 0; i < CALIBRATION_INSTRUCTIONS; ++i) {
+        const ToyOp &op = program[pc++];
+        switch (op.code) {
+            case 0: regs[op.a] += regs[op.b]; break;
+            case 1: regs[op.a] ^= regs[op.b] >> 3; break;
+            case 2: regs[op.a] = regs[op.a] << 1 | regs[op.b] >> 31; break;
+            case 3: regs[op.a] = table[(regs[op.a] ^ regs[op.b]) & 0xFF]; break;
+            case 4: if (regs[op.a] & 1) pc++; break;
+            default: pc = 0; break;
+        }
+        if (pc >= length) pc = 0;
+    }
+    calibration_sink = regs[0];
+}
+
+template <typename Function>
+double secondsOf(Function run) {
+    const auto begin = std::chrono::steady_clock::now();
+    run();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// Fastest of the repetitions, `ops` operations each. Every repetition is paired with a run of the calibration loop,
+// so both meet the host in the same state and its drift during the run mostly cancels out of `relative`.
+template <typename Function>
+MicrobenchTiming fastestTiming(int repetitions, double ops, Function run) {
+    double fastest = 0;
+    double fastest_calibration = 0;
+    for (int i = 0; i < repetitions; ++i) {
+        const double calibration = secondsOf(runCalibration);
+        const double seconds = secondsOf(run);
+        if (i == 0 || seconds < fastest) fastest = seconds;
+        if (i == 0 || calibration < fastest_calibration) fastest_calibration = calibration;
+    }
+    return {fastest * 1e9 / ops, fastest / ops / (fastest_calibration / CALIBRATION_INSTRUCTIONS)};
+}
+
+MicrobenchTiming timeRom(const RomCase &rom, const MicrobenchOptions &options) {
+    std::vector<uint8_t> bytes;
+    for (const uint16_t word : rom.code) {
+        bytes.push_back(word >> 8);
+        bytes.push_back(word & 0xFF);
+    }
+    bytes.insert(bytes.end(), rom.data.begin(), rom.data.end());
+
+    // Machines carry their decoded instruction cache inline, keep it off the stack
+    auto chip8 = std::make_unique<Chip8>();
+    chip8->initialize();
+    chip8->load_program(bytes);
+    // Decode every instruction of the loop before timing
+    chip8->run_cycles(1000);
+    if (chip8->get_halt() != Chip8Halt::None || chip8->get_idle() != Chip8Idle::None)
+        std::cerr << rom.name << " stopped running its loop, the timing is meaningless" << std::endl;
+
+    return fastestTiming(options.repetitions, options.cycles, [&] { chip8->run_cycles(options.cycles); });
+}
+
+MicrobenchTiming timeSetup(const SetupCase &setup, const MicrobenchOptions &options) {
+    auto chip8 = std::make_unique<Chip8>();
+    chip8->initialize();
+    return fastestTiming(options.repetitions, options.calls, [&] {
+        for (uint32_t i = 0; i < options.calls; ++i) setup.call(*chip8);
+    });
+}
+
+MicrobenchTiming timeRender(const RenderCase &render, const MicrobenchOptions &options) {
+    Chip8Renderer renderer(render.width, render.height, render.planes, render.scale);
+    if (!renderer.set_kernel(render.kernel))
+        std::cerr << render.name << " runs on another kernel, this CPU lacks the one it times" << std::endl;
+    renderer.set_persistence(render.persistence);
+    std::mt19937_64 rng(1);
+    std::vector<uint64_t> displays[2];
+    for (std::vector<uint64_t> &gfx : displays) {
+        gfx.resize(render.planes * render.height * render.width / 64);
+        for (uint64_t &word : gfx) word = rng();
+    }
+    std::vector<uint32_t> pixels(size_t(renderer.get_width()) * renderer.get_height());
+    const int pitch = renderer.get_width() * sizeof(uint32_t);
+
+    return fastestTiming(options.repetitions, double(options.renders) * pixels.size(), [&] {
+        for (uint32_t i = 0; i < options.renders; ++i)
+            renderer.render(displays[i % 2].data(), 0, render.height, pixels.data(), pitch);
+    });
+}
+
+// name,ns_per_op,relative lines, # starts a comment. Baselines from before the calibration loop lack relative
+bool readBaseline(const std::string &path, std::map<std::string, MicrobenchTiming> &baseline) {
+    std::ifstream file(path);
+    if (!file) return false;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#' || line.rfind("name,", 0) == 0) continue;
+        const size_t comma = line.find(',');
+        if (comma == std::string::npos) return false;
+        MicrobenchTiming &timing = baseline[line.substr(0, comma)];
+        timing.ns_per_op = std::stod(line.substr(comma + 1));
+        const size_t second = line.find(',', comma + 1);
+        if (second != std::string::npos) timing.relative = std::stod(line.substr(second + 1));
+    }
+    return true;
+}
+
+bool writeBaseline(const std::string &path, const std::vector<MicrobenchResult> &results) {
+    std::ofstream file(path);
+    if (!file) return false;
+    file << "# Written by chip8_microbench --write-baseline, nanoseconds per instruction (per call for setup cases, per"
+         << " output pixel for render cases)" << std::endl
+         << "# and the same in instructions of the calibration loop, which --baseline compares" << std::endl
+         << "name,ns_per_op,relative" << std::endl;
+    for (const MicrobenchResult &r : results)
+        file << r.name << "," << r.timing.ns_per_op << "," << r.timing.relative << std::endl;
+    return static_cast<bool>(file);
+}
+
+int main(int argc, char* argv[]) {
+    MicrobenchOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+    std::map<std::string, MicrobenchTiming> baseline;
+    if (!options.baseline_path.empty() && !readBaseline(options.baseline_path, baseline)) {
+        std::cout << "Failed to read baseline " << options.baseline_path << std::endl;
+        return 1;
+    }
+
+    auto selected = [&](const std::string &name) { return name.find(options.filter) != std::string::npos; };
+    if (options.list) {
+        for (const RomCase &rom : romCases())
+            if (selected(rom.name)) std::cout << rom.name << ": " << rom.description << std::endl;
+        for (const SetupCase &setup : setupCases())
+            if (selected(setup.name)) std::cout << setup.name << ": " << setup.description << std::endl;
+        for (const RenderCase &render : renderCases())
+            if (selected(render.name)) std::cout << render.name << ": " << render.description << ", ns per output pixel" << std::endl;
+        return 0;
+    }
+
+    std::vector<MicrobenchResult> results;
+    for (const RomCase &rom : romCases())
+        if (selected(rom.name)) results.push_back({rom.name, [&options, rom] { return timeRom(rom, options); }});
+    for (const SetupCase &setup : setupCases())
+        if (selected(setup.name)) results.push_back({setup.name, [&options, setup] { return timeSetup(setup, options); }});
+    for (const RenderCase &render : renderCases())
+        if (selected(render.name)) results.push_back({render.name, [&options, render] { return timeRender(render, options); }, true});
+    for (MicrobenchResult &r : results) r.timing = r.time();
+
+    // Relative to the calibration loop, so a baseline from another host or another run of a noisy one still
+    // applies. Nanoseconds only for a baseline that predates the calibration loop
+    auto ratio_of = [](const MicrobenchTiming &timing, const MicrobenchTiming &base) {
+        if (base.relative > 0) return timing.relative / base.relative;
+        return base.ns_per_op > 0 ? timing.ns_per_op / base.ns_per_op : 0;
+    };
+    int regressions = 0;
+    std::cout << "name,ns_per_op,relative,baseline,ratio,status" << std::endl;
+    for (MicrobenchResult &r : results) {
+        const auto it = baseline.find(r.name);
+        if (it != baseline.end()) r.baseline = it->second;
+        double ratio = ratio_of(r.timing, r.baseline);
+        if (ratio > 1 + options.tolerance) {
+            // One disturbed pass is not a regression, the case has to be slow twice
+            const MicrobenchTiming again = r.time();
+            const double again_ratio = ratio_of(again, r.baseline);
+            if (again_ratio < ratio) {
+                r.timing = again;
+                ratio = again_ratio;
+            }
+        }
+        const char *status = "";
+        if (!options.baseline_path.empty()) {
+            if (ratio <= 0) status = "new";
+            else if (ratio > 1 + options.tolerance) status = "REGRESSION";
+            else if (ratio < 1 / (1 + options.tolerance)) status = "faster";
+            else status = "ok";
+        }
+        if (std::string(status) == "REGRESSION") regressions++;
+        std::cout << r.name << "," << r.timing.ns_per_op << "," << r.timing.relative << ","
+                  << (r.baseline.relative > 0 ? r.baseline.relative : r.baseline.ns_per_op) << "," << ratio << ","
+                  << status << std::endl;
+    }
+    // Throughput of the render cases after the table, as comments
+    for (const MicrobenchResult &r : results)
+        if (r.render) std::cout << "# " << r.name << ": " << 1e3 / r.timing.ns_per_op << " Mpixels/s" << std::endl;
+
+    if (!options.write_baseline_path.empty() && !writeBaseline(options.write_baseline_path, results)) {
+        std::cout << "Failed to write baseline " << options.write_baseline_path << std::endl;
+        return 1;
+    }
+    if (regressions > 0) {
+        std::cerr << regressions << " cases more than " << options.tolerance * 100 << "% slower than "
+                  << options.baseline_path << std::endl;
+        return 2;
+    }
+    return 0;
+}
@@ -1,45 +1,267 @@
 // #define __EMSCRIPTEN__
 #ifndef CHIP8_H
 #define CHIP8_H
+#include <cstddef>
 #include <cstdint>
-#include <random>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
 #include <emscripten/bind.h>
 #include <emscripten/val.h>
 #endif //__EMSCRIPTEN__
 
+// Dimensions of the original machine, see the policies below for the extended variants
 #define CHIP8_DISPLAY_WIDTH 64
 #define CHIP8_DISPLAY_HEIGHT 32
 #define CHIP8_MEMORY_SIZE 4096
 #define CHIP8_REGISTER_COUNT 16
 #define CHIP8_ADDR_PROGRAM_START 0x200 // Start address of CHIP-8's program
+#define CHIP8_MAX_PROGRAM_SIZE (CHIP8_MEMORY_SIZE - CHIP8_ADDR_PROGRAM_START) // Largest ROM that fits in memory
 #define CHIP8_STACK_SIZE 16
 #define CHIP8_KEY_SIZE 16
+#define CHIP8_SNAPSHOT_MAGIC "C8SS"
+#define CHIP8_SNAPSHOT_VERSION 4
+#define CHIP8_SNAPSHOT_HEADER_SIZE 12 // Magic, uint16 version, uint16 reserved, uint32 total size
+#define CHIP8_DEFAULT_SEED 0x2545F491u // Used by initialize() until seed() is called, keeps CXNN reproducible
+#define CHIP8_IDLE_PROBE_INTERVAL 8 // Backward jumps between two recordings of the idle probe
+#define CHIP8_ADDR_BIG_FONT 0x50 // SUPER-CHIP 8x10 digits, right after the 4x5 ones
 #define CHIP8_TIMER_PERIOD_MICROSECONDS ((1000.0 / 60) * 1000.0) // Timers are at a constant 60 Hz, for now
+#define CHIP8_TIMER_HZ 60 // Also the frame rate run_frame() steps at
+#define CHIP8_DEFAULT_CPU_HZ 1000
+#define CHIP8_VIP_CYCLE_HZ 220113 // COSMAC VIP machine cycles per second, 8 clocks each at 1.7609 MHz
+#define CHIP8_VIP_DISPLAY_CYCLES 1024 // Taken from every frame by the display DMA, 8 bytes on each of 128 lines
+#define CHIP8_VIP_CPU_HZ (CHIP8_VIP_CYCLE_HZ - CHIP8_VIP_DISPLAY_CYCLES * CHIP8_TIMER_HZ) // Left to the interpreter
+#define CHIP8_TRACE_SIZE 256 // Instructions kept by the trace ring, a power of two
+// The interpreter traces every instruction unless built with CHIP8_TRACE=0, faults are counted either way
+#ifndef CHIP8_TRACE
+#define CHIP8_TRACE 1
+#endif
+// Computed goto dispatch is a GNU extension, other compilers fall back to a switch
+#if defined(__GNUC__) || defined(__clang__)
+#define CHIP8_THREADED_DISPATCH 1
+#else
+#define CHIP8_THREADED_DISPATCH 0
+#endif
+// Instruction set a ROM was written for
+enum class Chip8Variant : uint8_t {
+    Unknown,
+    Chip8, // The original 35 instructions only
+    SuperChip, // Uses SUPER-CHIP extensions (high resolution, scrolling, large sprites...)
+    XoChip // Uses XO-CHIP extensions (planes, long I loads, audio patterns...)
+};
+
+// How run_frame() measures a frame, see set_timing()
+enum class Chip8Timing : uint8_t {
+    Instructions, // Every instruction costs 1, cpu_hz is instructions per second (the default)
+    CosmacVip // Approximate machine cycles the COSMAC VIP interpreter spends on each instruction, DXYN waits for
+              // the vertical blank; cpu_hz is machine cycles per second
+};
+
+// Why a VM stopped making progress
+enum class Chip8Halt : uint8_t {
+    None, // Running normally
+    WaitingForKey, // Blocked on FX0A until a key is pressed
+    UnknownOpcode, // Stuck on an instruction the interpreter does not implement
+    Exited, // SUPER-CHIP 00FD, stays on it until reset
+    StackFault // Stuck on a 2NNN with all 16 stack entries in use, or a 00EE with none
+};
+// What an idle VM is waiting for, see Chip8::get_idle()
+enum class Chip8Idle : uint8_t {
+    None, // Doing work, or not known to be idle
+    UntilTimer, // Spinning on the delay timer, nothing changes before the next timer tick
+    UntilKey, // Spinning on the keypad (or blocked on FX0A), nothing changes before a key event
+    Forever // Spinning on nothing external, only a reset or a new state gets it out
+};
+
+// Misbehaviour the interpreter counts and keeps a trace of, see Chip8::take_fault_trace()
+enum class Chip8Fault : uint8_t {
+    None,
+    UnknownOpcode, // An instruction this variant does not implement, the VM halts on it
+    StackOverflow, // 2NNN with the stack full, the VM halts on it
+    StackUnderflow, // 00EE with the stack empty, the VM halts on it
+    AddressOverflow, // A memory access from I ran past the end of memory and wrapped around to 0
+    Count
+};
+
+// One instruction of a trace dump
+struct Chip8TraceRecord {
+    uint16_t pc;
+    uint16_t opcode; // First word only, for XO-CHIP F000 NNNN too
+    uint16_t idx_register; // I before the instruction
+};
+
+// The last instructions a VM ran and its state after them, oldest record first
+struct Chip8TraceDump {
+    Chip8Variant variant;
+    Chip8Fault fault; // What caused the dump, None if it was asked for
+    uint16_t pc; // Of the faulting instruction, the last record
+    uint16_t sp;
+    uint32_t count; // Records in use, at most CHIP8_TRACE_SIZE
+    uint64_t instructions; // Instructions traced since initialize() or fork(), the last record is number
+                           // instructions - 1. Those run while a fault trace was pending are not counted.
+    uint8_t registers_v[CHIP8_REGISTER_COUNT];
+    uint16_t stack[CHIP8_STACK_SIZE];
+    Chip8TraceRecord records[CHIP8_TRACE_SIZE];
+};
+
+#if CHIP8_PROFILE
+#define CHIP8_PROFILE_OP_SLOTS 64 // At least as many as Chip8's decoded handlers
+// Interpreter counters, only compiled in with CHIP8_PROFILE. Instructions run by Chip8Jit natively are not seen.
+struct Chip8Profile {
+    uint64_t op_counts[CHIP8_PROFILE_OP_SLOTS] = {}; // Executions per decoded handler, slot 0 counts decodes
+    uint64_t address_hits[CHIP8_MEMORY_SIZE] = {}; // Instructions fetched from each address (XO-CHIP wraps at 4 KB)
+    uint8_t address_op[CHIP8_MEMORY_SIZE] = {}; // Handler last executed at each address
+    uint64_t key_wait_stalls = 0; // FX0A executions that found no key pressed
+};
+#endif
+
+// Machine policies, picked at compile time so the interpreter of each variant only contains its own behaviour.
+// Derive from one and override members to model another interpreter, then instantiate Chip8Machine with it at
+// the end of Chip8.cpp.
+struct Chip8ClassicPolicy {
+    static constexpr Chip8Variant variant = Chip8Variant::Chip8;
+    static constexpr uint32_t memory_size = CHIP8_MEMORY_SIZE;
+    static constexpr int display_width = CHIP8_DISPLAY_WIDTH;
+    static constexpr int display_height = CHIP8_DISPLAY_HEIGHT;
+    static constexpr int display_planes = 1;
+    // Quirks, where interpreters disagree
+    static constexpr bool shift_uses_vy = false; // 8XY6 / 8XYE shift VY into VX instead of shifting VX in place
+    static constexpr bool load_store_increments_i = true; // FX55 / FX65 leave I past the last register
+    static constexpr bool jump_uses_vx = false; // BXNN jumps to XNN + VX instead of BNNN to NNN + V0
+    static constexpr bool clip_sprites = true; // Sprites are cut at the display edges instead of wrapping
+    static constexpr bool logic_resets_vf = false; // 8XY1 / 8XY2 / 8XY3 clear VF
+    static constexpr bool count_collision_rows = false; // High resolution DXYN sets VF to the rows that collided
+};
+
+// SUPER-CHIP 1.1: 128x64 high resolution mode, scrolling, 16x16 sprites, big digits and RPL flags
+struct Chip8SuperChipPolicy : Chip8ClassicPolicy {
+    static constexpr Chip8Variant variant = Chip8Variant::SuperChip;
+    static constexpr int display_width = 128;
+    static constexpr int display_height = 64;
+    static constexpr bool load_store_increments_i = false;
+    static constexpr bool jump_uses_vx = true;
+    static constexpr bool count_collision_rows = true;
+};
+
+// XO-CHIP: SUPER-CHIP plus 64 KB of memory, two bitplanes, long I loads and audio patterns
+struct Chip8XoChipPolicy : Chip8ClassicPolicy {
+    static constexpr Chip8Variant variant = Chip8Variant::XoChip;
+    static constexpr uint32_t memory_size = 65536;
+    static constexpr int display_width = 128;
+    static constexpr int display_height = 64;
+    static constexpr int display_planes = 2;
+    static constexpr bool shift_uses_vy = true;
+    static constexpr bool clip_sprites = false;
+};
+
 /**
  * @brief A class representing Chip-8 virtual machine.
  *
- * This class simulates the basic architecture of the Chip-8 VM,
- * currently only the original 35 instructions are supported.
+ * This class simulates the basic architecture of the Chip-8 VM. The instruction set, memory and display size and
+ * quirks come from Policy, so each variant is its own type with its own interpreter loop: the original machine
+ * (Chip8) runs the 35 original instructions without checking for anything else, Chip8SuperChip and Chip8XoChip
+ * add their extensions. Extended variants have a 128x64 display and draw low resolution pixels as 2x2 blocks.
+ * All state lives inline and is trivially copyable, see fork() for branching a running VM.
  */
-class Chip8 {
+template <typename Policy>
+class Chip8Machine {
+    friend class Chip8Aot;
+    friend class Chip8Batch;
+    friend class Chip8Jit;
     public:
-    Chip8();
+    static constexpr Chip8Variant variant = Policy::variant;
+    static constexpr uint32_t memory_size = Policy::memory_size;
+    static constexpr int display_width = Policy::display_width;
+    static constexpr int display_height = Policy::display_height;
+    static constexpr int display_planes = Policy::display_planes;
+    static constexpr int words_per_row = display_width / 64;
+    static constexpr uint32_t max_program_size = memory_size - CHIP8_ADDR_PROGRAM_START;
+    static constexpr uint64_t all_rows_dirty = display_height == 64 ? ~0ull : (1ull << display_height) - 1;
+    static_assert((memory_size & (memory_size - 1)) == 0 && memory_size <= 65536, "Addresses are masked to 16 bits");
+    static_assert(display_width % 64 == 0 && display_height <= 64, "Rows are packed into whole words");
+
+    Chip8Machine();
     void initialize();
+    void seed(uint32_t seed); // Seeds the CXNN generator, 0 picks CHIP8_DEFAULT_SEED; kept across initialize()
+    // Copies the machine state into destination, which keeps its own attached JIT, profile and decoded instructions
+    // (dropping those where its memory differed) and starts a new trace
+    void fork(Chip8Machine &destination) const;
+    [[nodiscard]] std::unique_ptr<Chip8Machine> clone() const; // Same as fork() into a new VM with nothing attached
     void reset_program();
-    void load_program(const std::string& filename); // method for loading directly from file
-    void load_program(const std::vector<uint8_t> & program); // method for loading from vector
+    // The load_program() variants return false, leaving memory untouched, if the ROM is larger than
+    // max_program_size (or the file cannot be read)
+    bool load_program(const std::string& filename); // method for loading directly from file
+    bool load_program(const std::vector<uint8_t> & program); // method for loading from vector
+    bool load_program(const uint8_t *program, size_t size); // method for loading from memory, e.g. a Chip8RomStore
     void dump_memory(std::ostream & os) const;
     void dump_memory() const;
     void run();
-    [[nodiscard]] const uint8_t* get_gfx() const;
+    // Budgets below are in cycles of the timing profile, instructions unless set_timing() picked another. An
+    // instruction that overruns its budget runs whole, and the next budget is that much smaller
+    void run_cycles(uint32_t cycles); // Execute `cycles` worth of instructions in one go, timers are not touched
+    uint32_t run_frame(); // Execute one 60 Hz frame's worth of instructions, then tick the timers; returns the frame's cycles
+    void set_cpu_hz(uint32_t hz); // Cycles per second run_frame() spreads over 60 frames (default 1000)
+    // Selects the cost table instructions are charged from, resets cpu_hz to the profile's native rate (scale it
+    // afterwards for multiples of the original speed) and the vertical blank wait to the profile's default.
+    // Chip8Jit, Chip8Aot and Chip8Batch count instructions and need Chip8Timing::Instructions
+    void set_timing(Chip8Timing timing);
+    [[nodiscard]] Chip8Timing get_timing() const;
+    void set_vblank_wait(bool wait); // DXYN ends the frame, the next instruction runs after the timers tick
+    [[nodiscard]] Chip8Idle get_idle() const; // Whether the last run ended in an idle loop, and what would end it
+    // Advances `frames` frames without running them, only if idle UntilKey or Forever (the caller must not feed
+    // input meanwhile). False if nothing was skipped, otherwise `instructions` gets the count they stood for
+    bool skip_idle_frames(uint64_t frames, uint64_t *instructions = nullptr);
+    // Cycles of budget given up so far without running anything: idle loop iterations, FX0A and 00FD, vertical
+    // blank waits and skip_idle_frames(). Only ever grows, take the difference across a run
+    [[nodiscard]] uint64_t get_skipped_cycles() const;
+    // words_per_row words per row, bit 63 of the first word is the leftmost pixel; the planes follow each other
+    [[nodiscard]] const uint64_t* get_gfx_packed() const;
+    void get_gfx(uint8_t *pixels) const; // Unpacks the display into display_width * display_height bytes, bit N set if plane N is lit
+    uint64_t take_dirty_rows(); // Rows changed since the previous call (bit N is row N), clears them
+    [[nodiscard]] bool is_high_resolution() const; // Extended variants only, after 00FF
     void set_input_key(uint8_t key, bool is_pressed);
+    [[nodiscard]] uint16_t get_input_keys() const; // Bit N set while key N is pressed
     void update_timers();
+    [[nodiscard]] const uint8_t* get_registers() const; // V0 to VF
+    [[nodiscard]] uint16_t get_pc() const;
+    [[nodiscard]] uint16_t get_idx_register() const;
+    [[nodiscard]] uint16_t get_sp() const;
+    [[nodiscard]] Chip8Halt get_halt() const;
+    [[nodiscard]] uint8_t get_delay_timer() const;
+    [[nodiscard]] uint8_t get_sound_timer() const; // The beeper sounds while it is not 0
+    [[nodiscard]] const uint8_t* get_audio_pattern() const; // XO-CHIP F002 pattern (16 bytes), nullptr on the others
+    [[nodiscard]] uint8_t get_audio_pitch() const; // XO-CHIP FX3A
+    // Execution trace, for post-mortem debugging. The interpreter keeps the last CHIP8_TRACE_SIZE instructions in
+    // a ring, which stops moving at the first fault since the previous take_fault_trace() until that call reads it
+    // out; a fault repeating at the same address is only counted. Instructions run by Chip8Jit or Chip8Aot natively
+    // are not traced.
+    [[nodiscard]] uint32_t get_fault_count(Chip8Fault fault) const; // Times it happened since initialize()
+    bool take_fault_trace(Chip8TraceDump &dump); // False if there was no fault since the previous call
+    void dump_trace(Chip8TraceDump &dump) const; // The ring as it is now, fault None
+    // Binary savestates, see snapshot() in Chip8.cpp for the layout
+    [[nodiscard]] static constexpr size_t snapshot_size() {
+        return CHIP8_SNAPSHOT_HEADER_SIZE + sizeof(memory) + sizeof(gfx) + sizeof(registers_v) + sizeof(stack)
+               + sizeof(sp) + sizeof(pc) + sizeof(idx_register) + sizeof(delay_timer) + sizeof(sound_timer)
+               + sizeof(input_keys) + sizeof(halt) + sizeof(rng_state) + sizeof(frame_remainder) + sizeof(cycle_debt)
+               + (variant != Chip8Variant::Chip8 ? sizeof(extended) : 0);
+    }
+    size_t snapshot(uint8_t *buffer, size_t capacity) const; // Returns bytes written, 0 if the buffer is too small
+    bool restore(const uint8_t *buffer, size_t size); // False, with the state untouched, if the snapshot is invalid
+#if CHIP8_PROFILE
+    [[nodiscard]] const Chip8Profile& get_profile() const;
+    void reset_profile();
+    // Flat CSV summary, or folded stacks (root;group;instruction;address count) for flamegraph.pl
+    // Note: the address column shows the instruction that last ran there, which self-modifying code may change
+    void write_profile(std::ostream &os, bool folded, const std::string &root = "chip8") const;
+#endif
     bool draw_gfx = false;
     private:
-    uint8_t gfx[CHIP8_DISPLAY_WIDTH * CHIP8_DISPLAY_HEIGHT] = {}; // Display is 64 x 32
-    uint8_t memory[CHIP8_MEMORY_SIZE] = {};
+    uint64_t gfx[display_planes][display_height][words_per_row] = {}; // Packed one bit per pixel
+    uint64_t dirty_rows = 0; // Bit N set when row N changed since the last take_dirty_rows()
+    uint8_t memory[memory_size] = {};
     uint8_t registers_v[CHIP8_REGISTER_COUNT] = {};
     uint16_t stack[CHIP8_STACK_SIZE] = {};
     uint8_t input_keys[CHIP8_KEY_SIZE] = {};
@@ -49,11 +271,114 @@ class Chip8 {
     uint16_t opcode = 0; // Current fetched opcode
     uint8_t delay_timer = 0;
     uint8_t sound_timer = 0;
-    std::random_device random_device;
-    std::mt19937 rng;
-    std::uniform_int_distribution<int> dist;
+    Chip8Halt halt = Chip8Halt::None;
+    uint32_t rng_seed = CHIP8_DEFAULT_SEED;
+    uint32_t rng_state = CHIP8_DEFAULT_SEED; // xorshift32, never 0
+    uint32_t cpu_hz = CHIP8_DEFAULT_CPU_HZ;
+    uint32_t frame_remainder = 0; // cpu_hz cycles left over from previous frames, in 1/60ths of a cycle
+    uint32_t cycle_debt = 0; // Cycles the last instruction ran past its budget, taken off the next one
+    Chip8Timing timing = Chip8Timing::Instructions;
+    bool vblank_wait = false;
+    // Only used, and saved, by the extended variants
+    struct ExtendedState {
+        uint8_t high_resolution;
+        uint8_t plane_mask; // Planes drawn, cleared and scrolled (XO-CHIP FN01)
+        uint8_t pitch; // XO-CHIP FX3A, 64 is 4000 Hz
+        uint8_t flags[16]; // RPL user flags, FX75 / FX85
+        uint8_t audio_pattern[16]; // XO-CHIP F002, 128 one-bit samples
+    };
+    ExtendedState extended = {0, 1, 64, {}, {}};
+
+    // Idle loop detection. A backward jump reached twice with the same registers, and with no memory or display
+    // writes in between, starts a loop that repeats identically until input or timers change, so the rest of the
+    // cycle budget only needs to run modulo its length.
+    struct IdleProbe {
+        uint32_t pc; // Address of the backward jump, memory_size when unset
+        uint32_t cycles_left; // Budget left when the jump was seen
+        uint32_t side_effects;
+        uint32_t timer_reads;
+        uint32_t key_reads;
+        uint32_t rng_state;
+        uint16_t idx_register;
+        uint16_t sp;
+        uint8_t delay_timer;
+        uint8_t sound_timer;
+        uint8_t registers_v[CHIP8_REGISTER_COUNT];
+    };
+    IdleProbe idle_probe = {};
+    uint32_t idle_probe_countdown = 0; // Failed probes left before the next jump gets recorded instead
+    uint32_t side_effects = 0; // Memory and display writes so far, only ever compared for changes
+    uint32_t timer_reads = 0; // FX07 executions
+    uint32_t key_reads = 0; // EX9E / EXA1 / FX0A executions
+    Chip8Idle idle = Chip8Idle::None;
+    uint32_t idle_loop_length = 0; // Instructions per iteration of the idle loop
+    uint64_t skipped_cycles = 0; // See get_skipped_cycles()
+    uint64_t trace_head = 0; // Records written to the trace ring, the next goes to trace[trace_head % CHIP8_TRACE_SIZE]
+    uint32_t fault_counts[static_cast<int>(Chip8Fault::Count)] = {};
+    Chip8Fault last_fault = Chip8Fault::None;
+    uint16_t last_fault_pc = 0;
+    bool fault_trace_pending = false;
+    // The rest of the machine at the pending fault, take_fault_trace() adds the ring to it
+    uint16_t fault_sp = 0;
+    uint8_t fault_registers_v[CHIP8_REGISTER_COUNT] = {};
+    uint16_t fault_stack[CHIP8_STACK_SIZE] = {};
+
+    // Notified whenever memory that may hold code is rewritten, so an attached JIT can drop stale blocks
+    void (*code_write_hook)(void *context, uint16_t address, uint32_t length) = nullptr;
+    void *code_write_context = nullptr;
+
+    // fork() copies everything above this line and nothing below: the trace and profile only describe this VM's
+    // own past, and the decoded instructions follow from memory
+
+    // Execution trace, one store per instruction: PC | I << 16 | decoded NNN << 32 | handler << 48, the opcode is
+    // only put back together by dump_trace(). While a fault trace is pending the head stays put and each new
+    // record overwrites the oldest one, keeping the instructions that led up to the fault.
+    uint64_t trace[CHIP8_TRACE_SIZE] = {};
+#if CHIP8_PROFILE
+    Chip8Profile profile;
+#endif
+
+    // Handlers of the decoded instruction cache, DECODE marks an entry that has not been decoded yet
+    enum Op : uint8_t {
+        OP_DECODE, OP_CLS, OP_RET, OP_STALL, OP_JP, OP_CALL, OP_SE_VX_NN, OP_SNE_VX_NN, OP_SE_VX_VY,
+        OP_LD_VX_NN, OP_ADD_VX_NN, OP_LD_VX_VY, OP_OR, OP_AND, OP_XOR, OP_ADD_VX_VY, OP_SUB, OP_SHR,
+        OP_SUBN, OP_SHL, OP_SNE_VX_VY, OP_LD_I, OP_JP_V0, OP_RND, OP_DRW, OP_SKP, OP_SKNP, OP_LD_VX_DT,
+        OP_LD_VX_K, OP_LD_DT, OP_LD_ST, OP_ADD_I, OP_LD_F, OP_LD_B, OP_LD_I_VX, OP_LD_VX_I, OP_UNKNOWN,
+        // SUPER-CHIP
+        OP_SCD, OP_SCR, OP_SCL, OP_EXIT, OP_LOW, OP_HIGH, OP_LD_HF, OP_LD_R_VX, OP_LD_VX_R,
+        // XO-CHIP
+        OP_SCU, OP_SAVE_VX_VY, OP_LOAD_VX_VY, OP_LD_I_LONG, OP_PLANE, OP_AUDIO, OP_PITCH,
+        OP_COUNT
+    };
+    // An instruction decoded once, with its operands already extracted from the opcode
+    struct DecodedOp {
+        uint8_t handler; // One of Op
+        uint8_t x; // Register index X
+        uint8_t y; // Register index Y
+        uint8_t nn; // Immediate NN, or N for DXYN
+        uint16_t nnn; // Address NNN, the whole second word of F000 NNNN, or the whole opcode of STALL and UNKNOWN
+        uint16_t cost; // Cycles charged under the timing profile, 0 until decoded
+    };
+    DecodedOp decoded[memory_size] = {}; // Filled lazily by execute(), indexed by instruction address
 
-    const uint8_t font_set[80] =
+    void execute(uint32_t cycles);
+    void decode_at(uint16_t address);
+    uint16_t cycle_cost(const DecodedOp &op) const;
+    void invalidate_decoded(uint16_t address, uint32_t length);
+    // Copies data to address, invalidating decoded instructions only in the chunks that changed
+    void rewrite_memory(uint32_t address, const uint8_t *data, uint32_t length);
+    uint16_t skip_length() const; // How far a taken skip advances PC, XO-CHIP skips F000 NNNN whole
+    uint8_t draw_extended(uint8_t x, uint8_t y, uint8_t n); // DXYN of the extended variants, returns VF
+    bool xor_sprite_row(int plane, int y, int x, uint64_t sprite);
+    void clear_planes();
+    void scroll_vertical(int rows); // Down if positive
+    void scroll_horizontal(int pixels); // Right if positive
+    uint8_t next_random();
+    bool probe_idle(uint32_t cycles_left);
+    void fault(Chip8Fault kind); // Counts it, and dumps the trace unless a dump is pending or it just happened here
+    void check_index_range(uint32_t length); // Faults if length bytes from I run past the end of memory
+
+    static constexpr uint8_t font_set[80] =
     {
         0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
         0x20, 0x60, 0x20, 0x20, 0x70, // 1
@@ -72,26 +397,111 @@ class Chip8 {
         0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
         0xF0, 0x80, 0xF0, 0x80, 0x80  // F
       };
+    // Loaded at CHIP8_ADDR_BIG_FONT by the extended variants, FX30
+    static constexpr uint8_t big_font_set[160] =
+    {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+      };
 };
+
+using Chip8 = Chip8Machine<Chip8ClassicPolicy>;
+using Chip8SuperChip = Chip8Machine<Chip8SuperChipPolicy>;
+using Chip8XoChip = Chip8Machine<Chip8XoChipPolicy>;
+
+// Instantiated in Chip8.cpp
+extern template class Chip8Machine<Chip8ClassicPolicy>;
+extern template class Chip8Machine<Chip8SuperChipPolicy>;
+extern template class Chip8Machine<Chip8XoChipPolicy>;
 #ifdef __EMSCRIPTEN__
-// Binding code
+// Binding code, the same interface for every variant
+template <typename Machine>
+void bind_chip8(const char *name) {
+    emscripten::class_<Machine>(name)
+        .template constructor()
+        .function("initialize", &Machine::initialize)
+        .function("seed", &Machine::seed)
+        .function("fork", &Machine::fork)
+        .function("resetProgram", &Machine::reset_program)
+        .function("loadProgram", static_cast<bool(Machine::*)(const std::vector<uint8_t> &)>(&Machine::load_program))
+        .function("dumpMemory", static_cast<void(Machine::*)()const>(&Machine::dump_memory))
+        .function("run", &Machine::run)
+        .function("runCycles", &Machine::run_cycles)
+        .function("runFrame", &Machine::run_frame)
+        .function("setCpuHz", &Machine::set_cpu_hz)
+        .function("setTiming", emscripten::optional_override([](Machine& chip, int timing) {
+            // 0 counts instructions, 1 uses COSMAC VIP cycle costs
+            chip.set_timing(timing == 1 ? Chip8Timing::CosmacVip : Chip8Timing::Instructions);
+        }))
+        .function("setVblankWait", &Machine::set_vblank_wait)
+        .function("getIdle", emscripten::optional_override([](const Machine& chip) {
+            return static_cast<int>(chip.get_idle());
+        }))
+        .function("updateTimers", &Machine::update_timers)
+        .function("getGfx", emscripten::optional_override([](const Machine& chip) {
+            // Unpacked on demand, the view is only valid until the next call
+            static uint8_t pixels[Machine::display_width * Machine::display_height];
+            chip.get_gfx(pixels);
+            return emscripten::val(emscripten::typed_memory_view(sizeof(pixels), pixels));
+        }))
+        .function("getGfxPacked", emscripten::optional_override([](const Machine& chip) {
+            // Two 32-bit words per 64 pixels, low half first (WASM is little-endian)
+            constexpr size_t words = Machine::display_planes * Machine::display_height * Machine::words_per_row * 2;
+            return emscripten::val(emscripten::typed_memory_view(words, reinterpret_cast<const uint32_t*>(chip.get_gfx_packed())));
+        }))
+        .function("getRegisters", emscripten::optional_override([](const Machine& chip) {
+            // Live view of V0-VF, stays valid for the lifetime of the VM
+            return emscripten::val(emscripten::typed_memory_view(CHIP8_REGISTER_COUNT, chip.get_registers()));
+        }))
+        .function("takeDirtyRows", emscripten::optional_override([](Machine& chip) {
+            // JS numbers hold 32 bits, on 64-row displays bit N stands for rows 2N and 2N + 1
+            uint64_t rows = chip.take_dirty_rows();
+            if (Machine::display_height <= 32) return static_cast<uint32_t>(rows);
+            rows = (rows | rows >> 1) & 0x5555555555555555ull;
+            uint32_t folded = 0;
+            for (int bit = 0; bit < 32; ++bit)
+                folded |= static_cast<uint32_t>((rows >> (bit * 2)) & 1) << bit;
+            return folded;
+        }))
+        .function("isHighResolution", &Machine::is_high_resolution)
+        .class_function("snapshotSize", &Machine::snapshot_size)
+        .function("snapshot", emscripten::optional_override([](const Machine& chip) {
+            // Shared buffer, copy the view out before the next call if it needs to be kept
+            static uint8_t buffer[Machine::snapshot_size()];
+            chip.snapshot(buffer, sizeof(buffer));
+            return emscripten::val(emscripten::typed_memory_view(sizeof(buffer), buffer));
+        }))
+        .function("snapshotInto", emscripten::optional_override([](const Machine& chip, uintptr_t address, size_t capacity) {
+            // Writes straight into a buffer allocated with _malloc, no copy on the JS side
+            return chip.snapshot(reinterpret_cast<uint8_t*>(address), capacity);
+        }))
+        .function("restore", emscripten::optional_override([](Machine& chip, uintptr_t address, size_t size) {
+            return chip.restore(reinterpret_cast<const uint8_t*>(address), size);
+        }))
+        .function("setInputKey", &Machine::set_input_key)
+        .property("drawGfx", &Machine::draw_gfx);
+}
+
 EMSCRIPTEN_BINDINGS(chip8_class) {
     emscripten::register_vector<uint8_t>("Uint8Vector");
 
-
-    emscripten::class_<Chip8>("Chip8")
-        .constructor()
-        .function("initialize", &Chip8::initialize)
-        .function("resetProgram", &Chip8::reset_program)
-        .function("loadProgram", static_cast<void(Chip8::*)(const std::vector<uint8_t> &)>(&Chip8::load_program))
-        .function("dumpMemory", static_cast<void(Chip8::*)()const>(&Chip8::dump_memory))
-        .function("run", &Chip8::run)
-        .function("updateTimers", &Chip8::update_timers)
-        .function("getGfx", emscripten::optional_override([](const Chip8& chip) {
-            return emscripten::val(emscripten::typed_memory_view(CHIP8_DISPLAY_WIDTH * CHIP8_DISPLAY_HEIGHT, chip.get_gfx()));
-        }))
-        .function("setInputKey", &Chip8::set_input_key)
-        .property("drawGfx", &Chip8::draw_gfx);
+    bind_chip8<Chip8>("Chip8");
+    bind_chip8<Chip8SuperChip>("SuperChip8");
+    bind_chip8<Chip8XoChip>("XoChip8");
 }
 #endif //__EMSCRIPTEN__
 
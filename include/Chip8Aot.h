@@ -0,0 +1,89 @@
+#ifndef CHIP8_AOT_H
+#define CHIP8_AOT_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Chip8.h"
+
+#define CHIP8_AOT_ABI_VERSION 1 // Bumped whenever the structures below change, modules of another version are refused
+#define CHIP8_AOT_ENTRY "chip8_aot_program" // Symbol a translated ROM built as a module exports, see chip8_add_aot()
+
+// CPU state translated code works on, mirrored from the Chip8 around each call
+struct Chip8AotFrame {
+    uint8_t registers_v[CHIP8_REGISTER_COUNT];
+    uint16_t stack[CHIP8_STACK_SIZE];
+    uint16_t pc;
+    uint16_t idx_register;
+    uint16_t sp;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t input_keys[CHIP8_KEY_SIZE]; // Only read, never copied back
+};
+
+// Address range [start, end) a translated block was generated from
+struct Chip8AotBlock {
+    uint16_t start;
+    uint16_t end;
+};
+
+// Runs translated blocks from frame->pc until the budget is used up or the next instruction has to be interpreted,
+// skipping blocks whose live entry is 0. Returns the number of instructions executed, 0 if none could be.
+typedef uint32_t (*Chip8AotRunFunction)(Chip8AotFrame *frame, const uint8_t *live, uint32_t cycles);
+
+// A ROM translated ahead of time by chip8_recompile
+struct Chip8AotProgram {
+    uint32_t abi_version;
+    const char *name;
+    const uint8_t *rom; // The bytes that were translated, loaded at CHIP8_ADDR_PROGRAM_START
+    uint32_t rom_size;
+    uint64_t rom_hash; // Chip8RomStore::hash() of rom
+    const Chip8AotBlock *blocks;
+    uint32_t block_count;
+    Chip8AotRunFunction run;
+};
+
+/**
+ * @brief Runs a Chip8 on code translated to C++ ahead of time.
+ *
+ * chip8_recompile follows the control flow of a ROM from its entry point and turns every basic block of ALU,
+ * timer, index, jump, call, return and skip instructions (key skips included) into native code, chained with
+ * direct jumps. Everything else (draws, waiting for a key, memory stores, random numbers, BNNN...) runs on the
+ * attached Chip8's own interpreter, and so does any block whose bytes in memory no longer match the ROM it was
+ * translated from. Like Chip8Jit it takes over the Chip8's code write hook, so only one of the two can be
+ * attached at a time.
+ */
+class Chip8Aot {
+    public:
+    Chip8Aot(Chip8 &chip8, const Chip8AotProgram &program);
+    ~Chip8Aot();
+    Chip8Aot(const Chip8Aot&) = delete;
+    Chip8Aot& operator=(const Chip8Aot&) = delete;
+    void run(uint32_t cycles); // Execute exactly `cycles` instructions, natively where possible
+    void set_verify(bool enabled); // Replay each native run on the interpreter and compare the resulting state
+    [[nodiscard]] bool is_native() const; // False if no translated block matches memory, e.g. another ROM is loaded
+    [[nodiscard]] uint64_t get_native_instructions() const;
+    [[nodiscard]] uint64_t get_interpreted_instructions() const;
+    [[nodiscard]] uint64_t get_verify_mismatches() const;
+    private:
+    Chip8 &chip8;
+    const Chip8AotProgram &program;
+    Chip8AotFrame frame = {};
+    std::vector<uint8_t> live; // Per block, 1 while memory still holds the bytes it was translated from
+    uint32_t code_begin = CHIP8_MEMORY_SIZE; // Range covered by the blocks
+    uint32_t code_end = 0;
+    std::vector<uint8_t> untranslated; // Per address, instructions before the next block start (0 at one, capped at 255)
+    uint64_t native_instructions = 0;
+    uint64_t interpreted_instructions = 0;
+    bool verify = false;
+    uint64_t verify_mismatches = 0;
+
+    void load_frame();
+    void store_frame();
+    void interpret(uint32_t cycles);
+    uint32_t run_native(uint32_t cycles);
+    void check_blocks(uint32_t begin, uint32_t end); // Updates live for the blocks overlapping [begin, end)
+    static void on_code_write(void *context, uint16_t address, uint32_t length);
+};
+
+#endif
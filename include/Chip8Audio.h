@@ -0,0 +1,78 @@
+#ifndef CHIP8_AUDIO_H
+#define CHIP8_AUDIO_H
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "Chip8.h"
+#include "Chip8SpscQueue.h"
+
+#define CHIP8_AUDIO_QUEUE_SIZE 64 // Tone changes in flight, a second of them at 60 Hz would be far more than any ROM makes
+#define CHIP8_AUDIO_TONE_HZ 440 // Beeper of the variants without audio patterns
+#define CHIP8_AUDIO_PATTERN_BYTES 16 // 128 one-bit samples, played in a loop
+#define CHIP8_AUDIO_VOLUME 4096 // Square wave amplitude, of 32767
+
+// The sound output from a given point of emulated time on
+struct Chip8AudioEvent {
+    uint64_t time; // In samples, counted from the first frame
+    uint32_t bit_rate; // Pattern bits played per second
+    bool on;
+    uint8_t pattern[CHIP8_AUDIO_PATTERN_BYTES];
+};
+
+/**
+ * @brief Beeper synthesis, fed by the emulation thread and pulled by the audio callback.
+ *
+ * The emulation side calls update() once per frame. It only pushes an event when the sound turns on or off or
+ * its pattern or pitch changes, timestamped with the emulated frame, through a lock-free single producer single
+ * consumer queue; when the queue is full the change is retried on the next frame instead of waiting. render()
+ * runs in the audio callback without locks or allocation and applies each event at its exact sample, playing
+ * `latency` samples behind the emulation so the events of a frame arrive before they are due. If the two clocks
+ * drift apart by more than that, the playback position jumps to the next event instead of falling further behind.
+ */
+class Chip8Audio {
+    public:
+    Chip8Audio(uint32_t sample_rate, uint32_t buffer_samples); // buffer_samples is the audio device buffer size
+
+    // Emulation thread, after each frame; `frame` counts frames since the start and keeps counting while paused
+    template <typename Machine>
+    void update(const Machine &chip8, uint64_t frame) {
+        Chip8AudioEvent event = {};
+        event.time = frame * sample_rate / CHIP8_TIMER_HZ;
+        event.on = chip8.get_sound_timer() > 0;
+        const uint8_t *pattern = chip8.get_audio_pattern();
+        bool has_pattern = false;
+        for (int i = 0; pattern != nullptr && i < CHIP8_AUDIO_PATTERN_BYTES; ++i)
+            has_pattern |= pattern[i] != 0;
+        if (has_pattern) {
+            // XO-CHIP pitch 64 plays 4000 bits per second, 48 steps per octave
+            memcpy(event.pattern, pattern, CHIP8_AUDIO_PATTERN_BYTES);
+            event.bit_rate = static_cast<uint32_t>(4000.0 * std::exp2((chip8.get_audio_pitch() - 64) / 48.0));
+        } else {
+            // Half the pattern set, one square wave period per loop
+            memset(event.pattern, 0xFF, CHIP8_AUDIO_PATTERN_BYTES / 2);
+            event.bit_rate = CHIP8_AUDIO_TONE_HZ * CHIP8_AUDIO_PATTERN_BYTES * 8;
+        }
+        push_change(event);
+    }
+    void render(int16_t *samples, size_t count); // Audio callback, fills `count` mono samples
+    private:
+    uint32_t sample_rate;
+    uint64_t latency; // Samples played behind the emulated time
+    Chip8SpscQueue<Chip8AudioEvent, CHIP8_AUDIO_QUEUE_SIZE> queue;
+
+    // Emulation side
+    Chip8AudioEvent last_sent = {}; // Newest tone the queue accepted, a rejected change differs from it until retried
+
+    // Audio callback side, on its own cache line
+    alignas(64) Chip8AudioEvent current = {}; // Tone playing now
+    uint64_t play_time = 0; // Emulated time of the next sample
+    uint64_t phase = 0; // Position in the pattern, 32.32 fixed point bits
+    uint64_t phase_step = 0; // Added per sample
+    bool anchored = false; // Whether play_time has been lined up with the emulated time yet
+
+    void push_change(const Chip8AudioEvent &event); // Queues the event if the tone differs from last_sent
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef CHIP8_BATCH_H
+#define CHIP8_BATCH_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Chip8.h"
+
+#define CHIP8_BATCH_WIDTH 32 // Lanes per chunk, one AVX2 register of 8-bit registers; lane counts are rounded up to it
+#define CHIP8_BATCH_PAGE_SIZE 64 // Granularity at which lanes are known to hold the same code
+#define CHIP8_BATCH_PAGES (CHIP8_MEMORY_SIZE / CHIP8_BATCH_PAGE_SIZE)
+
+/**
+ * @brief Runs many original CHIP-8 machines in lockstep, e.g. the same ROM under different seeds or inputs.
+ *
+ * State is laid out as structure of arrays, each register one array across lanes, so an instruction executes for
+ * every lane at once in loops the compiler turns into SSE2 or AVX2 code. At each step the lanes sharing the lowest
+ * PC issue together and the others wait: lanes that took different branches run one group after the other and
+ * merge again as soon as their PCs meet, usually at the top of the next loop iteration. Draws, stores, loads and
+ * random numbers touch per-lane memory and run lane by lane within the group. While all lanes run together,
+ * idle loops are detected and skipped the way Chip8 does it.
+ *
+ * Every lane ends up exactly where a Chip8 fed the same input would (see the bench's --batch mode), minus the
+ * counters nothing reads back: instructions executed, idle detection, dirty rows, the trace and fault counts.
+ */
+class Chip8Batch {
+    public:
+    explicit Chip8Batch(size_t lanes);
+    [[nodiscard]] size_t get_lanes() const;
+    void load(size_t lane, const Chip8 &chip8); // Copies a VM into a lane
+    void store(size_t lane, Chip8 &chip8) const; // Copies a lane into a VM, e.g. to take a snapshot of it
+    void set_input_key(size_t lane, uint8_t key, bool is_pressed);
+    void run_cycles(uint32_t cycles); // Every lane executes `cycles` instructions, timers are not touched
+    uint32_t run_frame(); // Same as Chip8::run_frame() for every lane, returns the instruction count of each
+    void set_cpu_hz(uint32_t hz);
+    void update_timers();
+    [[nodiscard]] const uint64_t* get_gfx_packed(size_t lane) const; // Same layout as Chip8::get_gfx_packed()
+    [[nodiscard]] uint16_t get_pc(size_t lane) const;
+    [[nodiscard]] Chip8Halt get_halt(size_t lane) const;
+    // Instructions issued, and instructions run by all lanes together. Their ratio is the average group size
+    [[nodiscard]] uint64_t get_steps() const;
+    [[nodiscard]] uint64_t get_lane_instructions() const;
+    // Budget all lanes together gave up without running it, in skipped idle loops and once halted
+    [[nodiscard]] uint64_t get_lane_skipped() const;
+
+    private:
+    size_t lanes; // Lanes in use
+    size_t padded_lanes; // Rounded up to CHIP8_BATCH_WIDTH, the lanes past `lanes` never run
+    // [register][lane]
+    std::vector<uint8_t> registers_v;
+    std::vector<uint16_t> stack;
+    // [lane]
+    std::vector<uint16_t> pc;
+    std::vector<uint16_t> idx_register;
+    std::vector<uint16_t> sp;
+    std::vector<uint8_t> delay_timer;
+    std::vector<uint8_t> sound_timer;
+    std::vector<uint16_t> input_keys; // Bit N set while key N is pressed
+    std::vector<uint8_t> halt; // Chip8Halt
+    std::vector<uint32_t> rng_state;
+    std::vector<uint32_t> remaining; // Instructions left in the current run_cycles()
+    std::vector<uint8_t> active; // 0xFF for the lanes issuing the current instruction, 0 for the others
+    // [lane][...]
+    std::vector<uint8_t> memory;
+    std::vector<uint64_t> gfx;
+    // Whether a page holds the same bytes in every lane, so one fetch serves them all
+    enum PageState : uint8_t { PageDiffers, PageShared, PageWritten };
+    PageState pages[CHIP8_BATCH_PAGES] = {};
+    bool pages_checked = false; // False after a load(), until pages is worked out again
+    uint32_t cpu_hz = CHIP8_DEFAULT_CPU_HZ;
+    uint32_t frame_remainder = 0;
+    uint64_t steps = 0;
+    uint64_t lane_budget = 0; // Handed to all lanes together by run_cycles()
+    uint64_t lane_skipped = 0;
+    uint32_t converged_executed = 0; // Instructions run_converged() took from the group's budget, not subtracted yet
+    bool lanes_halted = false; // Set when a lane leaves the group by halting during step()
+    uint32_t side_effects = 0; // Memory and display writes so far, only ever compared for changes
+    std::vector<uint8_t> probe; // Lane state at the backward jump idle detection last recorded
+
+    void check_pages();
+    void check_page(uint32_t page);
+    bool is_shared(uint32_t address);
+    void run_converged();
+    bool probe_lanes(bool record); // Records the lane state for idle detection, or compares it with the recording
+    uint16_t select_group(uint16_t group_pc); // Narrows active to the lanes with the same opcode, returns it
+    void step(uint16_t opcode); // Executes opcode on the active lanes
+    void drop_lane(size_t lane); // The lane halted, it is done for this run_cycles()
+    void write_memory(size_t lane, uint16_t address, uint8_t value);
+    uint8_t* lane_memory(size_t lane);
+    uint64_t* lane_gfx(size_t lane);
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef CHIP8_ENGINE_H
+#define CHIP8_ENGINE_H
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Chip8.h"
+
+/**
+ * @brief Outcome of stepping one VM, filled by whichever worker ran it.
+ *
+ * Aligned to a cache line so workers writing neighbouring results do not contend.
+ */
+struct alignas(64) Chip8Result {
+    uint64_t gfx[CHIP8_DISPLAY_HEIGHT];
+    uint8_t registers_v[CHIP8_REGISTER_COUNT];
+    uint16_t pc;
+    uint16_t idx_register;
+    uint16_t sp;
+    Chip8Halt halt; // Checked after every frame, a frame run stops early on UnknownOpcode, Exited or StackFault
+    uint64_t cycles; // Instructions the last run stood for, including skipped ones
+    uint64_t skipped; // Of those, fast-forwarded through idle loops and waits instead of executed
+    uint64_t frames; // Frames completed during the last run
+};
+
+/**
+ * @brief Owns many Chip8 instances and steps them in parallel.
+ *
+ * Each run splits the instances into one contiguous range per worker. Workers take instances from the front
+ * of their own range and, once it is empty, steal the back half of another worker's range, both through a
+ * single compare-and-swap. The only locks are taken to start a run and to wait for it to finish.
+ */
+class Chip8Engine {
+    public:
+    explicit Chip8Engine(size_t instances, unsigned threads = 0); // 0 threads means one per hardware thread
+    ~Chip8Engine();
+    Chip8Engine(const Chip8Engine&) = delete;
+    Chip8Engine& operator=(const Chip8Engine&) = delete;
+    [[nodiscard]] Chip8& instance(size_t index);
+    [[nodiscard]] const Chip8Result& result(size_t index) const;
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] unsigned thread_count() const;
+    void set_cpu_hz(uint32_t hz); // Sets Chip8::set_cpu_hz() on every instance
+    void run_cycles(uint64_t cycles); // Step every instance for `cycles` instructions, without ticking timers
+    void run_frames(uint64_t frames); // Step every instance for `frames` 60 Hz frames, ticking timers after each
+    private:
+    // Work range of a worker, begin in the upper 32 bits and end in the lower 32 bits
+    struct alignas(64) WorkRange {
+        std::atomic<uint64_t> range{0};
+    };
+
+    size_t instance_count;
+    std::unique_ptr<Chip8[]> machines;
+    std::vector<Chip8Result> results;
+    std::unique_ptr<WorkRange[]> work;
+    std::vector<std::thread> workers;
+    unsigned worker_count;
+
+    // Current job, published under job_mutex
+    std::mutex job_mutex;
+    std::condition_variable job_started;
+    std::condition_variable job_finished;
+    uint64_t job_generation = 0;
+    unsigned workers_busy = 0;
+    bool stopping = false;
+    uint64_t job_cycles = 0;
+    uint64_t job_frames = 0;
+
+    void run_job(uint64_t cycles, uint64_t frames);
+    void worker_loop(unsigned id);
+    void drain(unsigned id);
+    bool take(unsigned id, size_t &index);
+    bool steal(unsigned id, size_t &index);
+    void step_instance(size_t index);
+};
+
+#endif
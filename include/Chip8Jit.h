@@ -0,0 +1,87 @@
+#ifndef CHIP8_JIT_H
+#define CHIP8_JIT_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Chip8.h"
+
+// Native code generation is only implemented for x86-64 System V hosts
+#if defined(__x86_64__) && defined(__linux__)
+#define CHIP8_JIT_NATIVE 1
+#else
+#define CHIP8_JIT_NATIVE 0
+#endif
+
+#define CHIP8_JIT_MAX_BLOCK_INSTRUCTIONS 32
+#define CHIP8_JIT_CODE_SIZE (1024 * 1024)
+
+/**
+ * @brief Basic-block dynamic recompiler for a Chip8 instance.
+ *
+ * Straight-line runs of ALU, timer and index instructions are translated to x86-64, ending at jumps, calls,
+ * returns and skips. Anything else (draws, key waits, memory stores, random numbers...) is executed by the
+ * attached Chip8's own interpreter. V registers used by a block, I, SP and PC stay in host registers while
+ * the block runs. Blocks are dropped when the interpreter writes into their address range. Code memory is only
+ * writable while a block is being emitted, and executable the rest of the time.
+ */
+class Chip8Jit {
+    public:
+    explicit Chip8Jit(Chip8 &chip8);
+    ~Chip8Jit();
+    Chip8Jit(const Chip8Jit&) = delete;
+    Chip8Jit& operator=(const Chip8Jit&) = delete;
+    void run(uint32_t cycles); // Execute exactly `cycles` instructions, natively where possible
+    void flush(); // Drop every translated block
+    void set_verify(bool enabled); // Replay each block on the interpreter and compare the resulting state
+    [[nodiscard]] bool is_native() const; // False if code memory could not be mapped, everything is interpreted then
+    [[nodiscard]] uint64_t get_native_instructions() const;
+    [[nodiscard]] uint64_t get_interpreted_instructions() const;
+    [[nodiscard]] uint64_t get_blocks_compiled() const;
+    [[nodiscard]] uint64_t get_verify_mismatches() const;
+    private:
+    // CPU state the generated code works on, mirrored from the Chip8 around each block
+    struct Frame {
+        uint8_t registers_v[CHIP8_REGISTER_COUNT];
+        uint16_t stack[CHIP8_STACK_SIZE];
+        uint16_t pc;
+        uint16_t idx_register;
+        uint16_t sp;
+        uint8_t delay_timer;
+        uint8_t sound_timer;
+    };
+    typedef uint32_t (*BlockFunction)(Frame *frame); // Returns the number of instructions executed
+    struct Block {
+        BlockFunction entry;
+        uint16_t start; // Address range [start, end) the block was translated from
+        uint16_t end;
+        uint16_t length; // Instructions in the block, including its terminator
+        bool alive;
+    };
+    static constexpr int32_t NO_BLOCK = -1;
+    static constexpr int32_t INTERPRET_ONLY = -2; // First instruction at this address cannot be translated
+
+    Chip8 &chip8;
+    Frame frame = {};
+    uint8_t *code = nullptr;
+    size_t code_used = 0;
+    std::vector<Block> blocks;
+    int32_t block_at[CHIP8_MEMORY_SIZE]; // Index into blocks, or one of NO_BLOCK / INTERPRET_ONLY
+    uint16_t cover_count[CHIP8_MEMORY_SIZE] = {}; // Number of live blocks translated from each byte
+    bool verify = false;
+    uint64_t native_instructions = 0;
+    uint64_t interpreted_instructions = 0;
+    uint64_t blocks_compiled = 0;
+    uint64_t verify_mismatches = 0;
+
+    void load_frame();
+    void store_frame();
+    void interpret(uint32_t cycles);
+    bool set_code_writable(bool writable); // Flips the code memory between read-write and read-execute
+    int32_t compile(uint16_t start);
+    uint32_t run_block(const Block &block);
+    void invalidate(uint16_t address, uint32_t length);
+    static void on_code_write(void *context, uint16_t address, uint32_t length);
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef CHIP8_RECORDER_H
+#define CHIP8_RECORDER_H
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Chip8.h"
+#include "Chip8SpscQueue.h"
+
+#define CHIP8_RECORDING_MAGIC "C8RF"
+#define CHIP8_RECORDING_VERSION 1
+#define CHIP8_RECORDING_HEADER_SIZE 16 // Magic, uint16 version, uint16 width, uint16 height, uint8 planes, 5 reserved
+#define CHIP8_RECORDING_RECORD_HEADER_SIZE 11 // uint8 type, uint32 frame, uint16 keys, uint32 payload size
+#define CHIP8_RECORDING_KEYFRAME_INTERVAL 300 // Records between two stored whole, bounds the work of a seek
+#define CHIP8_RECORDING_MAX_WORDS (2 * 64 * 2) // Largest packed display, XO-CHIP's two planes of 128x64
+#define CHIP8_RECORDER_QUEUE_SIZE 64 // Changed frames on their way to the writer thread, a second at 60 Hz
+
+enum class Chip8RecordType : uint8_t {
+    Keyframe, // Payload is the packed display, run-length encoded
+    Delta, // Payload is the XOR against the previous record's display, run-length encoded
+    End // No payload, frame is the number of frames recorded
+};
+
+/**
+ * @brief Records every frame of a machine's display and keypad to a file, without blocking the emulation.
+ *
+ * record() is cheap enough to call every frame: frames identical to the last one (display and keys) are only
+ * counted, the others are copied into a bounded lock-free queue. A writer thread takes them from there, XORs each
+ * against the previous one, run-length encodes the result and writes it. If the writer falls a whole queue
+ * behind, frames are dropped (see get_dropped()) rather than making the emulation wait; a replay then shows the
+ * previous frame for longer.
+ *
+ * The file is a header followed by records, each tagged with the frame it starts at, so skipped frames cost
+ * nothing. Every CHIP8_RECORDING_KEYFRAME_INTERVAL records one is stored whole, which is where Chip8Replay starts
+ * decoding when seeking.
+ */
+class Chip8Recorder {
+    public:
+    Chip8Recorder();
+    ~Chip8Recorder(); // Closes the recording
+    Chip8Recorder(const Chip8Recorder&) = delete;
+    Chip8Recorder& operator=(const Chip8Recorder&) = delete;
+
+    template <typename Machine>
+    bool open(const std::string &path) {
+        return open(path, Machine::display_width, Machine::display_height, Machine::display_planes);
+    }
+    bool open(const std::string &path, int width, int height, int planes); // False if the file cannot be created
+
+    // Producer side, call once per frame from the emulation thread
+    template <typename Machine>
+    void record(const Machine &chip8) {
+        record(chip8.get_gfx_packed(), chip8.get_input_keys());
+    }
+    void record(const uint64_t *gfx, uint16_t keys);
+    [[nodiscard]] uint64_t get_frames() const; // Frames passed to record() so far
+    [[nodiscard]] uint64_t get_dropped() const; // Frames lost to a full queue
+
+    // Writes out what is queued and ends the file, false if any write failed
+    bool close();
+    [[nodiscard]] bool is_open() const;
+
+    private:
+    struct QueuedFrame {
+        uint32_t frame;
+        uint16_t keys;
+        uint64_t gfx[CHIP8_RECORDING_MAX_WORDS];
+    };
+
+    size_t words = 0; // Packed display size in words
+    // Producer side
+    uint32_t frame = 0;
+    uint64_t dropped = 0;
+    bool has_last = false;
+    uint16_t last_keys = 0;
+    uint64_t last_gfx[CHIP8_RECORDING_MAX_WORDS] = {}; // Last frame queued, the next is compared against it
+    // Shared
+    std::unique_ptr<Chip8SpscQueue<QueuedFrame, CHIP8_RECORDER_QUEUE_SIZE>> queue;
+    std::atomic<bool> stopping{false};
+    uint32_t end_frame = 0; // Written before stopping is set
+    // Writer side
+    std::thread writer;
+    std::ofstream file;
+    bool write_failed = false;
+    uint32_t records_since_keyframe = 0;
+    bool has_previous = false;
+    std::vector<uint8_t> previous; // Display of the last record written
+    std::vector<uint8_t> delta;
+    std::vector<uint8_t> encoded;
+
+    void write_loop();
+    void write_frame(const QueuedFrame &queued);
+    void write_record(Chip8RecordType type, uint32_t frame, uint16_t keys, const uint8_t *payload, uint32_t size);
+};
+
+/**
+ * @brief Reads a recording written by Chip8Recorder, frame by frame or at any frame.
+ *
+ * The file is read into memory and its records indexed once. seek() decodes from the nearest keyframe at or
+ * before the frame, or carries on from the current frame when moving forwards, so playing a recording from start
+ * to end decodes each record exactly once.
+ */
+class Chip8Replay {
+    public:
+    bool open(const std::string &path); // False if the file is missing or not a recording
+    [[nodiscard]] int get_width() const;
+    [[nodiscard]] int get_height() const;
+    [[nodiscard]] int get_planes() const;
+    [[nodiscard]] uint32_t get_frame_count() const;
+    // Frames at which the display or the keys changed, in order; every other frame repeats the one before
+    [[nodiscard]] const std::vector<uint32_t>& get_change_frames() const;
+
+    bool seek(uint32_t frame); // False if frame is past the end or the recording is damaged there
+    [[nodiscard]] uint32_t get_frame() const; // Frame the display and keys below belong to
+    // Same layout as Chip8::get_gfx_packed() of the recorded machine
+    [[nodiscard]] const uint64_t* get_gfx_packed() const;
+    [[nodiscard]] uint16_t get_keys() const;
+
+    private:
+    struct Record {
+        Chip8RecordType type;
+        uint16_t keys;
+        size_t offset; // Of the payload in data
+        uint32_t size;
+        size_t keyframe; // Index of the keyframe this record builds on
+    };
+
+    std::vector<uint8_t> data;
+    int width = 0;
+    int height = 0;
+    int planes = 0;
+    size_t words = 0;
+    uint32_t frame_count = 0;
+    std::vector<Record> records;
+    std::vector<uint32_t> change_frames; // Frame of each record
+    size_t current = 0; // Record the display holds, records.size() if none
+    uint32_t frame = 0;
+    std::vector<uint64_t> gfx;
+    std::vector<uint8_t> delta;
+
+    bool apply(size_t record);
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef CHIP8_RENDER_H
+#define CHIP8_RENDER_H
+#include <cstdint>
+#include <vector>
+
+#define CHIP8_RENDER_MAX_SCALE 32
+
+// Code paths of the renderer, the fastest one the CPU runs is picked on construction
+enum class Chip8RenderKernel : uint8_t {
+    Scalar,
+    Sse2,
+    Avx2
+};
+
+/**
+ * @brief Turns a machine's packed display into RGBA8888 texels, e.g. straight into a locked streaming texture.
+ *
+ * Each display row is expanded from its plane bits to palette colours 4 (SSE2) or 8 (AVX2) pixels at a time, then
+ * written out `scale` times with every pixel repeated `scale` times, so the GPU only copies the texture 1:1. The
+ * output is only ever written, never read back: locked texture memory may be uncached.
+ *
+ * With phosphor persistence, pixels that go dark fade from the colour they had towards the background over the
+ * following renders instead of vanishing at once, which hides the flicker of ROMs that erase and redraw their
+ * sprites every frame. Rows still fading are reported by get_fading_rows() and have to be rendered again even if
+ * the display did not change.
+ */
+class Chip8Renderer {
+    public:
+    // Background, plane 1, plane 2, both (only XO-CHIP draws on the second plane)
+    static constexpr uint32_t default_palette[4] = {0x000000FF, 0xFFFFFFFF, 0xAAAAAAFF, 0x555555FF};
+
+    // At most 2 planes and 64 rows, the width a multiple of 64; scale from 1 to CHIP8_RENDER_MAX_SCALE
+    Chip8Renderer(int display_width, int display_height, int display_planes, int scale);
+    [[nodiscard]] int get_width() const; // Of the output, in texels
+    [[nodiscard]] int get_height() const;
+    [[nodiscard]] int get_scale() const;
+    // Colours of the plane bits 0 to 3 as 0xRRGGBBAA, SDL's RGBA8888
+    void set_palette(const uint32_t colors[4]);
+    // Out of 256, how much of its previous colour a dark pixel keeps on each render; 0 turns phosphor off
+    void set_persistence(uint8_t value);
+    bool set_kernel(Chip8RenderKernel value); // False if the CPU cannot run it
+    [[nodiscard]] Chip8RenderKernel get_kernel() const;
+    [[nodiscard]] uint64_t get_fading_rows() const; // Bit N set while row N is fading
+    // Renders display rows [first_row, last_row) of gfx, laid out as Chip8::get_gfx_packed(). pixels is the left
+    // texel of output row first_row * scale, and pitch the bytes from one output row to the next
+    void render(const uint64_t *gfx, int first_row, int last_row, void *pixels, int pitch);
+
+    private:
+    using ExpandFunction = void (*)(const uint64_t *plane0, const uint64_t *plane1, int width, const uint32_t *palette,
+                                    uint32_t *out);
+    using FadeFunction = bool (*)(uint32_t *shown, const uint32_t *target, int width, uint32_t background,
+                                  uint8_t persistence);
+    using ReplicateFunction = void (*)(const uint32_t *row, int width, int scale, uint32_t *out);
+
+    int width;
+    int height;
+    int planes;
+    int words; // Per row and plane
+    int scale;
+    uint32_t palette[4];
+    uint8_t persistence = 0;
+    uint64_t fading_rows = 0;
+    Chip8RenderKernel kernel = Chip8RenderKernel::Scalar;
+    ExpandFunction expand = nullptr;
+    FadeFunction fade = nullptr;
+    ReplicateFunction replicate = nullptr;
+    std::vector<uint32_t> target; // One row in palette colours
+    std::vector<uint32_t> shown; // Display colours as last rendered, phosphor fades them towards the target
+
+    void clear_shown();
+};
+
+#endif
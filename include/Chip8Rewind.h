@@ -0,0 +1,74 @@
+#ifndef CHIP8_REWIND_H
+#define CHIP8_REWIND_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Chip8.h"
+
+#define CHIP8_REWIND_DEFAULT_MEMORY (8 * 1024 * 1024)
+#define CHIP8_REWIND_DEFAULT_KEYFRAME_INTERVAL 60 // One full state per second at 60 Hz
+
+/**
+ * @brief Ring buffer of past machine states for stepping backwards.
+ *
+ * Every recorded frame is a machine snapshot (of any variant, switching variants starts the ring over).
+ * Keyframes are stored whole, the frames in between as the XOR against their keyframe; both are run-length
+ * encoded, so unchanged bytes cost next to nothing. All buffers are allocated up front and the oldest frames are
+ * dropped once the memory cap is reached.
+ */
+class Chip8Rewind {
+    public:
+    explicit Chip8Rewind(size_t memory_cap = CHIP8_REWIND_DEFAULT_MEMORY,
+                         uint32_t keyframe_interval = CHIP8_REWIND_DEFAULT_KEYFRAME_INTERVAL);
+    // Call once per frame, after update_timers()
+    template <typename Machine>
+    void record(const Machine &chip8) {
+        prepare(Machine::snapshot_size());
+        chip8.snapshot(state.data(), state.size());
+        commit();
+    }
+    // Restores the newest recorded frame and forgets it, false if there is none
+    template <typename Machine>
+    bool step_back(Machine &chip8) {
+        return state.size() == Machine::snapshot_size() && pop() && chip8.restore(state.data(), state.size());
+    }
+    void clear();
+    [[nodiscard]] size_t frames() const;
+    [[nodiscard]] size_t memory_used() const;
+    private:
+    struct Entry {
+        uint64_t sequence; // Frame number, consecutive across the ring
+        uint64_t keyframe; // Sequence number of the keyframe this frame is a delta against (itself for keyframes)
+        size_t offset; // Start of the encoded bytes in storage
+        size_t size;
+    };
+
+    uint32_t keyframe_interval;
+    std::vector<uint8_t> storage; // Byte ring holding the encoded frames back to back
+    size_t storage_head = 0; // Where the next frame is written
+    size_t storage_used = 0;
+    std::vector<Entry> entries; // Ring of frame descriptors, oldest at entries_tail
+    size_t entries_tail = 0;
+    size_t entries_count = 0;
+    uint64_t next_sequence = 0;
+
+    std::vector<uint8_t> keyframe_state; // Decoded snapshot of the keyframe new deltas are taken against
+    uint64_t keyframe_sequence = 0;
+    bool keyframe_valid = false;
+    std::vector<uint8_t> state; // Scratch snapshot
+    std::vector<uint8_t> delta; // Scratch XOR of state and keyframe_state
+    std::vector<uint8_t> encoded; // Scratch encoded frame
+
+    void prepare(size_t state_size); // Sizes the buffers for snapshots of this size, dropping frames of another
+    void commit(); // Stores the snapshot in state as the newest frame
+    bool pop(); // Decodes the newest frame into state and forgets it
+    Entry &entry(size_t index); // 0 is the oldest frame
+    size_t encode(bool keyframe); // Encodes state into encoded, returns the encoded size
+    void drop_oldest();
+    void write_ring(const uint8_t *data, size_t size);
+    void read_ring(const Entry &frame, uint8_t *out) const;
+    bool decode(const Entry &frame, std::vector<uint8_t> &out);
+};
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef CHIP8_RLE_H
+#define CHIP8_RLE_H
+#include <cstddef>
+#include <cstdint>
+
+// Zero run-length coding shared by Chip8Rewind and Chip8Recorder, meant for XOR deltas and sparse bitmaps.
+// Data is stored as a sequence of (zero run, literal run) pairs, both lengths as LEB128 varints, each pair
+// followed by its literal bytes. XOR deltas are almost entirely zero, so a typical frame is a handful of pairs.
+namespace Chip8Rle {
+    [[nodiscard]] size_t bound(size_t size); // Largest output encode() can produce for `size` input bytes
+    size_t encode(const uint8_t *in, size_t size, uint8_t *out); // Returns the encoded size
+    bool decode(const uint8_t *in, size_t size, uint8_t *out, size_t out_size); // False unless exactly out_size bytes came out
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef CHIP8_ROM_STORE_H
+#define CHIP8_ROM_STORE_H
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Chip8.h"
+
+#define CHIP8_ARCHIVE_MAGIC "C8RA"
+#define CHIP8_ARCHIVE_VERSION 1
+#define CHIP8_ARCHIVE_HEADER_SIZE 12 // Magic, uint16 version, uint16 reserved, uint32 ROM count
+#define CHIP8_ARCHIVE_ENTRY_SIZE 24
+
+// A ROM held by a Chip8RomStore, valid as long as the store is
+struct Chip8Rom {
+    std::string name; // Path it was loaded from, or the name recorded in the archive
+    const uint8_t *data; // Read-only, straight from the mapped file
+    size_t size;
+    uint64_t hash; // 64-bit FNV-1a of the contents
+    Chip8Variant variant; // Instruction set reachable from the entry point
+};
+
+/**
+ * @brief Read-only library of ROMs, indexed by content hash.
+ *
+ * Files are memory-mapped once, either one by one (a file or a directory of them) or as a single packed archive
+ * (see write_archive()), and handed out as pointers into the mapping that Chip8::load_program() copies from.
+ * ROMs that are empty or do not fit in XO-CHIP memory are rejected (loading one that does not fit in the machine
+ * it is meant for still fails there), and identical contents are only kept once.
+ */
+class Chip8RomStore {
+    public:
+    Chip8RomStore() = default;
+    ~Chip8RomStore();
+    Chip8RomStore(const Chip8RomStore&) = delete;
+    Chip8RomStore& operator=(const Chip8RomStore&) = delete;
+    bool add(const std::string &path); // Directory, archive or single ROM, whichever the path turns out to be
+    bool add_file(const std::string &path);
+    size_t add_directory(const std::string &path); // Every regular file directly inside, returns how many were ROMs
+    bool add_archive(const std::string &path);
+    bool write_archive(const std::string &path) const; // Packs every ROM of the store, metadata included
+    [[nodiscard]] size_t size() const;
+    [[nodiscard]] const Chip8Rom& rom(size_t index) const;
+    [[nodiscard]] const Chip8Rom* find(uint64_t hash) const; // nullptr if no ROM has this hash
+    [[nodiscard]] static uint64_t hash(const uint8_t *data, size_t size);
+    [[nodiscard]] static Chip8Variant detect_variant(const uint8_t *data, size_t size);
+    private:
+    struct Mapping {
+        void *address;
+        size_t size;
+    };
+
+    std::vector<Mapping> mappings;
+    std::vector<Chip8Rom> roms;
+    std::unordered_map<uint64_t, size_t> index; // Hash to position in roms
+
+    const uint8_t* map_file(const std::string &path, size_t &size);
+    void unmap_last();
+    bool insert(const std::string &name, const uint8_t *data, size_t size, uint64_t hash, Chip8Variant variant);
+};
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef CHIP8_SERVER_H
+#define CHIP8_SERVER_H
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "Chip8.h"
+
+#define CHIP8_SERVER_MAGIC "C8SV"
+#define CHIP8_SERVER_VERSION 1
+#define CHIP8_SERVER_MAX_COMMANDS 64 // Commands in one request
+#define CHIP8_SERVER_MAX_FRAMES 3600 // Frames one StepFrames may run, a minute, so no session stalls the others long
+#define CHIP8_SERVER_MAX_EVENTS 64 // epoll events taken per wakeup
+#define CHIP8_SERVER_READ_BURST 16 // Requests read from one session before moving on to the next
+
+// Commands of the step protocol, each a Chip8ServerCommand
+enum class Chip8Command : uint8_t {
+    LoadRom, // initialize(), then loads `value` bytes from the region's rom
+    SetKey, // set_input_key(key, pressed)
+    StepFrames, // run_frame() `value` times, skipping frames the VM idles through
+    Reset, // reset_program()
+    Snapshot, // snapshot() into the region's snapshot, its size goes to snapshot_size
+    Restore, // restore() from the first `value` bytes of the region's snapshot
+    Seed // seed(value)
+};
+
+enum class Chip8ServerStatus : uint8_t {
+    Ok,
+    BadRequest, // Malformed message, unknown command or key out of range
+    InvalidRom, // Empty or larger than Chip8::max_program_size
+    InvalidSnapshot,
+    TooManyFrames // More than CHIP8_SERVER_MAX_FRAMES in one StepFrames
+};
+
+struct Chip8ServerCommand {
+    Chip8Command command;
+    uint8_t key;
+    uint8_t pressed;
+    uint8_t reserved;
+    uint32_t value;
+};
+
+// One message on the socket, only `count` commands are sent. They run in order, and stop at the first that fails
+struct Chip8ServerRequest {
+    uint32_t sequence; // Echoed in the reply
+    uint32_t count;
+    Chip8ServerCommand commands[CHIP8_SERVER_MAX_COMMANDS];
+};
+
+struct Chip8ServerReply {
+    uint32_t sequence;
+    Chip8ServerStatus status;
+    uint8_t failed; // Index of the command that failed, the ones before it ran
+    uint16_t reserved;
+    uint32_t frames; // Run by the request's StepFrames, including skipped ones
+    uint32_t instructions; // Executed by them, or stood for by skipped frames
+};
+
+// First message from the server after accepting, carries the region's memfd
+struct Chip8ServerHello {
+    char magic[4];
+    uint32_t version;
+    uint32_t region_size;
+    uint32_t reserved;
+};
+
+/**
+ * @brief Memory shared between the server and one client, mapped from a memfd handed over on connect.
+ *
+ * The server fills in the state before every reply, so a reply on the socket only carries a status and all of
+ * the display and registers are read straight from here. The client writes the ROM and restored snapshots into
+ * the input areas before sending the command that uses them. Only one request is outstanding at a time: the
+ * client must read the state before sending the next one, which overwrites it.
+ */
+struct Chip8SharedRegion {
+    // Written by the server after each request
+    uint64_t gfx[CHIP8_DISPLAY_HEIGHT]; // Same layout as Chip8::get_gfx_packed()
+    uint64_t dirty_rows; // Rows the request changed
+    uint8_t registers_v[CHIP8_REGISTER_COUNT];
+    uint16_t pc;
+    uint16_t idx_register;
+    uint16_t sp;
+    uint16_t input_keys;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    Chip8Halt halt;
+    Chip8Idle idle;
+    uint32_t snapshot_size; // Written by the last Snapshot
+    // Written by the client
+    uint8_t rom[CHIP8_MAX_PROGRAM_SIZE];
+    uint8_t snapshot[Chip8::snapshot_size()]; // Also where Snapshot writes to
+};
+
+/**
+ * @brief Headless emulation service on a Unix domain socket, for agents running in other processes.
+ *
+ * Every connection is a session owning one Chip8. Clients send batches of commands (load a ROM, set keys, step
+ * frames, snapshot, reset) as single SOCK_SEQPACKET messages and get one small reply each; the display, registers
+ * and snapshots travel through a Chip8SharedRegion per session instead of the socket. All sessions are served
+ * by one thread from an epoll loop, which reads a few requests from each ready session in turn.
+ */
+class Chip8Server {
+    public:
+    Chip8Server() = default;
+    ~Chip8Server();
+    Chip8Server(const Chip8Server&) = delete;
+    Chip8Server& operator=(const Chip8Server&) = delete;
+
+    bool open(const std::string &path); // Binds and listens, replacing a stale socket file; false on failure
+    void run(); // Serves sessions until stop()
+    void stop(); // From any thread or a signal handler
+    [[nodiscard]] size_t get_sessions() const; // Connected now
+    [[nodiscard]] uint64_t get_accepted() const;
+    [[nodiscard]] uint64_t get_requests() const;
+
+    private:
+    struct Session {
+        int fd;
+        Chip8SharedRegion *region;
+        std::unique_ptr<Chip8> chip8;
+        std::unique_ptr<uint8_t[]> restore_buffer; // The region is writable by the client, restore from a copy
+        bool has_pending = false; // Reply the socket had no room for, sent once it is writable
+        Chip8ServerReply pending;
+    };
+
+    std::string path;
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    int wake_fd = -1; // eventfd stop() writes to
+    std::unordered_map<int, std::unique_ptr<Session>> sessions;
+    uint64_t accepted = 0;
+    uint64_t requests = 0;
+
+    void close();
+    void accept_sessions();
+    void close_session(Session &session);
+    void read_requests(Session &session);
+    void execute(Session &session, const Chip8ServerRequest &request, size_t length, Chip8ServerReply &reply);
+    bool send_reply(Session &session, const Chip8ServerReply &reply); // False if the session was closed
+    void publish(Session &session);
+};
+
+/**
+ * @brief Client side of Chip8Server, maps the session's shared region on connect.
+ */
+class Chip8ServerClient {
+    public:
+    Chip8ServerClient() = default;
+    ~Chip8ServerClient();
+    Chip8ServerClient(const Chip8ServerClient&) = delete;
+    Chip8ServerClient& operator=(const Chip8ServerClient&) = delete;
+
+    bool connect(const std::string &path); // False if the server is not there or the handshake failed
+    void close();
+    // Sends the commands as one request and waits for its reply, false if the connection broke
+    bool call(const Chip8ServerCommand *commands, uint32_t count, Chip8ServerReply &reply);
+    [[nodiscard]] Chip8SharedRegion* get_region() const;
+
+    private:
+    int fd = -1;
+    Chip8SharedRegion *region = nullptr;
+    uint32_t sequence = 0;
+};
+
+#endif
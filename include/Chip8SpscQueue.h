@@ -0,0 +1,51 @@
+#ifndef CHIP8_SPSC_QUEUE_H
+#define CHIP8_SPSC_QUEUE_H
+#include <atomic>
+#include <cstddef>
+
+/**
+ * @brief Bounded lock-free queue between exactly one producer thread and one consumer thread.
+ *
+ * Neither side ever blocks: push() fails when the queue is full and front() returns nullptr when it is empty.
+ * The indices only grow and sit on their own cache lines, and each side keeps a copy of the other's index so it
+ * only has to read the shared one when its copy says the queue is full (or empty).
+ */
+template <typename T, size_t Capacity>
+class Chip8SpscQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    public:
+    // Producer side
+    bool push(const T &value) {
+        const size_t tail = tail_index.load(std::memory_order_relaxed);
+        if (tail - head_cache == Capacity) {
+            head_cache = head_index.load(std::memory_order_acquire);
+            if (tail - head_cache == Capacity) return false;
+        }
+        slots[tail & (Capacity - 1)] = value;
+        tail_index.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, the returned element stays valid until pop()
+    [[nodiscard]] const T* front() {
+        const size_t head = head_index.load(std::memory_order_relaxed);
+        if (head == tail_cache) {
+            tail_cache = tail_index.load(std::memory_order_acquire);
+            if (head == tail_cache) return nullptr;
+        }
+        return &slots[head & (Capacity - 1)];
+    }
+
+    void pop() { // Only after front() returned an element
+        head_index.store(head_index.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    private:
+    alignas(64) std::atomic<size_t> head_index{0}; // Next element to read, written by the consumer
+    size_t tail_cache = 0; // Consumer's copy of tail_index
+    alignas(64) std::atomic<size_t> tail_index{0}; // Next slot to write, written by the producer
+    size_t head_cache = 0; // Producer's copy of head_index
+    alignas(64) T slots[Capacity];
+};
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef CHIP8_TRACE_H
+#define CHIP8_TRACE_H
+#include <cstdint>
+#include <string>
+
+#include "Chip8.h"
+
+#define CHIP8_TRACE_MAGIC "C8TR"
+#define CHIP8_TRACE_VERSION 2
+#define CHIP8_TRACE_HEADER_SIZE 12 // Magic, uint16 version, uint16 reserved, uint32 total size
+#define CHIP8_TRACE_RECORD_SIZE 6 // uint16 PC, uint16 opcode, uint16 I
+
+// Trace dump files, written by the frontends when a VM faults and decoded offline by chip8_trace. A file holds one
+// Chip8TraceDump: the header, uint8 variant, uint8 fault, uint16 PC, uint16 SP, uint32 record count, uint64
+// instructions, V0-VF, the stack, then the records oldest first, every field in host byte order like snapshots.
+namespace Chip8Trace {
+    bool write(const std::string &path, const Chip8TraceDump &dump); // False if the file cannot be written
+    bool read(const std::string &path, Chip8TraceDump &dump); // False if the file is missing or not a trace dump
+    // Mnemonic of an instruction of the variant, "DW 0x...." for anything it does not implement. For XO-CHIP
+    // F000 NNNN only the first word is known.
+    [[nodiscard]] std::string disassemble(uint16_t opcode, Chip8Variant variant);
+    [[nodiscard]] const char* fault_name(Chip8Fault fault);
+}
+
+#endif
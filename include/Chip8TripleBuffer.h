@@ -0,0 +1,46 @@
+#ifndef CHIP8_TRIPLE_BUFFER_H
+#define CHIP8_TRIPLE_BUFFER_H
+#include <atomic>
+#include <cstdint>
+
+/**
+ * @brief Lock-free handoff of the newest value from one writer thread to one reader thread.
+ *
+ * The writer fills back() and publishes it, the reader takes the newest published slot and reads front(). One
+ * slot belongs to each side and the third sits in between, swapped with a single atomic exchange, so neither side
+ * ever waits: the writer overwrites values the reader was too slow to take, and the reader keeps its slot until a
+ * newer one is published.
+ */
+template <typename T>
+class Chip8TripleBuffer {
+    public:
+    // Writer side
+    [[nodiscard]] T& back() {
+        return slots[back_index];
+    }
+
+    void publish() {
+        back_index = middle.exchange(back_index | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Reader side, false (and front() unchanged) if nothing was published since the last take
+    bool take() {
+        if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) return false;
+        front_index = middle.exchange(front_index, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    [[nodiscard]] const T& front() const {
+        return slots[front_index];
+    }
+
+    private:
+    static constexpr uint8_t INDEX = 3;
+    static constexpr uint8_t FRESH = 4; // Set in middle when its slot holds a value the reader has not taken
+    T slots[3] = {};
+    alignas(64) std::atomic<uint8_t> middle{1}; // Slot between the two sides
+    alignas(64) uint8_t back_index = 0; // Only touched by the writer
+    alignas(64) uint8_t front_index = 2; // Only touched by the reader
+};
+
+#endif
@@ -1,53 +1,131 @@
 #include "../include/Chip8.h"
 
-#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
 #include <iostream>
 #include <cstring>
 #include <cwchar>
-#include <random>
+#include <type_traits>
 
-Chip8::Chip8() = default;
+// fork() relies on the VM being plain bytes
+static_assert(std::is_trivially_copyable<Chip8>::value, "Chip8 must stay trivially copyable");
+static_assert(std::is_trivially_copyable<Chip8XoChip>::value, "Chip8XoChip must stay trivially copyable");
+static_assert((CHIP8_TRACE_SIZE & (CHIP8_TRACE_SIZE - 1)) == 0, "The trace ring is indexed with a mask");
 
+template <typename Policy>
+Chip8Machine<Policy>::Chip8Machine() = default;
 
-void Chip8::initialize() {
+
+template <typename Policy>
+void Chip8Machine<Policy>::initialize() {
     idx_register = 0; // Reset index register
     pc = 0x200; // Reset PC to 0x200, where programs start
     sp = 0; // Reset stack pointer
     opcode = 0; // Reset current fetched opcode
     sound_timer = 0; // Reset sound timer
     delay_timer = 0; // Reset delay timer
-    rng = std::mt19937(random_device());
-    dist = std::uniform_int_distribution<int>(0, 255);
+    halt = Chip8Halt::None;
+    rng_state = rng_seed;
+    frame_remainder = 0;
+    cycle_debt = 0;
+    idle = Chip8Idle::None;
 
     // Clear display
     memset(gfx, 0, sizeof(gfx));
+    dirty_rows = all_rows_dirty;
+    extended = ExtendedState();
+    extended.plane_mask = 1;
+    extended.pitch = 64;
     // Clear stack
     memset(stack, 0, sizeof(stack));
-    // Clear memory
-    memset(memory, 0, sizeof(memory));
+    // Reset memory to the fonts followed by zeros. Decoded instructions are only dropped where that changes
+    // something, usually the program, clearing them all would write 8 bytes per address on every reset
+    constexpr uint32_t chunk = 64;
+    uint8_t fonts[4 * chunk] = {};
+    static_assert(CHIP8_ADDR_BIG_FONT + sizeof(big_font_set) <= sizeof(fonts), "The fonts fit in the first chunks");
+    memcpy(fonts, font_set, sizeof(font_set));
+    if constexpr (variant != Chip8Variant::Chip8)
+        memcpy(fonts + CHIP8_ADDR_BIG_FONT, big_font_set, sizeof(big_font_set));
+    rewrite_memory(0, fonts, sizeof(fonts));
+    for (uint32_t address = sizeof(fonts); address < memory_size; address += chunk) {
+        uint64_t bits = 0;
+        for (uint32_t i = 0; i < chunk; i += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, memory + address + i, sizeof(word));
+            bits |= word;
+        }
+        if (bits == 0) continue;
+        memset(memory + address, 0, chunk);
+        invalidate_decoded(address, chunk);
+    }
     // Clear registers
     memset(registers_v, 0, sizeof(registers_v));
     // Clear keys
     memset(input_keys, 0, sizeof(input_keys));
+    // Start a new trace, records past the head are never read
+    trace_head = 0;
+    memset(fault_counts, 0, sizeof(fault_counts));
+    last_fault = Chip8Fault::None;
+    fault_trace_pending = false;
+
+    draw_gfx = true;
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::seed(uint32_t seed) {
+    rng_seed = seed != 0 ? seed : CHIP8_DEFAULT_SEED;
+    rng_state = rng_seed;
+}
 
-    // Load font set
-    for (int i = 0; i < 80; ++i) {
-        memory[i] = font_set[i];
+template <typename Policy>
+void Chip8Machine<Policy>::fork(Chip8Machine &destination) const {
+    if (&destination == this) return;
+    // Decoded instructions only depend on memory and the cost table, so the destination keeps its own wherever its
+    // memory already matches (branching from the same ROM, usually everywhere but a few chunks)
+    if (destination.timing != timing) memset(destination.decoded, 0, sizeof(destination.decoded));
+    constexpr int chunk = 64;
+    for (uint32_t address = 0; address < memory_size; address += chunk) {
+        if (memcmp(destination.memory + address, memory + address, chunk) != 0)
+            destination.invalidate_decoded(address, chunk);
     }
+    // Then one copy of the machine state, every member declared before the trace ring (about 5 KB, 66 KB on XO-CHIP)
+    const auto hook = destination.code_write_hook;
+    void *const context = destination.code_write_context;
+    const size_t state_size = reinterpret_cast<const uint8_t*>(&trace) - reinterpret_cast<const uint8_t*>(this);
+    memcpy(static_cast<void*>(&destination), this, state_size);
+    destination.code_write_hook = hook;
+    destination.code_write_context = context;
+    // The ring was not copied, the fork's trace starts here
+    destination.trace_head = 0;
+    destination.fault_trace_pending = false;
+}
 
-    draw_gfx = true;
+template <typename Policy>
+std::unique_ptr<Chip8Machine<Policy>> Chip8Machine<Policy>::clone() const {
+    auto copy = std::make_unique<Chip8Machine>();
+    fork(*copy);
+    return copy;
 }
 
-void Chip8::reset_program() {
+template <typename Policy>
+void Chip8Machine<Policy>::reset_program() {
     idx_register = 0; // Reset index register
     pc = 0x200; // Reset PC to 0x200, where programs start
     sp = 0; // Reset stack pointer
     opcode = 0; // Reset current fetched opcode
     sound_timer = 0; // Reset sound timer
     delay_timer = 0; // Reset delay timer
+    halt = Chip8Halt::None;
+    cycle_debt = 0;
+    idle = Chip8Idle::None;
 
     // Clear display
     memset(gfx, 0, sizeof(gfx));
+    dirty_rows = all_rows_dirty;
+    extended.high_resolution = 0;
+    extended.plane_mask = 1;
     // Clear stack
     memset(stack, 0, sizeof(stack));
     // Clear registers
@@ -58,335 +136,1194 @@ void Chip8::reset_program() {
     draw_gfx = true;
 }
 
-void Chip8::load_program(const std::string& filename) {
+template <typename Policy>
+bool Chip8Machine<Policy>::load_program(const std::string& filename) {
     // Open file
     FILE *f = fopen(filename.c_str(), "rb");
     if (f == nullptr) {
         std::cout << "Failed to open file " << filename << std::endl;
-        exit(1);
-    }
-    // Seek to end of the file
-    fseek(f, 0, SEEK_END);
-    // Count byte size from start to current position (end), effectively file size
-    const int size = ftell(f);
-    // Seek to beginning of the file
-    rewind(f);
-    // Read ROM contents into memory
-    fread(memory + CHIP8_ADDR_PROGRAM_START, 1, size, f);
+        return false;
+    }
+    // Read one byte more than fits, so an oversized file is noticed without trusting its reported size
+    std::vector<uint8_t> program(max_program_size + 1);
+    const size_t size = fread(program.data(), 1, program.size(), f);
     // Close file
     fclose(f);
+    if (size > max_program_size) {
+        std::cout << "ROM " << filename << " does not fit in memory, at most " << max_program_size
+                  << " bytes are supported" << std::endl;
+        return false;
+    }
+    return load_program(program.data(), size);
 }
 
-void Chip8::load_program(const std::vector<uint8_t> &program) {
+template <typename Policy>
+bool Chip8Machine<Policy>::load_program(const std::vector<uint8_t> &program) {
+    return load_program(program.data(), program.size());
+}
+
+template <typename Policy>
+bool Chip8Machine<Policy>::load_program(const uint8_t *program, size_t size) {
+    if (size > max_program_size) return false;
     // Load ROM data into memory starting at CHIP8_ADDR_PROGRAM_START
-    for (int i = 0; i < program.size(); i++)
-        memory[CHIP8_ADDR_PROGRAM_START + i] = program[i];
+    memcpy(memory + CHIP8_ADDR_PROGRAM_START, program, size);
+    invalidate_decoded(CHIP8_ADDR_PROGRAM_START, size);
+    return true;
 }
 
-void Chip8::dump_memory(std::ostream & os) const {
-    for (int i = 0; i < CHIP8_MEMORY_SIZE; i++)
+template <typename Policy>
+void Chip8Machine<Policy>::dump_memory(std::ostream & os) const {
+    for (uint32_t i = 0; i < memory_size; i++)
         os << std::hex << "[0x" << i << "]: 0x" << ((int) memory[i]) << std::endl;
 }
 
-void Chip8::dump_memory() const {
-    for (int i = 0; i < CHIP8_MEMORY_SIZE; i++)
+template <typename Policy>
+void Chip8Machine<Policy>::dump_memory() const {
+    for (uint32_t i = 0; i < memory_size; i++)
         std::cout << std::hex << "[0x" << i << "]: 0x" << ((int) memory[i]) << std::endl;
 }
 
-void Chip8::run() {
-    static auto begin = std::chrono::high_resolution_clock::now();
+// Snapshot layout (version 4), fields in host byte order:
+// "C8SS", uint16 version, uint16 reserved, uint32 total size,
+// memory, gfx rows, V0-VF, stack, SP, PC, I, delay timer, sound timer, keys, halt reason, uint32 RNG state,
+// uint32 frame remainder, uint32 cycle debt, then for the extended variants: resolution, plane mask, pitch, RPL flags, audio pattern.
+// Memory and display sizes follow the variant, so the total size tells snapshots of different variants apart.
+
+template <typename Policy>
+size_t Chip8Machine<Policy>::snapshot(uint8_t *buffer, size_t capacity) const {
+    if (capacity < snapshot_size()) return 0;
+    uint8_t *out = buffer;
+    auto put = [&out](const void *field, size_t size) {
+        memcpy(out, field, size);
+        out += size;
+    };
+    const uint16_t version = CHIP8_SNAPSHOT_VERSION;
+    const uint16_t reserved = 0;
+    const uint32_t size = snapshot_size();
+
+    put(CHIP8_SNAPSHOT_MAGIC, 4);
+    put(&version, sizeof(version));
+    put(&reserved, sizeof(reserved));
+    put(&size, sizeof(size));
+    put(memory, sizeof(memory));
+    put(gfx, sizeof(gfx));
+    put(registers_v, sizeof(registers_v));
+    put(stack, sizeof(stack));
+    put(&sp, sizeof(sp));
+    put(&pc, sizeof(pc));
+    put(&idx_register, sizeof(idx_register));
+    put(&delay_timer, sizeof(delay_timer));
+    put(&sound_timer, sizeof(sound_timer));
+    put(input_keys, sizeof(input_keys));
+    put(&halt, sizeof(halt));
+    put(&rng_state, sizeof(rng_state));
+    put(&frame_remainder, sizeof(frame_remainder));
+    put(&cycle_debt, sizeof(cycle_debt));
+    if constexpr (variant != Chip8Variant::Chip8) put(&extended, sizeof(extended));
+    return out - buffer;
+}
+
+template <typename Policy>
+bool Chip8Machine<Policy>::restore(const uint8_t *buffer, size_t size) {
+    if (size < snapshot_size() || memcmp(buffer, CHIP8_SNAPSHOT_MAGIC, 4) != 0) return false;
+    uint16_t version;
+    uint32_t total_size;
+    memcpy(&version, buffer + 4, sizeof(version));
+    memcpy(&total_size, buffer + 8, sizeof(total_size));
+    if (version != CHIP8_SNAPSHOT_VERSION || total_size != snapshot_size()) return false;
+    // The run loops trust SP to index the stack and halt to be a known reason, check both before touching anything
+    constexpr size_t sp_offset = CHIP8_SNAPSHOT_HEADER_SIZE + sizeof(memory) + sizeof(gfx) + sizeof(registers_v)
+                                 + sizeof(stack);
+    constexpr size_t halt_offset = sp_offset + sizeof(sp) + sizeof(pc) + sizeof(idx_register) + sizeof(delay_timer)
+                                   + sizeof(sound_timer) + sizeof(input_keys);
+    uint16_t saved_sp;
+    uint8_t saved_halt;
+    memcpy(&saved_sp, buffer + sp_offset, sizeof(saved_sp));
+    memcpy(&saved_halt, buffer + halt_offset, sizeof(saved_halt));
+    if (saved_sp > CHIP8_STACK_SIZE || saved_halt > static_cast<uint8_t>(Chip8Halt::StackFault)) return false;
+
+    const uint8_t *in = buffer + CHIP8_SNAPSHOT_HEADER_SIZE;
+    auto get = [&in](void *field, size_t field_size) {
+        memcpy(field, in, field_size);
+        in += field_size;
+    };
+
+    // Only the parts of memory that differ, usually very few
+    rewrite_memory(0, in, memory_size);
+    in += sizeof(memory);
+    get(gfx, sizeof(gfx));
+    get(registers_v, sizeof(registers_v));
+    get(stack, sizeof(stack));
+    get(&sp, sizeof(sp));
+    get(&pc, sizeof(pc));
+    get(&idx_register, sizeof(idx_register));
+    get(&delay_timer, sizeof(delay_timer));
+    get(&sound_timer, sizeof(sound_timer));
+    get(input_keys, sizeof(input_keys));
+    get(&halt, sizeof(halt));
+    get(&rng_state, sizeof(rng_state));
+    if (rng_state == 0) rng_state = CHIP8_DEFAULT_SEED;
+    get(&frame_remainder, sizeof(frame_remainder));
+    frame_remainder %= CHIP8_TIMER_HZ;
+    get(&cycle_debt, sizeof(cycle_debt));
+    if constexpr (variant != Chip8Variant::Chip8) get(&extended, sizeof(extended));
+    idle = Chip8Idle::None;
+
+    dirty_rows = all_rows_dirty;
+    draw_gfx = true;
+    return true;
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::run() {
+    execute(1);
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::run_cycles(uint32_t cycles) {
+    execute(cycles);
+}
+
+template <typename Policy>
+uint32_t Chip8Machine<Policy>::run_frame() {
+    // Carry the fraction over, so cpu_hz instructions are spread over every 60 frames without drifting
+    const uint32_t owed = cpu_hz + frame_remainder;
+    const uint32_t cycles = owed / CHIP8_TIMER_HZ;
+    frame_remainder = owed % CHIP8_TIMER_HZ;
+    execute(cycles);
+    update_timers();
+    return cycles;
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::set_cpu_hz(uint32_t hz) {
+    cpu_hz = hz;
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::set_timing(Chip8Timing profile) {
+    timing = profile;
+    cpu_hz = profile == Chip8Timing::CosmacVip ? CHIP8_VIP_CPU_HZ : CHIP8_DEFAULT_CPU_HZ;
+    vblank_wait = profile == Chip8Timing::CosmacVip;
+    cycle_debt = 0;
+    // Costs are charged from the decoded instructions, decode them again under the new table
+    memset(decoded, 0, sizeof(decoded));
+}
+
+template <typename Policy>
+Chip8Timing Chip8Machine<Policy>::get_timing() const {
+    return timing;
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::set_vblank_wait(bool wait) {
+    vblank_wait = wait;
+}
+
+template <typename Policy>
+Chip8Idle Chip8Machine<Policy>::get_idle() const {
+    return idle;
+}
+
+template <typename Policy>
+uint64_t Chip8Machine<Policy>::get_skipped_cycles() const {
+    return skipped_cycles;
+}
+
+template <typename Policy>
+bool Chip8Machine<Policy>::skip_idle_frames(uint64_t frames, uint64_t *instructions) {
+    // Loops waiting on the delay timer behave differently every frame, those still have to run
+    if (frames == 0 || (idle != Chip8Idle::UntilKey && idle != Chip8Idle::Forever)) return false;
+    const Chip8Idle kind = idle;
+    const uint32_t length = idle_loop_length;
+
+    // Same cycle count run_frame() would have used for these frames
+    const uint64_t owed = uint64_t(cpu_hz) * frames + frame_remainder;
+    const uint64_t cycles = owed / CHIP8_TIMER_HZ;
+    frame_remainder = owed % CHIP8_TIMER_HZ;
+    // The loop does not read the timers, they just run down
+    delay_timer = frames >= delay_timer ? 0 : delay_timer - frames;
+    sound_timer = frames >= sound_timer ? 0 : sound_timer - frames;
+    // Every full iteration ends where it started, only the position within the loop is left to run
+    const uint64_t left = cycles > cycle_debt ? cycles - cycle_debt : 0;
+    cycle_debt = 0;
+    skipped_cycles += left - left % length;
+    execute(left % length);
+
+    idle = kind;
+    idle_loop_length = length;
+    if (instructions) *instructions = cycles;
+    return true;
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::decode_at(uint16_t address) {
     // Fetch opcode, each opcode is 16 bits
-    opcode = memory[pc] << 8 | memory[pc + 1];
+    opcode = memory[address] << 8 | memory[(address + 1) & (memory_size - 1)];
     // Some sources disagree on the instruction set, so I implemented from the wikipedia set: https://en.wikipedia.org/wiki/CHIP-8#Opcode_table
     // It appears to be correct for wide range of ROMs
+    DecodedOp &op = decoded[address];
+    op.x = (opcode & 0x0F00) >> 8;
+    op.y = (opcode & 0x00F0) >> 4;
+    op.nn = opcode & 0x00FF;
+    op.nnn = opcode & 0x0FFF;
+
+    constexpr bool super_chip = variant != Chip8Variant::Chip8;
+    constexpr bool xo_chip = variant == Chip8Variant::XoChip;
 
     // Select based on first hex digit
     switch (opcode & 0xF000) {
         case 0x0000:
-            switch (opcode & 0x0F00) {
-                case 0x0000:
-                    switch (opcode & 0x000F) {
-                        case 0x0000:
-                            // Clear screen
-                            memset(gfx, 0, sizeof(gfx));
-                            draw_gfx = true;
-                            pc += 2;
-                            break;
-                        case 0x000E:
-                            // Return from subroutine
-                            sp--;
-                            pc = stack[sp];
-                            pc += 2;
-                            break;
-                    }
-                    break;
-            }
-            break;
-        case 0x1000:
-            // (1NNN) Jump to address NNN
-            pc = opcode & 0x0FFF;
-            break;
-        case 0x2000:
-            // (2NNN) Execute subroutine at address NNN
-            stack[sp] = pc;
-            sp++;
-            pc = opcode & 0x0FFF;
-            break;
-        case 0x3000:
-            // (3XNN) Skip the following instruction if the value of register VX equals NN
-            if (registers_v[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF)) pc += 4;
-            else pc += 2;
-            break;
-        case 0x4000:
-            // (4XNN) Skip the following instruction if the value of register VX is not equal to NN
-            if (registers_v[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF)) pc += 4;
-            else pc += 2;
+            if (super_chip && (opcode & 0xFFF0) == 0x00C0) op.handler = OP_SCD;
+            else if (xo_chip && (opcode & 0xFFF0) == 0x00D0) op.handler = OP_SCU;
+            else if (super_chip && opcode == 0x00FB) op.handler = OP_SCR;
+            else if (super_chip && opcode == 0x00FC) op.handler = OP_SCL;
+            else if (super_chip && opcode == 0x00FD) op.handler = OP_EXIT;
+            else if (super_chip && opcode == 0x00FE) op.handler = OP_LOW;
+            else if (super_chip && opcode == 0x00FF) op.handler = OP_HIGH;
+            else if ((opcode & 0x0F00) != 0) op.handler = OP_STALL;
+            else if ((opcode & 0x000F) == 0x0000) op.handler = OP_CLS;
+            else if ((opcode & 0x000F) == 0x000E) op.handler = OP_RET;
+            else op.handler = OP_STALL;
             break;
+        case 0x1000: op.handler = OP_JP; break;
+        case 0x2000: op.handler = OP_CALL; break;
+        case 0x3000: op.handler = OP_SE_VX_NN; break;
+        case 0x4000: op.handler = OP_SNE_VX_NN; break;
         case 0x5000:
-            // (5XY0) Skip the following instruction if the value of register VX is equal to the value of register VY
-            if (registers_v[(opcode & 0x0F00) >> 8] == registers_v[(opcode & 0x00F0) >> 4]) pc += 4;
-            else pc += 2;
-            break;
-        case 0x6000:
-            // (6XNN) Store number NN in register VX
-            registers_v[(opcode & 0x0F00) >> 8] = opcode & 0x00FF;
-            pc += 2;
-            break;
-        case 0x7000:
-            // (7XNN) Add the value NN to register VX
-            registers_v[(opcode & 0x0F00) >> 8] += (opcode & 0x00FF);
-            pc += 2;
+            if (xo_chip && (opcode & 0x000F) == 0x2) op.handler = OP_SAVE_VX_VY;
+            else if (xo_chip && (opcode & 0x000F) == 0x3) op.handler = OP_LOAD_VX_VY;
+            else op.handler = OP_SE_VX_VY;
             break;
+        case 0x6000: op.handler = OP_LD_VX_NN; break;
+        case 0x7000: op.handler = OP_ADD_VX_NN; break;
         case 0x8000:
             // Pattern: (8XY[0-7E])
             switch (opcode & 0x000F) {
-                case 0x0:
-                    // Set VX to VY
-                    registers_v[(opcode & 0x0F00) >> 8] = registers_v[(opcode & 0x00F0) >> 4];
-                    pc += 2;
-                    break;
-                case 0x1:
-                    // Set VX to VX OR VY
-                    registers_v[(opcode & 0x0F00) >> 8] |= registers_v[(opcode & 0x00F0) >> 4];
-                    pc += 2;
-                    break;
-                case 0x2:
-                    // Set VX to VX AND VY
-                    registers_v[(opcode & 0x0F00) >> 8] &= registers_v[(opcode & 0x00F0) >> 4];
-                    pc += 2;
-                    break;
-                case 0x3:
-                    // Set VX to VX XOR VY
-                    registers_v[(opcode & 0x0F00) >> 8] ^= registers_v[(opcode & 0x00F0) >> 4];
-                    pc += 2;
-                    break;
-                case 0x4:
-                    // Add the value of register VY to register VX
-                    // Set VF to 01 if a carry occurs
-                    // Set VF to 00 if a carry does not occur
-                    if (registers_v[(opcode & 0x00F0) >> 4] > (0xFF - registers_v[(opcode & 0x0F00) >> 8]))
-                        registers_v[0xF] = 1;
-                    else
-                        registers_v[0xF] = 0;
-                    registers_v[(opcode & 0x0F00) >> 8] += registers_v[(opcode & 0x00F0) >> 4];
-                    pc += 2;
-                    break;
-                case 0x5:
-                    // Subtract the value of register VY from register VX
-                    // Set VF to 00 if a borrow occurs
-                    // Set VF to 01 if a borrow does not occur
-                    if (registers_v[(opcode & 0x00F0) >> 4] > registers_v[(opcode & 0x0F00) >> 8])
-                        registers_v[0xF] = 0;
-                    else
-                        registers_v[0xF] = 1;
-                    registers_v[(opcode & 0x0F00) >> 8] -= registers_v[(opcode & 0x00F0) >> 4];
-                    pc += 2;
-                    break;
-                case 0x6:
-                    // Shift VX to right by 1, store the LSb before the shift in VF
-                    registers_v[0xF] = registers_v[(opcode & 0x0F00) >> 8] & 0x1;
-                    registers_v[(opcode & 0x0F00) >> 8] >>= 1;
-                    pc += 2;
-                    break;
-                case 0x7:
-                    // Set register VX to the value of VY minus VX
-                    // Set VF to 00 if a borrow occurs
-                    // Set VF to 01 if a borrow does not occur
-                    if (registers_v[(opcode & 0x0F00) >> 8] > registers_v[(opcode & 0x00F0) >> 4])
-                        registers_v[0xF] = 0;
-                    else
-                        registers_v[0xF] = 1;
-                    registers_v[(opcode & 0x0F00) >> 8] = registers_v[(opcode & 0x00F0) >> 4] - registers_v[(opcode & 0x0F00) >> 8];
-                    pc += 2;
-                    break;
-                case 0xE:
-                    // Shift VX to left by 1, store the MSb before the shift in VF
-                    registers_v[0xF] = registers_v[(opcode & 0x0F00) >> 8] >> 7;
-                    registers_v[(opcode & 0x0F00) >> 8] <<= 1;
-                    pc += 2;
-                    break;
+                case 0x0: op.handler = OP_LD_VX_VY; break;
+                case 0x1: op.handler = OP_OR; break;
+                case 0x2: op.handler = OP_AND; break;
+                case 0x3: op.handler = OP_XOR; break;
+                case 0x4: op.handler = OP_ADD_VX_VY; break;
+                case 0x5: op.handler = OP_SUB; break;
+                case 0x6: op.handler = OP_SHR; break;
+                case 0x7: op.handler = OP_SUBN; break;
+                case 0xE: op.handler = OP_SHL; break;
+                default: op.handler = OP_STALL;
             }
             break;
-        case 0x9000:
-            // (9XY0) Skip the following instruction if the value of register VX is not equal to the value of register VY
-            if (registers_v[(opcode & 0x0F00) >> 8] != registers_v[(opcode & 0x00F0) >> 4]) pc += 4;
-            else pc += 2;
-            break;
-        case 0xA000:
-            // (ANNN) Store memory address NNN in register I
-            idx_register = opcode & 0x0FFF;
-            pc += 2;
-            break;
-        case 0xB000:
-            // (BNNN) Jump to address NNN + V0
-            pc = (opcode & 0x0FFF) + registers_v[0];
-            break;
-        case 0xC000:
-            // (CXNN) Set VX to a random number with a mask of NN
-            registers_v[(opcode & 0x0F00) >> 8] = dist(rng) & (opcode & 0x00FF);
-            pc += 2;
-            break;
+        case 0x9000: op.handler = OP_SNE_VX_VY; break;
+        case 0xA000: op.handler = OP_LD_I; break;
+        case 0xB000: op.handler = OP_JP_V0; break;
+        case 0xC000: op.handler = OP_RND; break;
         case 0xD000:
-            {
-            // (DXYN) Draw a sprite at position VX, VY with N bytes of sprite data starting at the address stored in I
-            // Set VF to 01 if any set pixels are changed to unset, and 00 otherwise
-            // The corresponding graphic on the screen will be 8 px wide and N pixels high
-            registers_v[0xF] = 0;
-            const uint8_t x_coord = registers_v[(opcode & 0x0F00) >> 8];
-            const uint8_t y_coord = registers_v[(opcode & 0x00F0) >> 4];
-            const uint8_t N = opcode & 0x000F;
-
-            for (int y_offset = 0; y_offset < N; ++y_offset) {
-                const uint8_t rowTexture = memory[idx_register + y_offset];
-                for (int x_offset = 0; x_offset < 8; ++x_offset) {
-                    if ((rowTexture & (0x80 >> x_offset)) != 0) {
-                        // We check if the current pixel is 1, XORing with one indicates a pixel flip
-                        if(gfx[((y_coord + y_offset) * CHIP8_DISPLAY_WIDTH) + (x_coord + x_offset)] == 1)
-                        {
-                            // Register F indicates if a flip of the pixel happened, for collision detection purposes we
-                            // need to keep track of this
-                            registers_v[0xF] = 1;
-                        }
-                        // gfx is 64 x 32
-                        gfx[((y_coord + y_offset) * CHIP8_DISPLAY_WIDTH) + (x_coord + x_offset)] ^= 1;
-                    }
-                }
-            }
-            draw_gfx = true;
-            pc += 2;
+            op.handler = OP_DRW;
+            op.nn = opcode & 0x000F;
             break;
-            }
         case 0xE000:
             switch (opcode & 0x00FF) {
-                case 0x009E:
-                    // Skip the following instruction if the key corresponding to the hex value currently stored in register VX is pressed
-                    if (input_keys[registers_v[(opcode & 0x0F00) >> 8]] != 0) {
-                        pc += 4;
-                    } else {
-                        pc += 2;
-                    }
-                    break;
-                case 0x00A1:
-                    // Skip the following instruction if the key corresponding to the hex value currently stored in register VX is not pressed
-                    if (input_keys[registers_v[(opcode & 0x0F00) >> 8]] == 0) {
-                        pc += 4;
-                    } else {
-                        pc += 2;
-                    }
-                    break;
+                case 0x009E: op.handler = OP_SKP; break;
+                case 0x00A1: op.handler = OP_SKNP; break;
+                default: op.handler = OP_STALL;
             }
             break;
         case 0xF000:
+            if (xo_chip && opcode == 0xF000) {
+                // The address is the whole next word, making this the only 4-byte instruction
+                op.handler = OP_LD_I_LONG;
+                op.nnn = memory[(address + 2) & (memory_size - 1)] << 8 | memory[(address + 3) & (memory_size - 1)];
+                break;
+            }
+            if (xo_chip && opcode == 0xF002) {
+                op.handler = OP_AUDIO;
+                break;
+            }
             switch (opcode & 0x00FF) {
-                case 0x07:
-                    // Store the current value of the delay timer in register VX
-                    registers_v[(opcode & 0x0F00) >> 8] = delay_timer;
-                    pc += 2;
-                    break;
-                case 0x0A: {
-                    // Wait for a keypress and store the result in register VX
-                    bool keyPress = false;
-
-                    for(int i = 0; i < CHIP8_KEY_SIZE; ++i)
-                    {
-                        if(input_keys[i] != 0)
-                        {
-                            registers_v[(opcode & 0x0F00) >> 8] = i;
-                            keyPress = true;
-                        }
-                    }
-                    // If no press received, we return to cycle through the same instruction instead of increasing the PC
-                    if(!keyPress)
-                        return;
-
-                    pc += 2;
-                    break;
-                }
-                case 0x15:
-                    // Set the delay timer to the value of register VX
-                    delay_timer = registers_v[(opcode & 0x0F00) >> 8];
-                    pc += 2;
-                    break;
-                case 0x18:
-                    // Set the sound timer to the value of register VX
-                    sound_timer = registers_v[(opcode & 0x0F00) >> 8];
-                    pc += 2;
-                    break;
-                case 0x1E:
-                    // Add the value stored in register VX to register I
-                    if(idx_register + registers_v[(opcode & 0x0F00) >> 8] > 0xFFF)
-                        registers_v[0xF] = 1;
-                    else
-                        registers_v[0xF] = 0;
-                    idx_register += registers_v[(opcode & 0x0F00) >> 8];
-                    pc += 2;
-                    break;
-                case 0x29:
-                    // Set I to the memory address of the sprite data corresponding to the hexadecimal digit stored in register VX
-                    // Each font char is represented by 4x5 sprite
-                    idx_register = registers_v[(opcode & 0x0F00) >> 8] * 5;
-                    pc += 2;
-                    break;
-                case 0x33:
-                    // Store the binary-coded decimal equivalent of the value stored in register VX at addresses I, I + 1, and I + 2
-                    memory[idx_register] = registers_v[(opcode & 0x0F00) >> 8] / 100;
-                    memory[idx_register + 1] = (registers_v[(opcode & 0x0F00) >> 8] / 10) % 10;
-                    memory[idx_register + 2] = registers_v[(opcode & 0x0F00) >> 8] % 10;
-                    pc += 2;
-                    break;
-                case 0x55:
-                {
-                    // Store the values of registers V0 to VX inclusive in memory starting at address I
-                    // I is set to I + X + 1 after operation
-                    const int X = (opcode & 0x0F00) >> 8;
-                    for (int i = 0; i <= X; ++i)
-                        memory[idx_register + i] = registers_v[i];
-
-                    idx_register = idx_register + X + 1;
-                    pc += 2;
-                    break;
-                }
-                case 0x65: {
-                    // Fill registers V0 to VX inclusive with the values stored in memory starting at address I
-                    // I is set to I + X + 1 after operation
-                    const int X = (opcode & 0x0F00) >> 8;
-                    for (int i = 0; i <= X; ++i)
-                        registers_v[i] = memory[idx_register + i];
-
-                    idx_register = idx_register + X + 1;
-                    pc += 2;
-                    break;
-                }
-                default:
-                    std::cout << "Unknown opcode: 0x" << std::hex << opcode << std::endl;
+                case 0x01: op.handler = xo_chip ? OP_PLANE : OP_UNKNOWN; break;
+                case 0x3A: op.handler = xo_chip ? OP_PITCH : OP_UNKNOWN; break;
+                case 0x30: op.handler = super_chip ? OP_LD_HF : OP_UNKNOWN; break;
+                case 0x75: op.handler = super_chip ? OP_LD_R_VX : OP_UNKNOWN; break;
+                case 0x85: op.handler = super_chip ? OP_LD_VX_R : OP_UNKNOWN; break;
+                case 0x07: op.handler = OP_LD_VX_DT; break;
+                case 0x0A: op.handler = OP_LD_VX_K; break;
+                case 0x15: op.handler = OP_LD_DT; break;
+                case 0x18: op.handler = OP_LD_ST; break;
+                case 0x1E: op.handler = OP_ADD_I; break;
+                case 0x29: op.handler = OP_LD_F; break;
+                case 0x33: op.handler = OP_LD_B; break;
+                case 0x55: op.handler = OP_LD_I_VX; break;
+                case 0x65: op.handler = OP_LD_VX_I; break;
+                default: op.handler = OP_UNKNOWN;
             }
             break;
+    }
+    // Neither handler reads NNN, the trace needs the whole opcode to tell which instruction it was
+    if (op.handler == OP_STALL || op.handler == OP_UNKNOWN) op.nnn = opcode;
+    op.cost = cycle_cost(op);
+}
+
+// Approximate COSMAC VIP costs, in machine cycles: the interpreter's fetch and dispatch, then each instruction's
+// routine, with DXYN growing by the row and FX55 / FX65 by the register
+#define CHIP8_VIP_FETCH_CYCLES 40
+#define CHIP8_VIP_ROW_CYCLES 68
+#define CHIP8_VIP_REGISTER_CYCLES 14
+
+template <typename Policy>
+uint16_t Chip8Machine<Policy>::cycle_cost(const DecodedOp &op) const {
+    if (timing == Chip8Timing::Instructions) return 1;
+    // Same order as Op. The extensions never ran on the VIP, they are charged like the nearest original
+    // instruction: scrolls and resolution switches like 00E0, register ranges like FX55
+    static constexpr uint16_t vip_cycles[] = {
+        0, 3078, 10, 0, 12, 26, 10, 10, 14, 6, 10, 12, 44, 44, 44, 44, 44, 44, 44, 44, 14, 12, 22, 36, 26, 14, 14,
+        10, 18, 10, 10, 16, 16, 152, 14, 14, 0,
+        3078, 3078, 3078, 0, 3078, 3078, 16, 14, 14,
+        3078, 14, 14, 24, 10, 14 + 16 * CHIP8_VIP_REGISTER_CYCLES, 10
+    };
+    static_assert(sizeof(vip_cycles) / sizeof(vip_cycles[0]) == OP_COUNT, "vip_cycles must list every handler");
+    uint32_t cycles = CHIP8_VIP_FETCH_CYCLES + vip_cycles[op.handler];
+    switch (op.handler) {
+        case OP_DRW:
+            cycles += (variant != Chip8Variant::Chip8 && op.nn == 0 ? 16 : op.nn) * CHIP8_VIP_ROW_CYCLES;
+            break;
+        case OP_LD_I_VX: case OP_LD_VX_I: case OP_LD_R_VX: case OP_LD_VX_R:
+            cycles += (op.x + 1) * CHIP8_VIP_REGISTER_CYCLES;
+            break;
+        case OP_SAVE_VX_VY: case OP_LOAD_VX_VY:
+            cycles += (std::abs(op.x - op.y) + 1) * CHIP8_VIP_REGISTER_CYCLES;
+            break;
         default:
-            std::cout << "Unknown opcode: 0x" << std::hex << opcode << std::endl;
+            break;
+    }
+    return cycles;
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::rewrite_memory(uint32_t address, const uint8_t *data, uint32_t length) {
+    // Chunk by chunk, only those that differ are copied and have their decoded instructions dropped
+    constexpr uint32_t chunk = 64;
+    for (uint32_t offset = 0; offset < length; offset += chunk) {
+        const uint32_t size = std::min(chunk, length - offset);
+        if (memcmp(memory + address + offset, data + offset, size) != 0) {
+            memcpy(memory + address + offset, data + offset, size);
+            invalidate_decoded(address + offset, size);
+        }
+    }
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::invalidate_decoded(uint16_t address, uint32_t length) {
+    // Instructions starting up to one byte before the write overlap it as well, three for F000 NNNN
+    constexpr int overlap = variant == Chip8Variant::XoChip ? 3 : 1;
+    for (int i = -overlap; i < int(length); ++i)
+        decoded[(address + i) & (memory_size - 1)] = DecodedOp();
+    side_effects++;
+    idle = Chip8Idle::None;
+    if (!code_write_hook) return;
+    // Stores through I wrap around memory, hooks only ever see ranges inside it: one up to the end, one from 0
+    const uint32_t start = address & (memory_size - 1);
+    const uint32_t size = std::min<uint32_t>(length, memory_size);
+    const uint32_t head = std::min(size, memory_size - start);
+    code_write_hook(code_write_context, start, head);
+    if (head < size) code_write_hook(code_write_context, 0, size - head);
+}
+
+template <typename Policy>
+uint8_t Chip8Machine<Policy>::next_random() {
+    // xorshift32, the top byte is the best mixed
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state >> 24;
+}
+
+template <typename Policy>
+bool Chip8Machine<Policy>::probe_idle(uint32_t cycles_left) {
+    IdleProbe &probe = idle_probe;
+    if (probe.pc == pc && probe.cycles_left > cycles_left && probe.side_effects == side_effects
+        && probe.rng_state == rng_state && probe.idx_register == idx_register && probe.sp == sp
+        && probe.delay_timer == delay_timer && probe.sound_timer == sound_timer
+        && memcmp(probe.registers_v, registers_v, sizeof(registers_v)) == 0) {
+        idle_loop_length = probe.cycles_left - cycles_left;
+        // A delay timer already at 0 stays there, polling it is no different from spinning
+        if (probe.timer_reads != timer_reads && delay_timer > 0) idle = Chip8Idle::UntilTimer;
+        else if (probe.key_reads != key_reads) idle = Chip8Idle::UntilKey;
+        else idle = Chip8Idle::Forever;
+        return true;
     }
+    // Any later visit with the same state proves the loop idle, so busy loops need not be re-recorded every time
+    if (probe.pc < memory_size && --idle_probe_countdown > 0) return false;
+    idle_probe_countdown = CHIP8_IDLE_PROBE_INTERVAL;
+    probe.pc = pc;
+    probe.cycles_left = cycles_left;
+    probe.side_effects = side_effects;
+    probe.timer_reads = timer_reads;
+    probe.key_reads = key_reads;
+    probe.rng_state = rng_state;
+    probe.idx_register = idx_register;
+    probe.sp = sp;
+    probe.delay_timer = delay_timer;
+    probe.sound_timer = sound_timer;
+    memcpy(probe.registers_v, registers_v, sizeof(registers_v));
+    return false;
 }
 
-void Chip8::update_timers() {
+template <typename Policy>
+void Chip8Machine<Policy>::execute(uint32_t cycles) {
+    const DecodedOp *op;
+    // Each instruction is charged its cost as it is fetched, the one that takes the budget below 1 still runs
+    // and what it overran is owed by the next call
+    int64_t budget = int64_t(cycles) - cycle_debt;
+    // Input and timers only change between calls, so a loop found idle here stays idle until we return
+    idle = Chip8Idle::None;
+    idle_probe.pc = memory_size;
+
+#if CHIP8_PROFILE
+    // XO-CHIP addresses are folded into the 4 KB of the counters
+#define CHIP8_PROFILE_FETCH() (profile.address_hits[pc & (CHIP8_MEMORY_SIZE - 1)]++)
+#define CHIP8_PROFILE_DISPATCH() \
+    (profile.op_counts[op->handler]++, profile.address_op[pc & (CHIP8_MEMORY_SIZE - 1)] = op->handler)
+#define CHIP8_PROFILE_COUNT(counter) (profile.counter++)
+#else
+#define CHIP8_PROFILE_FETCH() ((void) 0)
+#define CHIP8_PROFILE_DISPATCH() ((void) 0)
+#define CHIP8_PROFILE_COUNT(counter) ((void) 0)
+#endif
+
+#if CHIP8_TRACE
+    // One store per instruction, built from the decoded entry. The head stays in a register until we return, and
+    // does not move while a fault trace is pending, see fault().
+    uint64_t head = trace_head;
+#define CHIP8_TRACE_RECORD(at) \
+    (trace[(at) & (CHIP8_TRACE_SIZE - 1)] = pc | uint64_t(idx_register) << 16 | uint64_t(op->nnn) << 32 | \
+                                            uint64_t(op->handler) << 48)
+#define CHIP8_TRACE_DISPATCH() (CHIP8_TRACE_RECORD(head), head += !fault_trace_pending)
+#define CHIP8_TRACE_DECODED() CHIP8_TRACE_RECORD(head - !fault_trace_pending)
+#define CHIP8_TRACE_SAVE() (trace_head = head)
+#else
+#define CHIP8_TRACE_DISPATCH() ((void) 0)
+#define CHIP8_TRACE_DECODED() ((void) 0)
+#define CHIP8_TRACE_SAVE() ((void) 0)
+#endif
+
+    // Gives up the budget above `kept` without running it, counted in skipped_cycles
+#define CHIP8_SKIP_TO(kept) \
+    do { \
+        const int64_t skip_kept = (kept); \
+        if (budget > skip_kept) { \
+            skipped_cycles += uint64_t(budget - skip_kept); \
+            budget = skip_kept; \
+        } \
+    } while (0)
+
+#if CHIP8_THREADED_DISPATCH
+    // Same order as Op
+    static void *const dispatch_table[OP_COUNT] = {
+        &&op_OP_DECODE, &&op_OP_CLS, &&op_OP_RET, &&op_OP_STALL, &&op_OP_JP, &&op_OP_CALL, &&op_OP_SE_VX_NN,
+        &&op_OP_SNE_VX_NN, &&op_OP_SE_VX_VY, &&op_OP_LD_VX_NN, &&op_OP_ADD_VX_NN, &&op_OP_LD_VX_VY, &&op_OP_OR,
+        &&op_OP_AND, &&op_OP_XOR, &&op_OP_ADD_VX_VY, &&op_OP_SUB, &&op_OP_SHR, &&op_OP_SUBN, &&op_OP_SHL,
+        &&op_OP_SNE_VX_VY, &&op_OP_LD_I, &&op_OP_JP_V0, &&op_OP_RND, &&op_OP_DRW, &&op_OP_SKP, &&op_OP_SKNP,
+        &&op_OP_LD_VX_DT, &&op_OP_LD_VX_K, &&op_OP_LD_DT, &&op_OP_LD_ST, &&op_OP_ADD_I, &&op_OP_LD_F, &&op_OP_LD_B,
+        &&op_OP_LD_I_VX, &&op_OP_LD_VX_I, &&op_OP_UNKNOWN, &&op_OP_SCD, &&op_OP_SCR, &&op_OP_SCL, &&op_OP_EXIT,
+        &&op_OP_LOW, &&op_OP_HIGH, &&op_OP_LD_HF, &&op_OP_LD_R_VX, &&op_OP_LD_VX_R, &&op_OP_SCU, &&op_OP_SAVE_VX_VY,
+        &&op_OP_LOAD_VX_VY, &&op_OP_LD_I_LONG, &&op_OP_PLANE, &&op_OP_AUDIO, &&op_OP_PITCH
+    };
+#define CHIP8_OP(handler) op_##handler
+#define CHIP8_NEXT() \
+    do { \
+        if (budget <= 0) { \
+            cycle_debt = -budget; \
+            CHIP8_TRACE_SAVE(); \
+            return; \
+        } \
+        op = &decoded[pc & (memory_size - 1)]; \
+        budget -= op->cost; \
+        CHIP8_TRACE_DISPATCH(); \
+        CHIP8_PROFILE_FETCH(); \
+        CHIP8_PROFILE_DISPATCH(); \
+        goto *dispatch_table[op->handler]; \
+    } while (0)
+#define CHIP8_REDISPATCH() \
+    do { \
+        CHIP8_PROFILE_DISPATCH(); \
+        goto *dispatch_table[op->handler]; \
+    } while (0)
+
+    CHIP8_NEXT();
+#else
+#define CHIP8_OP(handler) case handler
+#define CHIP8_NEXT() continue
+#define CHIP8_REDISPATCH() goto redispatch
+
+    while (budget > 0) {
+        op = &decoded[pc & (memory_size - 1)];
+        budget -= op->cost;
+        CHIP8_TRACE_DISPATCH();
+        CHIP8_PROFILE_FETCH();
+    redispatch:
+        CHIP8_PROFILE_DISPATCH();
+        switch (op->handler) {
+#endif
+    CHIP8_OP(OP_DECODE):
+        // The entry cost nothing when fetched, charge what the instruction costs
+        decode_at(pc & (memory_size - 1));
+        budget -= op->cost;
+        CHIP8_TRACE_DECODED();
+        CHIP8_REDISPATCH();
+    CHIP8_OP(OP_STALL):
+        // Unsupported instruction in a known group, PC is not advanced
+        if (halt != Chip8Halt::UnknownOpcode) fault(Chip8Fault::UnknownOpcode);
+        halt = Chip8Halt::UnknownOpcode;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_CLS):
+        // (00E0) Clear screen, only rows that had pixels set actually change
+        clear_planes();
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_RET):
+        // (00EE) Return from subroutine, halts here if the stack is empty (or SP came out of a bad snapshot)
+        if (sp - 1u >= CHIP8_STACK_SIZE) {
+            if (halt != Chip8Halt::StackFault) fault(Chip8Fault::StackUnderflow);
+            halt = Chip8Halt::StackFault;
+            CHIP8_NEXT();
+        }
+        sp--;
+        pc = stack[sp];
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_JP):
+        // (1NNN) Jump to address NNN
+        // Loops close with a backward jump, skip whole iterations of one that provably repeats itself
+        if (op->nnn <= pc && budget >= 0 && probe_idle(budget)) CHIP8_SKIP_TO(budget % idle_loop_length);
+        pc = op->nnn;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_CALL):
+        // (2NNN) Execute subroutine at address NNN, halts here if the stack is full
+        if (sp >= CHIP8_STACK_SIZE) {
+            if (halt != Chip8Halt::StackFault) fault(Chip8Fault::StackOverflow);
+            halt = Chip8Halt::StackFault;
+            CHIP8_NEXT();
+        }
+        stack[sp] = pc;
+        sp++;
+        pc = op->nnn;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_SE_VX_NN):
+        // (3XNN) Skip the following instruction if the value of register VX equals NN
+        pc += registers_v[op->x] == op->nn ? skip_length() : 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_SNE_VX_NN):
+        // (4XNN) Skip the following instruction if the value of register VX is not equal to NN
+        pc += registers_v[op->x] != op->nn ? skip_length() : 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_SE_VX_VY):
+        // (5XY0) Skip the following instruction if the value of register VX is equal to the value of register VY
+        pc += registers_v[op->x] == registers_v[op->y] ? skip_length() : 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_LD_VX_NN):
+        // (6XNN) Store number NN in register VX
+        registers_v[op->x] = op->nn;
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_ADD_VX_NN):
+        // (7XNN) Add the value NN to register VX
+        registers_v[op->x] += op->nn;
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_LD_VX_VY):
+        // (8XY0) Set VX to VY
+        registers_v[op->x] = registers_v[op->y];
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_OR):
+        // (8XY1) Set VX to VX OR VY
+        registers_v[op->x] |= registers_v[op->y];
+        if constexpr (Policy::logic_resets_vf) registers_v[0xF] = 0;
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_AND):
+        // (8XY2) Set VX to VX AND VY
+        registers_v[op->x] &= registers_v[op->y];
+        if constexpr (Policy::logic_resets_vf) registers_v[0xF] = 0;
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_XOR):
+        // (8XY3) Set VX to VX XOR VY
+        registers_v[op->x] ^= registers_v[op->y];
+        if constexpr (Policy::logic_resets_vf) registers_v[0xF] = 0;
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_ADD_VX_VY):
+        // (8XY4) Add the value of register VY to register VX
+        // Set VF to 01 if a carry occurs
+        // Set VF to 00 if a carry does not occur
+        registers_v[0xF] = registers_v[op->y] > (0xFF - registers_v[op->x]);
+        registers_v[op->x] += registers_v[op->y];
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_SUB):
+        // (8XY5) Subtract the value of register VY from register VX
+        // Set VF to 00 if a borrow occurs
+        // Set VF to 01 if a borrow does not occur
+        registers_v[0xF] = !(registers_v[op->y] > registers_v[op->x]);
+        registers_v[op->x] -= registers_v[op->y];
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_SHR):
+        // (8XY6) Shift VX to right by 1, store the LSb before the shift in VF
+        if constexpr (Policy::shift_uses_vy) {
+            // VX = VY >> 1, the flag is written last
+            const uint8_t value = registers_v[op->y];
+            registers_v[op->x] = value >> 1;
+            registers_v[0xF] = value & 0x1;
+        } else {
+            registers_v[0xF] = registers_v[op->x] & 0x1;
+            registers_v[op->x] >>= 1;
+        }
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_SUBN):
+        // (8XY7) Set register VX to the value of VY minus VX
+        // Set VF to 00 if a borrow occurs
+        // Set VF to 01 if a borrow does not occur
+        registers_v[0xF] = !(registers_v[op->x] > registers_v[op->y]);
+        registers_v[op->x] = registers_v[op->y] - registers_v[op->x];
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_SHL):
+        // (8XYE) Shift VX to left by 1, store the MSb before the shift in VF
+        if constexpr (Policy::shift_uses_vy) {
+            const uint8_t value = registers_v[op->y];
+            registers_v[op->x] = value << 1;
+            registers_v[0xF] = value >> 7;
+        } else {
+            registers_v[0xF] = registers_v[op->x] >> 7;
+            registers_v[op->x] <<= 1;
+        }
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_SNE_VX_VY):
+        // (9XY0) Skip the following instruction if the value of register VX is not equal to the value of register VY
+        pc += registers_v[op->x] != registers_v[op->y] ? skip_length() : 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_LD_I):
+        // (ANNN) Store memory address NNN in register I
+        idx_register = op->nnn;
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_JP_V0):
+        // (BNNN) Jump to address NNN + V0, or (BXNN) to XNN + VX, see Policy::jump_uses_vx
+        pc = op->nnn + registers_v[Policy::jump_uses_vx ? op->x : 0];
+        CHIP8_NEXT();
+    CHIP8_OP(OP_RND):
+        // (CXNN) Set VX to a random number with a mask of NN
+        registers_v[op->x] = next_random() & op->nn;
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_DRW): {
+        // (DXYN) Draw a sprite at position VX, VY with N bytes of sprite data starting at the address stored in I
+        // Set VF to 01 if any set pixels are changed to unset, and 00 otherwise
+        // The corresponding graphic on the screen will be 8 px wide and N pixels high
+        // The starting position wraps around the display, the sprite itself is clipped at the edges
+        if constexpr (variant != Chip8Variant::Chip8 || !Policy::clip_sprites) {
+            // Large sprites, planes, low resolution scaling or wrapping, see draw_extended()
+            registers_v[0xF] = draw_extended(registers_v[op->x], registers_v[op->y], op->nn);
+        } else {
+            const uint8_t x_coord = registers_v[op->x] % display_width;
+            const uint8_t y_coord = registers_v[op->y] % display_height;
+            const int rows = std::min<int>(op->nn, display_height - y_coord);
+            uint64_t collision = 0;
+            check_index_range(rows);
+
+            for (int y_offset = 0; y_offset < rows; ++y_offset) {
+                // Place the sprite byte at the top of the word, pixels shifted past bit 0 are clipped
+                const uint64_t sprite = static_cast<uint64_t>(memory[(idx_register + y_offset) & (memory_size - 1)]) << 56 >> x_coord;
+                uint64_t &row = gfx[0][y_coord + y_offset][0];
+                // Register F indicates if a set pixel was flipped, for collision detection purposes
+                collision |= row & sprite;
+                row ^= sprite;
+                if (sprite != 0) dirty_rows |= 1ull << (y_coord + y_offset);
+            }
+            registers_v[0xF] = collision != 0;
+            draw_gfx = true;
+            side_effects++;
+        }
+        // The VIP interpreter draws in step with the display interrupt, at most one sprite goes out per frame
+        if (vblank_wait) CHIP8_SKIP_TO(0);
+        pc += 2;
+        CHIP8_NEXT();
+    }
+    CHIP8_OP(OP_SKP):
+        // (EX9E) Skip the following instruction if the key corresponding to the hex value currently stored in register VX is pressed
+        // Only the low nibble of VX picks the key, as on the COSMAC VIP
+        pc += input_keys[registers_v[op->x] & 0xF] != 0 ? skip_length() : 2;
+        key_reads++;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_SKNP):
+        // (EXA1) Skip the following instruction if the key corresponding to the hex value currently stored in register VX is not pressed
+        pc += input_keys[registers_v[op->x] & 0xF] == 0 ? skip_length() : 2;
+        key_reads++;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_LD_VX_DT):
+        // (FX07) Store the current value of the delay timer in register VX
+        registers_v[op->x] = delay_timer;
+        timer_reads++;
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_LD_VX_K): {
+        // (FX0A) Wait for a keypress and store the result in register VX
+        bool keyPress = false;
+
+        for(int i = 0; i < CHIP8_KEY_SIZE; ++i)
+        {
+            if(input_keys[i] != 0)
+            {
+                registers_v[op->x] = i;
+                keyPress = true;
+            }
+        }
+        // If no press received, we cycle through the same instruction instead of increasing the PC
+        if(keyPress) {
+            halt = Chip8Halt::None;
+            pc += 2;
+        } else {
+            halt = Chip8Halt::WaitingForKey;
+            CHIP8_PROFILE_COUNT(key_wait_stalls);
+            // Nothing changes until a key is pressed, which cannot happen before we return
+            idle = Chip8Idle::UntilKey;
+            idle_loop_length = 1;
+            CHIP8_SKIP_TO(0);
+        }
+        CHIP8_NEXT();
+    }
+    CHIP8_OP(OP_LD_DT):
+        // (FX15) Set the delay timer to the value of register VX
+        delay_timer = registers_v[op->x];
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_LD_ST):
+        // (FX18) Set the sound timer to the value of register VX
+        sound_timer = registers_v[op->x];
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_ADD_I):
+        // (FX1E) Add the value stored in register VX to register I
+        registers_v[0xF] = idx_register + registers_v[op->x] > 0xFFF;
+        idx_register += registers_v[op->x];
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_LD_F):
+        // (FX29) Set I to the memory address of the sprite data corresponding to the hexadecimal digit stored in register VX
+        // Each font char is represented by 4x5 sprite
+        idx_register = registers_v[op->x] * 5;
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_LD_B): {
+        // (FX33) Store the binary-coded decimal equivalent of the value stored in register VX at addresses I, I + 1, and I + 2
+        const uint8_t value = registers_v[op->x];
+        check_index_range(3);
+        memory[idx_register & (memory_size - 1)] = value / 100;
+        memory[(idx_register + 1) & (memory_size - 1)] = (value / 10) % 10;
+        memory[(idx_register + 2) & (memory_size - 1)] = value % 10;
+        // The written bytes may hold code, e.g. self-modifying ROMs
+        invalidate_decoded(idx_register, 3);
+        pc += 2;
+        CHIP8_NEXT();
+    }
+    CHIP8_OP(OP_LD_I_VX): {
+        // (FX55) Store the values of registers V0 to VX inclusive in memory starting at address I
+        // I is set to I + X + 1 after operation, see Policy::load_store_increments_i
+        const int X = op->x;
+        check_index_range(X + 1);
+        for (int i = 0; i <= X; ++i)
+            memory[(idx_register + i) & (memory_size - 1)] = registers_v[i];
+
+        invalidate_decoded(idx_register, X + 1);
+        if constexpr (Policy::load_store_increments_i) idx_register = idx_register + X + 1;
+        pc += 2;
+        CHIP8_NEXT();
+    }
+    CHIP8_OP(OP_LD_VX_I): {
+        // (FX65) Fill registers V0 to VX inclusive with the values stored in memory starting at address I
+        // I is set to I + X + 1 after operation
+        const int X = op->x;
+        check_index_range(X + 1);
+        for (int i = 0; i <= X; ++i)
+            registers_v[i] = memory[(idx_register + i) & (memory_size - 1)];
+
+        if constexpr (Policy::load_store_increments_i) idx_register = idx_register + X + 1;
+        pc += 2;
+        CHIP8_NEXT();
+    }
+    CHIP8_OP(OP_UNKNOWN):
+        // Unsupported FXNN, PC is not advanced; the trace shows which one
+        if (halt != Chip8Halt::UnknownOpcode) fault(Chip8Fault::UnknownOpcode);
+        halt = Chip8Halt::UnknownOpcode;
+        CHIP8_NEXT();
+    // Only decoded by the extended variants, the handlers below never run on the original machine
+    CHIP8_OP(OP_SCD):
+        // (00CN) Scroll the selected planes down by N pixels
+        scroll_vertical(op->nn & 0xF);
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_SCU):
+        // (00DN) Scroll the selected planes up by N pixels
+        scroll_vertical(-(op->nn & 0xF));
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_SCR):
+        // (00FB) Scroll the selected planes right by 4 pixels
+        scroll_horizontal(4);
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_SCL):
+        // (00FC) Scroll the selected planes left by 4 pixels
+        scroll_horizontal(-4);
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_EXIT):
+        // (00FD) Exit the interpreter, PC stays here until reset
+        halt = Chip8Halt::Exited;
+        idle = Chip8Idle::Forever;
+        idle_loop_length = 1;
+        CHIP8_SKIP_TO(0);
+        CHIP8_NEXT();
+    CHIP8_OP(OP_LOW):
+    CHIP8_OP(OP_HIGH): {
+        // (00FE / 00FF) Switch to low / high resolution, which clears every plane
+        extended.high_resolution = op->nn == 0xFF;
+        memset(gfx, 0, sizeof(gfx));
+        dirty_rows = all_rows_dirty;
+        draw_gfx = true;
+        side_effects++;
+        pc += 2;
+        CHIP8_NEXT();
+    }
+    CHIP8_OP(OP_LD_HF):
+        // (FX30) Set I to the 8x10 sprite of the hexadecimal digit in VX
+        idx_register = CHIP8_ADDR_BIG_FONT + (registers_v[op->x] & 0xF) * 10;
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_LD_R_VX):
+        // (FX75) Store V0 to VX in the RPL user flags
+        memcpy(extended.flags, registers_v, op->x + 1);
+        side_effects++;
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_LD_VX_R):
+        // (FX85) Fill V0 to VX from the RPL user flags
+        memcpy(registers_v, extended.flags, op->x + 1);
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_SAVE_VX_VY): {
+        // (5XY2) Store VX to VY, in either order, at I onwards; I is left unchanged
+        const int step = op->x <= op->y ? 1 : -1;
+        const int count = std::abs(op->y - op->x) + 1;
+        check_index_range(count);
+        for (int i = 0; i < count; ++i)
+            memory[(idx_register + i) & (memory_size - 1)] = registers_v[op->x + i * step];
+        invalidate_decoded(idx_register, count);
+        pc += 2;
+        CHIP8_NEXT();
+    }
+    CHIP8_OP(OP_LOAD_VX_VY): {
+        // (5XY3) Fill VX to VY, in either order, from I onwards; I is left unchanged
+        const int step = op->x <= op->y ? 1 : -1;
+        const int count = std::abs(op->y - op->x) + 1;
+        check_index_range(count);
+        for (int i = 0; i < count; ++i)
+            registers_v[op->x + i * step] = memory[(idx_register + i) & (memory_size - 1)];
+        pc += 2;
+        CHIP8_NEXT();
+    }
+    CHIP8_OP(OP_LD_I_LONG):
+        // (F000 NNNN) Store the 16-bit address NNNN in register I
+        idx_register = op->nnn;
+        pc += 4;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_PLANE):
+        // (FN01) Select the planes drawn, cleared and scrolled, as a bit mask
+        extended.plane_mask = op->x & ((1 << display_planes) - 1);
+        side_effects++;
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_AUDIO):
+        // (F002) Load the 16-byte audio pattern from I onwards
+        check_index_range(16);
+        for (int i = 0; i < 16; ++i)
+            extended.audio_pattern[i] = memory[(idx_register + i) & (memory_size - 1)];
+        side_effects++;
+        pc += 2;
+        CHIP8_NEXT();
+    CHIP8_OP(OP_PITCH):
+        // (FX3A) Set the audio pattern playback pitch to VX
+        extended.pitch = registers_v[op->x];
+        side_effects++;
+        pc += 2;
+        CHIP8_NEXT();
+#if !CHIP8_THREADED_DISPATCH
+        default:
+            CHIP8_NEXT();
+        }
+    }
+    cycle_debt = -budget;
+    CHIP8_TRACE_SAVE();
+#endif
+#undef CHIP8_OP
+#undef CHIP8_NEXT
+#undef CHIP8_REDISPATCH
+#undef CHIP8_TRACE_RECORD
+#undef CHIP8_TRACE_DISPATCH
+#undef CHIP8_TRACE_DECODED
+#undef CHIP8_TRACE_SAVE
+#undef CHIP8_SKIP_TO
+#undef CHIP8_PROFILE_FETCH
+#undef CHIP8_PROFILE_DISPATCH
+#undef CHIP8_PROFILE_COUNT
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::fault(Chip8Fault kind) {
+    fault_counts[static_cast<int>(kind)]++;
+    // A fault inside a loop happens on every iteration, the trace leading up to the first one is what matters
+    if (fault_trace_pending || (kind == last_fault && pc == last_fault_pc)) return;
+    last_fault = kind;
+    last_fault_pc = pc;
+    fault_sp = sp;
+    memcpy(fault_registers_v, registers_v, sizeof(registers_v));
+    memcpy(fault_stack, stack, sizeof(stack));
+    fault_trace_pending = true;
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::check_index_range(uint32_t length) {
+    if (idx_register + length > memory_size) fault(Chip8Fault::AddressOverflow);
+}
+
+template <typename Policy>
+uint16_t Chip8Machine<Policy>::skip_length() const {
+    if constexpr (variant == Chip8Variant::XoChip) {
+        const bool long_load = memory[(pc + 2) & (memory_size - 1)] == 0xF0 && memory[(pc + 3) & (memory_size - 1)] == 0x00;
+        return long_load ? 6 : 4;
+    }
+    return 4;
+}
+
+template <typename Policy>
+uint8_t Chip8Machine<Policy>::draw_extended(uint8_t x, uint8_t y, uint8_t n) {
+    // Low resolution pixels are 2x2 blocks of the 128x64 display, so coordinates and sprites are doubled
+    const int scale = variant == Chip8Variant::Chip8 || extended.high_resolution ? 1 : 2;
+    const bool large = variant != Chip8Variant::Chip8 && n == 0; // DXY0, 16x16
+    const int width = large ? 16 : 8;
+    const int height = large ? 16 : n;
+    const int x0 = x % (display_width / scale) * scale;
+    const int y0 = y % (display_height / scale) * scale;
+    uint16_t address = idx_register;
+    uint32_t length = 0; // Sprite bytes read
+    int collided_rows = 0;
+
+    // Each selected plane takes its own sprite data, one after the other
+    for (int plane = 0; plane < display_planes; ++plane) {
+        if ((extended.plane_mask >> plane & 1) == 0) continue;
+        for (int row = 0; row < height; ++row) {
+            uint32_t bits = memory[address & (memory_size - 1)];
+            if (large) bits = bits << 8 | memory[(address + 1) & (memory_size - 1)];
+            address += width / 8;
+            length += width / 8;
+            int y_pixel = y0 + row * scale;
+            if (y_pixel >= display_height) {
+                if (Policy::clip_sprites) continue;
+                y_pixel -= display_height;
+            }
+            if (bits == 0) continue;
+
+            // Sprite row at the top of the word, every pixel doubled at low resolution
+            uint64_t sprite = 0;
+            if (scale == 1) {
+                sprite = static_cast<uint64_t>(bits) << (64 - width);
+            } else {
+                for (int bit = 0; bit < width; ++bit)
+                    if (bits >> bit & 1) sprite |= 3ull << (64 - 2 * width + 2 * bit);
+            }
+            bool collision = false;
+            for (int line = 0; line < scale; ++line) {
+                collision |= xor_sprite_row(plane, y_pixel + line, x0, sprite);
+                dirty_rows |= 1ull << (y_pixel + line);
+            }
+            collided_rows += collision;
+        }
+    }
+    check_index_range(length);
+    draw_gfx = true;
+    side_effects++;
+    if (Policy::count_collision_rows && extended.high_resolution) return collided_rows;
+    return collided_rows != 0;
+}
+
+template <typename Policy>
+bool Chip8Machine<Policy>::xor_sprite_row(int plane, int y, int x, uint64_t sprite) {
+    uint64_t *row = gfx[plane][y];
+    const int word = x / 64;
+    const int shift = x % 64;
+    uint64_t collision = row[word] & (sprite >> shift);
+    row[word] ^= sprite >> shift;
+    // Pixels past the end of the word go to the next one, or around to the left edge when wrapping
+    const uint64_t spill = shift != 0 ? sprite << (64 - shift) : 0;
+    if (spill != 0 && (word + 1 < words_per_row || !Policy::clip_sprites)) {
+        uint64_t &next = row[(word + 1) % words_per_row];
+        collision |= next & spill;
+        next ^= spill;
+    }
+    return collision != 0;
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::clear_planes() {
+    for (int plane = 0; plane < display_planes; ++plane) {
+        if ((extended.plane_mask >> plane & 1) == 0) continue;
+        for (int y = 0; y < display_height; ++y) {
+            for (int word = 0; word < words_per_row; ++word) {
+                if (gfx[plane][y][word] == 0) continue;
+                dirty_rows |= 1ull << y;
+                gfx[plane][y][word] = 0;
+            }
+        }
+    }
+    side_effects++;
+    draw_gfx = true;
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::scroll_vertical(int rows) {
+    const int shift = std::abs(rows) * (extended.high_resolution ? 1 : 2);
+    constexpr size_t row_size = sizeof(gfx[0][0]);
+    for (int plane = 0; plane < display_planes; ++plane) {
+        if ((extended.plane_mask >> plane & 1) == 0) continue;
+        uint64_t (*lines)[words_per_row] = gfx[plane];
+        if (rows > 0) {
+            memmove(lines + shift, lines, (display_height - shift) * row_size);
+            memset(lines, 0, shift * row_size);
+        } else {
+            memmove(lines, lines + shift, (display_height - shift) * row_size);
+            memset(lines + display_height - shift, 0, shift * row_size);
+        }
+    }
+    dirty_rows = all_rows_dirty;
+    side_effects++;
+    draw_gfx = true;
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::scroll_horizontal(int pixels) {
+    const int shift = std::abs(pixels) * (extended.high_resolution ? 1 : 2);
+    for (int plane = 0; plane < display_planes; ++plane) {
+        if ((extended.plane_mask >> plane & 1) == 0) continue;
+        for (int y = 0; y < display_height; ++y) {
+            uint64_t *row = gfx[plane][y];
+            if (pixels > 0) {
+                for (int word = words_per_row - 1; word >= 0; --word)
+                    row[word] = row[word] >> shift | (word > 0 ? row[word - 1] << (64 - shift) : 0);
+            } else {
+                for (int word = 0; word < words_per_row; ++word)
+                    row[word] = row[word] << shift | (word + 1 < words_per_row ? row[word + 1] >> (64 - shift) : 0);
+            }
+        }
+    }
+    dirty_rows = all_rows_dirty;
+    side_effects++;
+    draw_gfx = true;
+}
+
+#if CHIP8_PROFILE
+namespace {
+    struct OpInfo {
+        const char *group; // First nibble of the opcode
+        const char *name;
+    };
+    // Same order as Chip8::Op
+    const OpInfo op_info[] = {
+        {"decode", "decode"}, {"0x0000", "00E0 CLS"}, {"0x0000", "00EE RET"}, {"stall", "stall"},
+        {"0x1000", "1NNN JP"}, {"0x2000", "2NNN CALL"}, {"0x3000", "3XNN SE"}, {"0x4000", "4XNN SNE"},
+        {"0x5000", "5XY0 SE"}, {"0x6000", "6XNN LD"}, {"0x7000", "7XNN ADD"}, {"0x8000", "8XY0 LD"},
+        {"0x8000", "8XY1 OR"}, {"0x8000", "8XY2 AND"}, {"0x8000", "8XY3 XOR"}, {"0x8000", "8XY4 ADD"},
+        {"0x8000", "8XY5 SUB"}, {"0x8000", "8XY6 SHR"}, {"0x8000", "8XY7 SUBN"}, {"0x8000", "8XYE SHL"},
+        {"0x9000", "9XY0 SNE"}, {"0xA000", "ANNN LD I"}, {"0xB000", "BNNN JP V0"}, {"0xC000", "CXNN RND"},
+        {"0xD000", "DXYN DRW"}, {"0xE000", "EX9E SKP"}, {"0xE000", "EXA1 SKNP"}, {"0xF000", "FX07 LD DT"},
+        {"0xF000", "FX0A LD K"}, {"0xF000", "FX15 LD DT"}, {"0xF000", "FX18 LD ST"}, {"0xF000", "FX1E ADD I"},
+        {"0xF000", "FX29 LD F"}, {"0xF000", "FX33 LD B"}, {"0xF000", "FX55 LD [I]"}, {"0xF000", "FX65 LD [I]"},
+        {"0xF000", "unknown"}, {"0x0000", "00CN SCD"}, {"0x0000", "00FB SCR"}, {"0x0000", "00FC SCL"},
+        {"0x0000", "00FD EXIT"}, {"0x0000", "00FE LOW"}, {"0x0000", "00FF HIGH"}, {"0xF000", "FX30 LD HF"},
+        {"0xF000", "FX75 LD R"}, {"0xF000", "FX85 LD R"}, {"0x0000", "00DN SCU"}, {"0x5000", "5XY2 SAVE"},
+        {"0x5000", "5XY3 LOAD"}, {"0xF000", "F000 LD I"}, {"0xF000", "FN01 PLANE"}, {"0xF000", "F002 AUDIO"},
+        {"0xF000", "FX3A PITCH"}
+    };
+}
+
+template <typename Policy>
+const Chip8Profile& Chip8Machine<Policy>::get_profile() const {
+    return profile;
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::reset_profile() {
+    profile = Chip8Profile();
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::write_profile(std::ostream &os, bool folded, const std::string &root) const {
+    static_assert(sizeof(op_info) / sizeof(op_info[0]) == OP_COUNT, "op_info must list every handler");
+    static_assert(OP_COUNT <= CHIP8_PROFILE_OP_SLOTS, "Chip8Profile::op_counts is too small");
+    const std::ios_base::fmtflags flags = os.flags();
+    const char fill = os.fill();
+
+    if (folded) {
+        // One stack per address, under the instruction that last ran there
+        for (int address = 0; address < CHIP8_MEMORY_SIZE; ++address) {
+            if (profile.address_hits[address] == 0) continue;
+            const OpInfo &info = op_info[profile.address_op[address]];
+            os << root << ";" << info.group << ";" << info.name << ";0x" << std::hex << std::setw(3)
+               << std::setfill('0') << address << std::dec << " " << profile.address_hits[address] << std::endl;
+        }
+        os.flags(flags);
+        os.fill(fill);
+        return;
+    }
+
+    uint64_t instructions = 0;
+    for (int handler = OP_DECODE + 1; handler < OP_COUNT; ++handler)
+        instructions += profile.op_counts[handler];
+    os << "kind,name,count" << std::endl
+       << "summary,instructions," << instructions << std::endl
+       << "summary,decodes," << profile.op_counts[OP_DECODE] << std::endl
+       << "summary,draws," << profile.op_counts[OP_DRW] + profile.op_counts[OP_CLS] << std::endl
+       << "summary,key_wait_stalls," << profile.key_wait_stalls << std::endl;
+
+    // Hottest first
+    std::vector<int> handlers;
+    for (int handler = OP_DECODE + 1; handler < OP_COUNT; ++handler)
+        if (profile.op_counts[handler] > 0) handlers.push_back(handler);
+    std::stable_sort(handlers.begin(), handlers.end(), [this](int a, int b) {
+        return profile.op_counts[a] > profile.op_counts[b];
+    });
+    for (const int handler : handlers)
+        os << "op," << op_info[handler].name << "," << profile.op_counts[handler] << std::endl;
+
+    std::vector<int> addresses;
+    for (int address = 0; address < CHIP8_MEMORY_SIZE; ++address)
+        if (profile.address_hits[address] > 0) addresses.push_back(address);
+    std::stable_sort(addresses.begin(), addresses.end(), [this](int a, int b) {
+        return profile.address_hits[a] > profile.address_hits[b];
+    });
+    for (const int address : addresses) {
+        os << "pc,0x" << std::hex << std::setw(3) << std::setfill('0') << address << std::dec << " "
+           << op_info[profile.address_op[address]].name << "," << profile.address_hits[address] << std::endl;
+    }
+    os.flags(flags);
+    os.fill(fill);
+}
+#endif
+
+template <typename Policy>
+void Chip8Machine<Policy>::update_timers() {
     if (delay_timer > 0) {
         delay_timer--;
     }
@@ -395,10 +1332,228 @@ void Chip8::update_timers() {
     }
 }
 
-const uint8_t* Chip8::get_gfx() const {
-    return gfx;
+template <typename Policy>
+const uint64_t* Chip8Machine<Policy>::get_gfx_packed() const {
+    return &gfx[0][0][0];
+}
+
+template <typename Policy>
+uint64_t Chip8Machine<Policy>::take_dirty_rows() {
+    const uint64_t rows = dirty_rows;
+    dirty_rows = 0;
+    return rows;
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::get_gfx(uint8_t *pixels) const {
+    for (int y = 0; y < display_height; ++y) {
+        for (int x = 0; x < display_width; ++x) {
+            uint8_t value = 0;
+            for (int plane = 0; plane < display_planes; ++plane)
+                value |= ((gfx[plane][y][x / 64] >> (63 - x % 64)) & 1) << plane;
+            pixels[y * display_width + x] = value;
+        }
+    }
+}
+
+template <typename Policy>
+bool Chip8Machine<Policy>::is_high_resolution() const {
+    return extended.high_resolution != 0;
 }
 
-void Chip8::set_input_key(uint8_t key, bool is_pressed) {
+template <typename Policy>
+void Chip8Machine<Policy>::set_input_key(uint8_t key, bool is_pressed) {
+    if (input_keys[key] != is_pressed && idle != Chip8Idle::Forever) idle = Chip8Idle::None;
     input_keys[key] = is_pressed;
-}
\ No newline at end of file
+}
+
+template <typename Policy>
+uint16_t Chip8Machine<Policy>::get_input_keys() const {
+    uint16_t keys = 0;
+    for (int key = 0; key < CHIP8_KEY_SIZE; ++key)
+        keys |= (input_keys[key] != 0) << key;
+    return keys;
+}
+
+template <typename Policy>
+const uint8_t* Chip8Machine<Policy>::get_registers() const {
+    return registers_v;
+}
+
+template <typename Policy>
+uint16_t Chip8Machine<Policy>::get_pc() const {
+    return pc;
+}
+
+template <typename Policy>
+uint16_t Chip8Machine<Policy>::get_idx_register() const {
+    return idx_register;
+}
+
+template <typename Policy>
+uint16_t Chip8Machine<Policy>::get_sp() const {
+    return sp;
+}
+
+template <typename Policy>
+Chip8Halt Chip8Machine<Policy>::get_halt() const {
+    return halt;
+}
+
+template <typename Policy>
+uint8_t Chip8Machine<Policy>::get_delay_timer() const {
+    return delay_timer;
+}
+
+template <typename Policy>
+uint8_t Chip8Machine<Policy>::get_sound_timer() const {
+    return sound_timer;
+}
+
+template <typename Policy>
+const uint8_t* Chip8Machine<Policy>::get_audio_pattern() const {
+    if constexpr (variant == Chip8Variant::XoChip) return extended.audio_pattern;
+    return nullptr;
+}
+
+template <typename Policy>
+uint8_t Chip8Machine<Policy>::get_audio_pitch() const {
+    return extended.pitch;
+}
+
+template <typename Policy>
+uint32_t Chip8Machine<Policy>::get_fault_count(Chip8Fault fault) const {
+    return fault_counts[static_cast<int>(fault)];
+}
+
+template <typename Policy>
+bool Chip8Machine<Policy>::take_fault_trace(Chip8TraceDump &dump) {
+    if (!fault_trace_pending) return false;
+    dump_trace(dump);
+    dump.fault = last_fault;
+    dump.pc = last_fault_pc;
+    dump.sp = fault_sp;
+    memcpy(dump.registers_v, fault_registers_v, sizeof(fault_registers_v));
+    memcpy(dump.stack, fault_stack, sizeof(fault_stack));
+    fault_trace_pending = false;
+    return true;
+}
+
+template <typename Policy>
+void Chip8Machine<Policy>::dump_trace(Chip8TraceDump &dump) const {
+    dump.variant = variant;
+    dump.fault = Chip8Fault::None;
+    dump.pc = pc;
+    dump.sp = sp;
+    // While a fault trace is pending the slot at the head is the one being overwritten
+    dump.count = std::min<uint64_t>(trace_head, CHIP8_TRACE_SIZE - fault_trace_pending);
+    dump.instructions = trace_head;
+    memcpy(dump.registers_v, registers_v, sizeof(registers_v));
+    memcpy(dump.stack, stack, sizeof(stack));
+    // The group nibble each handler was decoded from, same order as Op. STALL and UNKNOWN keep their whole opcode
+    // in NNN, F000 NNNN its second word.
+    static constexpr uint8_t groups[] = {
+        0x0, 0x0, 0x0, 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0x8, 0x8, 0x8, 0x8, 0x8, 0x8, 0x8, 0x8, 0x8, 0x9,
+        0xA, 0xB, 0xC, 0xD, 0xE, 0xE, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF, 0xF,
+        0x0, 0x0, 0x0, 0x0, 0x0, 0x0, 0xF, 0xF, 0xF,
+        0x0, 0x5, 0x5, 0xF, 0xF, 0xF, 0xF
+    };
+    static_assert(sizeof(groups) / sizeof(groups[0]) == OP_COUNT, "groups must list every handler");
+    // Oldest first, which is the next record to be overwritten once the ring is full
+    for (uint32_t i = 0; i < dump.count; ++i) {
+        const uint64_t record = trace[(trace_head - dump.count + i) & (CHIP8_TRACE_SIZE - 1)];
+        const uint8_t handler = record >> 48;
+        const uint16_t nnn = record >> 32;
+        dump.records[i].pc = record;
+        dump.records[i].idx_register = record >> 16;
+        if (handler == OP_STALL || handler == OP_UNKNOWN) dump.records[i].opcode = nnn;
+        else if (handler == OP_LD_I_LONG) dump.records[i].opcode = 0xF000;
+        else dump.records[i].opcode = groups[handler] << 12 | nnn;
+    }
+}
+
+template class Chip8Machine<Chip8ClassicPolicy>;
+template class Chip8Machine<Chip8SuperChipPolicy>;
+template class Chip8Machine<Chip8XoChipPolicy>;
+
+#ifdef __EMSCRIPTEN__
+// Plain C exports for web workers. Each call runs whole frames, and the framebuffer, registers and keypad are
+// read and written through typed arrays over the WASM heap at the addresses returned below, which stay valid
+// for the lifetime of the VM (as long as the heap does not grow). No embind marshalling on any of these paths.
+struct Chip8WasmVM {
+    Chip8 chip8;
+    // Bit N is key N. The host may store into it at any time, even from another thread when the heap is a
+    // SharedArrayBuffer (build with -pthread); it is read once before every frame
+    std::atomic<uint32_t> keypad{0};
+};
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "keypad is viewed as a Uint32Array");
+
+namespace {
+    void sync_keypad(Chip8WasmVM &vm) {
+        const uint32_t keys = vm.keypad.load(std::memory_order_relaxed);
+        for (uint8_t key = 0; key < CHIP8_KEY_SIZE; ++key)
+            vm.chip8.set_input_key(key, (keys >> key) & 1);
+    }
+}
+
+extern "C" {
+    EMSCRIPTEN_KEEPALIVE Chip8WasmVM* chip8_create(uint32_t seed) {
+        auto *vm = new Chip8WasmVM();
+        vm->chip8.seed(seed);
+        vm->chip8.initialize();
+        return vm;
+    }
+
+    EMSCRIPTEN_KEEPALIVE void chip8_destroy(Chip8WasmVM *vm) {
+        delete vm;
+    }
+
+    // Loads a ROM the host copied into a _malloc'd buffer, 0 if it is too large
+    EMSCRIPTEN_KEEPALIVE int chip8_load(Chip8WasmVM *vm, const uint8_t *program, size_t size) {
+        return vm->chip8.load_program(program, size);
+    }
+
+    EMSCRIPTEN_KEEPALIVE void chip8_set_cpu_hz(Chip8WasmVM *vm, uint32_t hz) {
+        vm->chip8.set_cpu_hz(hz);
+    }
+
+    // Runs `frames` 60 Hz frames, timers included, and returns the display rows they changed (bit N is row N)
+    EMSCRIPTEN_KEEPALIVE uint32_t chip8_run_frames(Chip8WasmVM *vm, uint32_t frames) {
+        uint32_t dirty_rows = 0;
+        for (uint32_t f = 0; f < frames; ++f) {
+            sync_keypad(*vm);
+            if (!vm->chip8.skip_idle_frames(1)) vm->chip8.run_frame();
+            dirty_rows |= static_cast<uint32_t>(vm->chip8.take_dirty_rows());
+        }
+        return dirty_rows;
+    }
+
+    // Runs `cycles` instructions without ticking the timers, returns the display rows they changed
+    EMSCRIPTEN_KEEPALIVE uint32_t chip8_run_cycles(Chip8WasmVM *vm, uint32_t cycles) {
+        sync_keypad(*vm);
+        vm->chip8.run_cycles(cycles);
+        return static_cast<uint32_t>(vm->chip8.take_dirty_rows());
+    }
+
+    // CHIP8_DISPLAY_HEIGHT rows of two 32-bit words, low half first, bit 31 of the high word is the leftmost pixel
+    EMSCRIPTEN_KEEPALIVE const uint64_t* chip8_gfx(const Chip8WasmVM *vm) {
+        return vm->chip8.get_gfx_packed();
+    }
+
+    EMSCRIPTEN_KEEPALIVE const uint8_t* chip8_registers(const Chip8WasmVM *vm) {
+        return vm->chip8.get_registers();
+    }
+
+    EMSCRIPTEN_KEEPALIVE std::atomic<uint32_t>* chip8_keypad(Chip8WasmVM *vm) {
+        return &vm->keypad;
+    }
+
+    EMSCRIPTEN_KEEPALIVE uint32_t chip8_halt(const Chip8WasmVM *vm) {
+        return static_cast<uint32_t>(vm->chip8.get_halt());
+    }
+
+    EMSCRIPTEN_KEEPALIVE uint32_t chip8_idle(const Chip8WasmVM *vm) {
+        return static_cast<uint32_t>(vm->chip8.get_idle());
+    }
+}
+#endif //__EMSCRIPTEN__
\ No newline at end of file
@@ -0,0 +1,140 @@
+#include "../include/Chip8Aot.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+Chip8Aot::Chip8Aot(Chip8 &chip8, const Chip8AotProgram &program)
+    : chip8(chip8), program(program), live(program.block_count), untranslated(CHIP8_MEMORY_SIZE + 2) {
+    for (uint32_t i = 0; i < program.block_count; ++i) {
+        code_begin = std::min<uint32_t>(code_begin, program.blocks[i].start);
+        code_end = std::max<uint32_t>(code_end, program.blocks[i].end);
+        untranslated[program.blocks[i].start] = 1;
+    }
+    for (uint32_t address = CHIP8_MEMORY_SIZE; address-- > 0;)
+        untranslated[address] = untranslated[address] ? 0 : std::min(untranslated[address + 2] + 1, 0xFF);
+    check_blocks(0, CHIP8_MEMORY_SIZE);
+    chip8.code_write_hook = &Chip8Aot::on_code_write;
+    chip8.code_write_context = this;
+}
+
+Chip8Aot::~Chip8Aot() {
+    if (chip8.code_write_context == this) {
+        chip8.code_write_hook = nullptr;
+        chip8.code_write_context = nullptr;
+    }
+}
+
+void Chip8Aot::set_verify(bool enabled) {
+    verify = enabled;
+}
+
+bool Chip8Aot::is_native() const {
+    for (const uint8_t block : live)
+        if (block != 0) return true;
+    return false;
+}
+
+uint64_t Chip8Aot::get_native_instructions() const {
+    return native_instructions;
+}
+
+uint64_t Chip8Aot::get_interpreted_instructions() const {
+    return interpreted_instructions;
+}
+
+uint64_t Chip8Aot::get_verify_mismatches() const {
+    return verify_mismatches;
+}
+
+void Chip8Aot::load_frame() {
+    memcpy(frame.registers_v, chip8.registers_v, sizeof(frame.registers_v));
+    memcpy(frame.stack, chip8.stack, sizeof(frame.stack));
+    frame.pc = chip8.pc;
+    frame.idx_register = chip8.idx_register;
+    frame.sp = chip8.sp;
+    frame.delay_timer = chip8.delay_timer;
+    frame.sound_timer = chip8.sound_timer;
+    memcpy(frame.input_keys, chip8.input_keys, sizeof(frame.input_keys));
+}
+
+void Chip8Aot::store_frame() {
+    memcpy(chip8.registers_v, frame.registers_v, sizeof(frame.registers_v));
+    memcpy(chip8.stack, frame.stack, sizeof(frame.stack));
+    chip8.pc = frame.pc;
+    chip8.idx_register = frame.idx_register;
+    chip8.sp = frame.sp;
+    chip8.delay_timer = frame.delay_timer;
+    chip8.sound_timer = frame.sound_timer;
+}
+
+void Chip8Aot::interpret(uint32_t cycles) {
+    chip8.execute(cycles);
+    interpreted_instructions += cycles;
+}
+
+void Chip8Aot::run(uint32_t cycles) {
+    load_frame();
+    while (cycles > 0) {
+        const uint32_t ahead = untranslated[frame.pc & (CHIP8_MEMORY_SIZE - 1)];
+        uint32_t executed = 0;
+        if (ahead == 0) executed = run_native(cycles);
+        if (executed == 0) {
+            // Untranslated code, a block that is no longer live, or not enough budget left for the whole block.
+            // The interpreter takes over up to the next block, or for the rest of the budget once the machine halts.
+            executed = chip8.halt != Chip8Halt::None ? cycles : std::min(cycles, std::max<uint32_t>(ahead, 1));
+            store_frame();
+            interpret(executed);
+            load_frame();
+        }
+        cycles -= executed;
+    }
+    store_frame();
+}
+
+uint32_t Chip8Aot::run_native(uint32_t cycles) {
+    if (!verify) {
+        const uint32_t executed = program.run(&frame, live.data(), cycles);
+        native_instructions += executed;
+        return executed;
+    }
+
+    // Differential mode, replay the same instructions on the interpreter and compare. Translated code never
+    // writes memory, so the registers, stack and timers are all there is to compare.
+    const Chip8AotFrame before = frame;
+    const uint32_t executed = program.run(&frame, live.data(), cycles);
+    if (executed == 0) return 0;
+    const Chip8AotFrame after = frame;
+    frame = before;
+    store_frame();
+    chip8.execute(executed);
+    load_frame();
+    native_instructions += executed;
+
+    if (memcmp(&frame, &after, sizeof(Chip8AotFrame)) != 0) {
+        verify_mismatches++;
+        std::cout << "AOT mismatch in the run from 0x" << std::hex << before.pc << std::dec << " after " << executed
+                  << " instructions" << std::endl;
+    }
+    // Either way, continue from the interpreter's state
+    return executed;
+}
+
+void Chip8Aot::on_code_write(void *context, uint16_t address, uint32_t length) {
+    // The instruction starting one byte before the write overlaps it as well
+    const uint32_t begin = address > 0 ? address - 1 : 0;
+    static_cast<Chip8Aot*>(context)->check_blocks(begin, address + length);
+}
+
+void Chip8Aot::check_blocks(uint32_t begin, uint32_t end) {
+    // Stores to data, by far the most common, miss every block
+    if (begin >= code_end || end <= code_begin) return;
+    // Writing the same bytes back (reloading the ROM, restoring a snapshot) brings blocks back to life
+    for (uint32_t i = 0; i < program.block_count; ++i) {
+        const Chip8AotBlock &block = program.blocks[i];
+        if (block.start >= end || block.end <= begin) continue;
+        live[i] = block.end <= CHIP8_ADDR_PROGRAM_START + program.rom_size
+                  && memcmp(chip8.memory + block.start, program.rom + (block.start - CHIP8_ADDR_PROGRAM_START),
+                            block.end - block.start) == 0;
+    }
+}
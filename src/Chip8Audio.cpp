@@ -0,0 +1,54 @@
+#include "../include/Chip8Audio.h"
+
+#include <algorithm>
+
+Chip8Audio::Chip8Audio(uint32_t sample_rate, uint32_t buffer_samples)
+    : sample_rate(sample_rate),
+      // A frame's events are pushed when it ends, and a device buffer is filled ahead of being heard
+      latency(sample_rate / CHIP8_TIMER_HZ + buffer_samples) {
+}
+
+void Chip8Audio::push_change(const Chip8AudioEvent &event) {
+    // Pattern and pitch changes while silent are picked up by the event that turns the sound on
+    const bool changed = event.on != last_sent.on
+                         || (event.on && (event.bit_rate != last_sent.bit_rate
+                                          || memcmp(event.pattern, last_sent.pattern, sizeof(event.pattern)) != 0));
+    // Never wait for the audio thread, a full queue leaves last_sent as it was and the next frame tries again
+    if (changed && queue.push(event)) last_sent = event;
+}
+
+void Chip8Audio::render(int16_t *samples, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        // Apply the events that are due, and play up to the next one that is not
+        uint64_t run = count - done;
+        while (const Chip8AudioEvent *next = queue.front()) {
+            if (!anchored || next->time + latency < play_time || next->time > play_time + 2 * latency) {
+                // First event, or the emulation and audio clocks drifted apart: line the playback position up again
+                play_time = next->time > latency ? next->time - latency : 0;
+                anchored = true;
+            }
+            if (next->time > play_time) {
+                run = std::min(run, next->time - play_time);
+                break;
+            }
+            current = *next;
+            phase_step = (static_cast<uint64_t>(current.bit_rate) << 32) / sample_rate;
+            queue.pop();
+        }
+
+        int16_t *out = samples + done;
+        if (!current.on) {
+            memset(out, 0, run * sizeof(int16_t));
+        } else {
+            for (uint64_t i = 0; i < run; ++i) {
+                const uint32_t bit = (phase >> 32) & (CHIP8_AUDIO_PATTERN_BYTES * 8 - 1);
+                const bool high = (current.pattern[bit / 8] >> (7 - bit % 8)) & 1;
+                out[i] = high ? CHIP8_AUDIO_VOLUME : -CHIP8_AUDIO_VOLUME;
+                phase += phase_step;
+            }
+        }
+        play_time += run;
+        done += run;
+    }
+}
@@ -0,0 +1,619 @@
+#include "../include/Chip8Batch.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+// Clones the lane loops for AVX2 next to the baseline SSE2 build, the loader picks one for the CPU it runs on.
+// Elsewhere they are built for whatever the compiler targets.
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__) && defined(__ELF__) && !defined(__AVX2__)
+#define CHIP8_BATCH_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define CHIP8_BATCH_CLONES
+#endif
+
+// Every lane loop runs over whole chunks of CHIP8_BATCH_WIDTH lanes, a constant trip count the vectorizer turns
+// into a few full-width instructions. Results are computed into a local chunk first and then blended into place,
+// so reading and writing the same register (8XY4 with X == Y, VF as an operand...) keeps the interpreter's order.
+template <typename T, typename Compute>
+static inline void assign_lanes(T *destination, const uint8_t *active, size_t lanes, Compute compute) {
+    for (size_t base = 0; base < lanes; base += CHIP8_BATCH_WIDTH) {
+        T value[CHIP8_BATCH_WIDTH];
+        for (size_t i = 0; i < CHIP8_BATCH_WIDTH; ++i)
+            value[i] = compute(base + i);
+        T *chunk = destination + base;
+        const uint8_t *mask = active + base;
+        for (size_t i = 0; i < CHIP8_BATCH_WIDTH; ++i)
+            chunk[i] = mask[i] ? value[i] : chunk[i];
+    }
+}
+
+// Runs body on the active lanes one at a time, for what touches per-lane memory or the display
+template <typename Body>
+static inline void for_active_lanes(const uint8_t *active, size_t lanes, Body body) {
+    for (size_t lane = 0; lane < lanes; ++lane)
+        if (active[lane]) body(lane);
+}
+
+Chip8Batch::Chip8Batch(size_t lanes)
+    : lanes(lanes), padded_lanes((lanes + CHIP8_BATCH_WIDTH - 1) / CHIP8_BATCH_WIDTH * CHIP8_BATCH_WIDTH),
+      registers_v(CHIP8_REGISTER_COUNT * padded_lanes), stack(CHIP8_STACK_SIZE * padded_lanes), pc(padded_lanes),
+      idx_register(padded_lanes), sp(padded_lanes), delay_timer(padded_lanes), sound_timer(padded_lanes),
+      input_keys(padded_lanes), halt(padded_lanes), rng_state(padded_lanes), remaining(padded_lanes),
+      active(padded_lanes), memory(lanes * CHIP8_MEMORY_SIZE), gfx(lanes * CHIP8_DISPLAY_HEIGHT) {
+    // Every lane starts as a freshly initialized machine with nothing loaded
+    const auto blank = std::make_unique<Chip8>();
+    blank->initialize();
+    for (size_t lane = 0; lane < lanes; ++lane)
+        load(lane, *blank);
+}
+
+size_t Chip8Batch::get_lanes() const {
+    return lanes;
+}
+
+uint8_t* Chip8Batch::lane_memory(size_t lane) {
+    return memory.data() + lane * CHIP8_MEMORY_SIZE;
+}
+
+uint64_t* Chip8Batch::lane_gfx(size_t lane) {
+    return gfx.data() + lane * CHIP8_DISPLAY_HEIGHT;
+}
+
+void Chip8Batch::load(size_t lane, const Chip8 &chip8) {
+    memcpy(lane_memory(lane), chip8.memory, CHIP8_MEMORY_SIZE);
+    memcpy(lane_gfx(lane), chip8.gfx, CHIP8_DISPLAY_HEIGHT * sizeof(uint64_t));
+    for (int i = 0; i < CHIP8_REGISTER_COUNT; ++i)
+        registers_v[i * padded_lanes + lane] = chip8.registers_v[i];
+    for (int i = 0; i < CHIP8_STACK_SIZE; ++i)
+        stack[i * padded_lanes + lane] = chip8.stack[i];
+    pc[lane] = chip8.pc;
+    idx_register[lane] = chip8.idx_register;
+    sp[lane] = chip8.sp;
+    delay_timer[lane] = chip8.delay_timer;
+    sound_timer[lane] = chip8.sound_timer;
+    input_keys[lane] = chip8.get_input_keys();
+    halt[lane] = static_cast<uint8_t>(chip8.halt);
+    rng_state[lane] = chip8.rng_state;
+    pages_checked = false;
+}
+
+void Chip8Batch::store(size_t lane, Chip8 &chip8) const {
+    // Same as Chip8::restore(), only the parts of memory that differ are rewritten and invalidated
+    const uint8_t *source = memory.data() + lane * CHIP8_MEMORY_SIZE;
+    for (uint32_t address = 0; address < CHIP8_MEMORY_SIZE; address += CHIP8_BATCH_PAGE_SIZE) {
+        if (memcmp(chip8.memory + address, source + address, CHIP8_BATCH_PAGE_SIZE) != 0) {
+            memcpy(chip8.memory + address, source + address, CHIP8_BATCH_PAGE_SIZE);
+            chip8.invalidate_decoded(address, CHIP8_BATCH_PAGE_SIZE);
+        }
+    }
+    memcpy(chip8.gfx, gfx.data() + lane * CHIP8_DISPLAY_HEIGHT, CHIP8_DISPLAY_HEIGHT * sizeof(uint64_t));
+    for (int i = 0; i < CHIP8_REGISTER_COUNT; ++i)
+        chip8.registers_v[i] = registers_v[i * padded_lanes + lane];
+    for (int i = 0; i < CHIP8_STACK_SIZE; ++i)
+        chip8.stack[i] = stack[i * padded_lanes + lane];
+    chip8.pc = pc[lane];
+    chip8.idx_register = idx_register[lane];
+    chip8.sp = sp[lane];
+    chip8.delay_timer = delay_timer[lane];
+    chip8.sound_timer = sound_timer[lane];
+    for (int key = 0; key < CHIP8_KEY_SIZE; ++key)
+        chip8.input_keys[key] = input_keys[lane] >> key & 1;
+    chip8.halt = static_cast<Chip8Halt>(halt[lane]);
+    chip8.rng_state = rng_state[lane];
+    chip8.frame_remainder = frame_remainder;
+    chip8.idle = Chip8Idle::None;
+    chip8.dirty_rows = Chip8::all_rows_dirty;
+    chip8.draw_gfx = true;
+}
+
+void Chip8Batch::set_input_key(size_t lane, uint8_t key, bool is_pressed) {
+    if (key >= CHIP8_KEY_SIZE) return;
+    if (is_pressed) input_keys[lane] |= 1 << key;
+    else input_keys[lane] &= ~(1 << key);
+}
+
+void Chip8Batch::set_cpu_hz(uint32_t hz) {
+    cpu_hz = hz;
+}
+
+CHIP8_BATCH_CLONES
+void Chip8Batch::update_timers() {
+    uint8_t *const delay = delay_timer.data();
+    uint8_t *const sound = sound_timer.data();
+    const size_t n = padded_lanes;
+    for (size_t lane = 0; lane < n; ++lane) {
+        delay[lane] -= delay[lane] > 0;
+        sound[lane] -= sound[lane] > 0;
+    }
+}
+
+uint32_t Chip8Batch::run_frame() {
+    const uint32_t owed = cpu_hz + frame_remainder;
+    const uint32_t cycles = owed / CHIP8_TIMER_HZ;
+    frame_remainder = owed % CHIP8_TIMER_HZ;
+    run_cycles(cycles);
+    update_timers();
+    return cycles;
+}
+
+const uint64_t* Chip8Batch::get_gfx_packed(size_t lane) const {
+    return gfx.data() + lane * CHIP8_DISPLAY_HEIGHT;
+}
+
+uint16_t Chip8Batch::get_pc(size_t lane) const {
+    return pc[lane];
+}
+
+Chip8Halt Chip8Batch::get_halt(size_t lane) const {
+    return static_cast<Chip8Halt>(halt[lane]);
+}
+
+uint64_t Chip8Batch::get_steps() const {
+    return steps;
+}
+
+uint64_t Chip8Batch::get_lane_instructions() const {
+    return lane_budget - lane_skipped;
+}
+
+uint64_t Chip8Batch::get_lane_skipped() const {
+    return lane_skipped;
+}
+
+void Chip8Batch::check_pages() {
+    for (uint32_t page = 0; page < CHIP8_BATCH_PAGES; ++page)
+        check_page(page);
+    pages_checked = true;
+}
+
+void Chip8Batch::check_page(uint32_t page) {
+    const uint32_t offset = page * CHIP8_BATCH_PAGE_SIZE;
+    bool shared = true;
+    for (size_t lane = 1; lane < lanes && shared; ++lane)
+        shared = memcmp(lane_memory(lane) + offset, lane_memory(0) + offset, CHIP8_BATCH_PAGE_SIZE) == 0;
+    pages[page] = shared ? PageShared : PageDiffers;
+}
+
+bool Chip8Batch::is_shared(uint32_t address) {
+    const uint32_t page = address / CHIP8_BATCH_PAGE_SIZE;
+    // Lanes in lockstep mostly store the same bytes, e.g. code patching itself, so written pages are compared
+    // again once code runs from them
+    if (pages[page] == PageWritten) check_page(page);
+    return pages[page] == PageShared;
+}
+
+void Chip8Batch::drop_lane(size_t lane) {
+    lane_skipped += remaining[lane] - converged_executed;
+    remaining[lane] = 0;
+    active[lane] = 0;
+    lanes_halted = true;
+}
+
+void Chip8Batch::write_memory(size_t lane, uint16_t address, uint8_t value) {
+    address &= CHIP8_MEMORY_SIZE - 1;
+    lane_memory(lane)[address] = value;
+    // Lanes may store different values, the page is compared again before code is fetched from it
+    pages[address / CHIP8_BATCH_PAGE_SIZE] = PageWritten;
+}
+
+CHIP8_BATCH_CLONES
+void Chip8Batch::run_cycles(uint32_t cycles) {
+    if (!pages_checked) check_pages();
+    // Plain pointers, so the compiler knows storing a mask byte does not move the vectors' buffers
+    const uint16_t *const pcs = pc.data();
+    uint32_t *const budget = remaining.data();
+    uint8_t *const mask = active.data();
+    const size_t n = padded_lanes;
+    for (size_t lane = 0; lane < n; ++lane)
+        budget[lane] = lane < lanes ? cycles : 0;
+
+    lane_budget += uint64_t(lanes) * cycles;
+
+    while (true) {
+        // The group issuing next is every lane at the lowest PC with budget left. Lanes ahead wait for the ones
+        // behind, so after a branch the paths taken run one after the other and merge where they meet again.
+        // Lanes out of budget count as 0x10000, past any PC
+        uint32_t group_pc = 0x10000;
+        for (size_t lane = 0; lane < n; ++lane)
+            group_pc = std::min(group_pc, pcs[lane] | uint32_t(budget[lane] == 0) << 16);
+        if (group_pc == 0x10000) break;
+        for (size_t lane = 0; lane < n; ++lane)
+            mask[lane] = -uint8_t((budget[lane] != 0) & (pcs[lane] == group_pc));
+
+        const uint16_t opcode = select_group(group_pc);
+        uint32_t waiting = 0;
+        for (size_t lane = 0; lane < n; ++lane) {
+            waiting += (budget[lane] != 0) & (mask[lane] == 0);
+            budget[lane] -= mask[lane] & 1;
+        }
+        steps++;
+        lanes_halted = false;
+        step(opcode);
+        if (waiting == 0 && !lanes_halted) run_converged();
+    }
+}
+
+// Every lane with budget left is in the group: until their PCs part, the group is simply the same lanes again
+// and the only work between instructions is checking that they still agree
+CHIP8_BATCH_CLONES
+void Chip8Batch::run_converged() {
+    const uint16_t *const pcs = pc.data();
+    uint32_t *const budget = remaining.data();
+    const uint8_t *const mask = active.data();
+    const size_t n = padded_lanes;
+    size_t leader = 0;
+    while (!mask[leader]) leader++;
+    uint32_t limit = UINT32_MAX; // Until the first lane runs out of budget
+    for (size_t lane = 0; lane < n; ++lane)
+        limit = std::min(limit, budget[lane] | -uint32_t(mask[lane] == 0));
+
+    // Idle loop detection, as in Chip8::probe_idle(): a backward jump reached twice with every lane in the same
+    // state, and nothing written in between, starts a loop the lanes repeat identically until the run is over
+    uint32_t probe_pc = CHIP8_MEMORY_SIZE;
+    uint32_t probe_executed = 0;
+    uint32_t probe_side_effects = 0;
+    uint32_t probe_countdown = 0;
+
+    uint32_t executed = 0;
+    while (executed < limit && !lanes_halted) {
+        const uint16_t group_pc = pcs[leader];
+        uint16_t apart = 0;
+        for (size_t lane = 0; lane < n; ++lane)
+            apart |= (pcs[lane] ^ group_pc) & -uint16_t(mask[lane] & 1);
+        const uint32_t address = group_pc & (CHIP8_MEMORY_SIZE - 1);
+        const uint32_t next = (address + 1) & (CHIP8_MEMORY_SIZE - 1);
+        if (apart != 0 || !is_shared(address) || !is_shared(next)) break;
+        const uint16_t opcode = lane_memory(leader)[address] << 8 | lane_memory(leader)[next];
+
+        if ((opcode & 0xF000) == 0x1000 && (opcode & 0x0FFF) <= group_pc) {
+            if (probe_pc == group_pc && probe_side_effects == side_effects && probe_lanes(false)) {
+                // Whole iterations change nothing, every lane only runs what is left modulo the loop length
+                const uint32_t length = executed - probe_executed;
+                for (size_t lane = 0; lane < n; ++lane) {
+                    if (!mask[lane]) continue;
+                    const uint32_t left = budget[lane] - executed;
+                    lane_skipped += left - left % length;
+                    budget[lane] = left % length;
+                }
+                steps += executed;
+                converged_executed = 0;
+                return;
+            }
+            if (probe_pc == CHIP8_MEMORY_SIZE || --probe_countdown == 0) {
+                probe_pc = group_pc;
+                probe_executed = executed;
+                probe_side_effects = side_effects;
+                probe_countdown = CHIP8_IDLE_PROBE_INTERVAL;
+                probe_lanes(true);
+            }
+        }
+        // The instruction about to run counts too, should a lane halt on it
+        converged_executed = ++executed;
+        step(opcode);
+    }
+    converged_executed = 0;
+    // Lanes that halted meanwhile dropped out of the group with no budget left
+    for (size_t lane = 0; lane < n; ++lane)
+        budget[lane] -= executed & -uint32_t(mask[lane] & 1);
+    steps += executed;
+}
+
+bool Chip8Batch::probe_lanes(bool record) {
+    // Everything an instruction can change but memory and the display, which side_effects stands for
+    probe.resize(padded_lanes * (CHIP8_REGISTER_COUNT + 2 * sizeof(uint16_t) + 2 + sizeof(uint32_t)));
+    uint8_t *saved = probe.data();
+    bool same = true;
+    auto field = [&](const void *data, size_t size) {
+        if (record) memcpy(saved, data, size);
+        else if (same) same = memcmp(saved, data, size) == 0;
+        saved += size;
+    };
+    field(registers_v.data(), registers_v.size());
+    field(idx_register.data(), padded_lanes * sizeof(uint16_t));
+    field(sp.data(), padded_lanes * sizeof(uint16_t));
+    field(delay_timer.data(), padded_lanes);
+    field(sound_timer.data(), padded_lanes);
+    field(rng_state.data(), padded_lanes * sizeof(uint32_t));
+    return same;
+}
+
+uint16_t Chip8Batch::select_group(uint16_t group_pc) {
+    const uint32_t address = group_pc & (CHIP8_MEMORY_SIZE - 1);
+    const uint32_t next = (address + 1) & (CHIP8_MEMORY_SIZE - 1);
+    if (is_shared(address) && is_shared(next))
+        return lane_memory(0)[address] << 8 | lane_memory(0)[next];
+
+    // The lanes may hold different code here, the first one decides and the lanes holding something else
+    // issue in a later step
+    size_t first = 0;
+    while (!active[first]) first++;
+    const uint16_t opcode = lane_memory(first)[address] << 8 | lane_memory(first)[next];
+    for (size_t lane = first + 1; lane < lanes; ++lane) {
+        const uint8_t *code = lane_memory(lane);
+        if (active[lane] && (code[address] << 8 | code[next]) != opcode) active[lane] = 0;
+    }
+    return opcode;
+}
+
+// One instruction of the original machine for all active lanes, same semantics and quirks as Chip8's interpreter.
+// Where the interpreter writes VF before the result (or the other way around), two passes keep that order.
+CHIP8_BATCH_CLONES
+void Chip8Batch::step(uint16_t opcode) {
+    const int x = opcode >> 8 & 0xF;
+    const int y = opcode >> 4 & 0xF;
+    const uint8_t nn = opcode & 0xFF;
+    const uint16_t nnn = opcode & 0xFFF;
+    const size_t n = padded_lanes;
+    const uint8_t *mask = active.data();
+    uint8_t *const vx = registers_v.data() + x * n;
+    uint8_t *const vy = registers_v.data() + y * n;
+    uint8_t *const v0 = registers_v.data();
+    uint8_t *const vf = registers_v.data() + 0xF * n;
+    uint16_t *const pcs = pc.data();
+    uint16_t *const index = idx_register.data();
+
+    auto advance = [&]() {
+        assign_lanes(pcs, mask, n, [&](size_t lane) -> uint16_t { return pcs[lane] + 2; });
+    };
+    auto skip_if = [&](auto condition) {
+        assign_lanes(pcs, mask, n, [&](size_t lane) -> uint16_t { return pcs[lane] + (condition(lane) ? 4 : 2); });
+    };
+    auto stall = [&]() {
+        // Unsupported instruction, PC is not advanced. Running it again changes nothing, so the lane is done.
+        for_active_lanes(mask, lanes, [&](size_t lane) {
+            halt[lane] = static_cast<uint8_t>(Chip8Halt::UnknownOpcode);
+            drop_lane(lane);
+        });
+    };
+    auto stack_fault = [&](size_t lane) {
+        halt[lane] = static_cast<uint8_t>(Chip8Halt::StackFault);
+        drop_lane(lane);
+    };
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (x != 0) {
+                stall();
+            } else if ((opcode & 0x000F) == 0x0000) {
+                // (00E0) Clear screen
+                side_effects++;
+                for_active_lanes(mask, lanes, [&](size_t lane) {
+                    memset(lane_gfx(lane), 0, CHIP8_DISPLAY_HEIGHT * sizeof(uint64_t));
+                });
+                advance();
+            } else if ((opcode & 0x000F) == 0x000E) {
+                // (00EE) Return from subroutine, halts on an empty stack
+                for_active_lanes(mask, lanes, [&](size_t lane) {
+                    if (sp[lane] - 1u >= CHIP8_STACK_SIZE) {
+                        stack_fault(lane);
+                        return;
+                    }
+                    sp[lane]--;
+                    pcs[lane] = stack[sp[lane] * n + lane] + 2;
+                });
+            } else {
+                stall();
+            }
+            break;
+        case 0x1000:
+            // (1NNN) Jump to address NNN
+            assign_lanes(pcs, mask, n, [&](size_t) { return nnn; });
+            break;
+        case 0x2000:
+            // (2NNN) Execute subroutine at address NNN, halts on a full stack
+            for_active_lanes(mask, lanes, [&](size_t lane) {
+                if (sp[lane] >= CHIP8_STACK_SIZE) {
+                    stack_fault(lane);
+                    return;
+                }
+                stack[sp[lane] * n + lane] = pcs[lane];
+                sp[lane]++;
+                pcs[lane] = nnn;
+            });
+            break;
+        case 0x3000:
+            // (3XNN) Skip if VX == NN
+            skip_if([&](size_t lane) { return vx[lane] == nn; });
+            break;
+        case 0x4000:
+            // (4XNN) Skip if VX != NN
+            skip_if([&](size_t lane) { return vx[lane] != nn; });
+            break;
+        case 0x5000:
+            // (5XY0) Skip if VX == VY
+            skip_if([&](size_t lane) { return vx[lane] == vy[lane]; });
+            break;
+        case 0x6000:
+            // (6XNN) VX = NN
+            assign_lanes(vx, mask, n, [&](size_t) { return nn; });
+            advance();
+            break;
+        case 0x7000:
+            // (7XNN) VX += NN
+            assign_lanes(vx, mask, n, [&](size_t lane) -> uint8_t { return vx[lane] + nn; });
+            advance();
+            break;
+        case 0x8000:
+            switch (opcode & 0x000F) {
+                case 0x0:
+                    // (8XY0) VX = VY
+                    assign_lanes(vx, mask, n, [&](size_t lane) { return vy[lane]; });
+                    break;
+                case 0x1:
+                    // (8XY1) VX |= VY
+                    assign_lanes(vx, mask, n, [&](size_t lane) -> uint8_t { return vx[lane] | vy[lane]; });
+                    break;
+                case 0x2:
+                    // (8XY2) VX &= VY
+                    assign_lanes(vx, mask, n, [&](size_t lane) -> uint8_t { return vx[lane] & vy[lane]; });
+                    break;
+                case 0x3:
+                    // (8XY3) VX ^= VY
+                    assign_lanes(vx, mask, n, [&](size_t lane) -> uint8_t { return vx[lane] ^ vy[lane]; });
+                    break;
+                case 0x4:
+                    // (8XY4) VX += VY, VF = carry; the flag is written first
+                    assign_lanes(vf, mask, n, [&](size_t lane) -> uint8_t { return vy[lane] > 0xFF - vx[lane]; });
+                    assign_lanes(vx, mask, n, [&](size_t lane) -> uint8_t { return vx[lane] + vy[lane]; });
+                    break;
+                case 0x5:
+                    // (8XY5) VX -= VY, VF = no borrow
+                    assign_lanes(vf, mask, n, [&](size_t lane) -> uint8_t { return !(vy[lane] > vx[lane]); });
+                    assign_lanes(vx, mask, n, [&](size_t lane) -> uint8_t { return vx[lane] - vy[lane]; });
+                    break;
+                case 0x6:
+                    // (8XY6) VX >>= 1, VF = the bit shifted out
+                    assign_lanes(vf, mask, n, [&](size_t lane) -> uint8_t { return vx[lane] & 0x1; });
+                    assign_lanes(vx, mask, n, [&](size_t lane) -> uint8_t { return vx[lane] >> 1; });
+                    break;
+                case 0x7:
+                    // (8XY7) VX = VY - VX, VF = no borrow
+                    assign_lanes(vf, mask, n, [&](size_t lane) -> uint8_t { return !(vx[lane] > vy[lane]); });
+                    assign_lanes(vx, mask, n, [&](size_t lane) -> uint8_t { return vy[lane] - vx[lane]; });
+                    break;
+                case 0xE:
+                    // (8XYE) VX <<= 1, VF = the bit shifted out
+                    assign_lanes(vf, mask, n, [&](size_t lane) -> uint8_t { return vx[lane] >> 7; });
+                    assign_lanes(vx, mask, n, [&](size_t lane) -> uint8_t { return vx[lane] << 1; });
+                    break;
+                default:
+                    stall();
+                    return;
+            }
+            advance();
+            break;
+        case 0x9000:
+            // (9XY0) Skip if VX != VY
+            skip_if([&](size_t lane) { return vx[lane] != vy[lane]; });
+            break;
+        case 0xA000:
+            // (ANNN) I = NNN
+            assign_lanes(index, mask, n, [&](size_t) { return nnn; });
+            advance();
+            break;
+        case 0xB000:
+            // (BNNN) Jump to NNN + V0
+            assign_lanes(pcs, mask, n, [&](size_t lane) -> uint16_t { return nnn + v0[lane]; });
+            break;
+        case 0xC000: {
+            // (CXNN) VX = random & NN, each lane draws from its own xorshift32
+            uint32_t *const state = rng_state.data();
+            assign_lanes(state, mask, n, [&](size_t lane) {
+                uint32_t value = state[lane];
+                value ^= value << 13;
+                value ^= value >> 17;
+                value ^= value << 5;
+                return value;
+            });
+            assign_lanes(vx, mask, n, [&](size_t lane) -> uint8_t { return (state[lane] >> 24) & nn; });
+            advance();
+            break;
+        }
+        case 0xD000: {
+            // (DXYN) Draw N rows of sprite data from I at VX, VY, clipped at the edges; VF = collision
+            const int rows_wanted = opcode & 0x000F;
+            side_effects++;
+            for_active_lanes(mask, lanes, [&](size_t lane) {
+                const uint8_t x_coord = vx[lane] % CHIP8_DISPLAY_WIDTH;
+                const uint8_t y_coord = vy[lane] % CHIP8_DISPLAY_HEIGHT;
+                const int rows = std::min<int>(rows_wanted, CHIP8_DISPLAY_HEIGHT - y_coord);
+                const uint8_t *code = lane_memory(lane);
+                uint64_t *display = lane_gfx(lane);
+                uint64_t collision = 0;
+                for (int y_offset = 0; y_offset < rows; ++y_offset) {
+                    const uint64_t sprite = static_cast<uint64_t>(code[(index[lane] + y_offset) & (CHIP8_MEMORY_SIZE - 1)]) << 56 >> x_coord;
+                    uint64_t &row = display[y_coord + y_offset];
+                    collision |= row & sprite;
+                    row ^= sprite;
+                }
+                vf[lane] = collision != 0;
+            });
+            advance();
+            break;
+        }
+        case 0xE000: {
+            // (EX9E / EXA1) Skip if the key in the low nibble of VX is (not) pressed
+            const uint16_t *keys = input_keys.data();
+            auto pressed = [&](size_t lane) { return (keys[lane] >> (vx[lane] & 0xF) & 1) != 0; };
+            if (nn == 0x9E) skip_if([&](size_t lane) { return pressed(lane); });
+            else if (nn == 0xA1) skip_if([&](size_t lane) { return !pressed(lane); });
+            else stall();
+            break;
+        }
+        case 0xF000:
+            switch (nn) {
+                case 0x07:
+                    // (FX07) VX = delay timer
+                    assign_lanes(vx, mask, n, [&](size_t lane) { return delay_timer[lane]; });
+                    break;
+                case 0x0A:
+                    // (FX0A) Wait for a key, the highest one pressed goes to VX
+                    for_active_lanes(mask, lanes, [&](size_t lane) {
+                        const uint16_t keys = input_keys[lane];
+                        if (keys != 0) {
+                            int key = CHIP8_KEY_SIZE - 1;
+                            while ((keys >> key & 1) == 0) key--;
+                            vx[lane] = key;
+                            halt[lane] = static_cast<uint8_t>(Chip8Halt::None);
+                            pcs[lane] += 2;
+                        } else {
+                            // Nothing changes until a key is pressed, which cannot happen before we return
+                            halt[lane] = static_cast<uint8_t>(Chip8Halt::WaitingForKey);
+                            drop_lane(lane);
+                        }
+                    });
+                    return;
+                case 0x15:
+                    // (FX15) Delay timer = VX
+                    assign_lanes(delay_timer.data(), mask, n, [&](size_t lane) { return vx[lane]; });
+                    break;
+                case 0x18:
+                    // (FX18) Sound timer = VX
+                    assign_lanes(sound_timer.data(), mask, n, [&](size_t lane) { return vx[lane]; });
+                    break;
+                case 0x1E:
+                    // (FX1E) I += VX, VF = overflow past 0xFFF; the flag is written first
+                    assign_lanes(vf, mask, n, [&](size_t lane) -> uint8_t { return index[lane] + vx[lane] > 0xFFF; });
+                    assign_lanes(index, mask, n, [&](size_t lane) -> uint16_t { return index[lane] + vx[lane]; });
+                    break;
+                case 0x29:
+                    // (FX29) I = address of the font digit in VX
+                    assign_lanes(index, mask, n, [&](size_t lane) -> uint16_t { return vx[lane] * 5; });
+                    break;
+                case 0x33:
+                    // (FX33) Store the BCD of VX at I, I + 1 and I + 2
+                    side_effects++;
+                    for_active_lanes(mask, lanes, [&](size_t lane) {
+                        const uint8_t value = vx[lane];
+                        write_memory(lane, index[lane], value / 100);
+                        write_memory(lane, index[lane] + 1, (value / 10) % 10);
+                        write_memory(lane, index[lane] + 2, value % 10);
+                    });
+                    break;
+                case 0x55:
+                    // (FX55) Store V0 to VX at I, I ends up past the last one
+                    side_effects++;
+                    for_active_lanes(mask, lanes, [&](size_t lane) {
+                        for (int i = 0; i <= x; ++i)
+                            write_memory(lane, index[lane] + i, registers_v[i * n + lane]);
+                        index[lane] += x + 1;
+                    });
+                    break;
+                case 0x65:
+                    // (FX65) Load V0 to VX from I, I ends up past the last one
+                    for_active_lanes(mask, lanes, [&](size_t lane) {
+                        const uint8_t *code = lane_memory(lane);
+                        for (int i = 0; i <= x; ++i)
+                            registers_v[i * n + lane] = code[(index[lane] + i) & (CHIP8_MEMORY_SIZE - 1)];
+                        index[lane] += x + 1;
+                    });
+                    break;
+                default:
+                    stall();
+                    return;
+            }
+            advance();
+            break;
+    }
+}
@@ -0,0 +1,186 @@
+#include "../include/Chip8Engine.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    uint64_t pack_range(uint64_t begin, uint64_t end) {
+        return begin << 32 | end;
+    }
+}
+
+Chip8Engine::Chip8Engine(size_t instances, unsigned threads)
+    : instance_count(instances),
+      machines(std::make_unique<Chip8[]>(instances)),
+      results(instances) {
+    for (size_t i = 0; i < instance_count; ++i)
+        machines[i].initialize();
+
+    worker_count = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+    work = std::make_unique<WorkRange[]>(worker_count);
+    // The calling thread is worker 0
+    for (unsigned id = 1; id < worker_count; ++id)
+        workers.emplace_back(&Chip8Engine::worker_loop, this, id);
+}
+
+Chip8Engine::~Chip8Engine() {
+    {
+        std::lock_guard<std::mutex> lock(job_mutex);
+        stopping = true;
+    }
+    job_started.notify_all();
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+Chip8& Chip8Engine::instance(size_t index) {
+    return machines[index];
+}
+
+const Chip8Result& Chip8Engine::result(size_t index) const {
+    return results[index];
+}
+
+size_t Chip8Engine::size() const {
+    return instance_count;
+}
+
+unsigned Chip8Engine::thread_count() const {
+    return worker_count;
+}
+
+void Chip8Engine::set_cpu_hz(uint32_t hz) {
+    for (size_t i = 0; i < instance_count; ++i)
+        machines[i].set_cpu_hz(hz);
+}
+
+void Chip8Engine::run_cycles(uint64_t cycles) {
+    run_job(cycles, 0);
+}
+
+void Chip8Engine::run_frames(uint64_t frames) {
+    run_job(0, frames);
+}
+
+void Chip8Engine::run_job(uint64_t cycles, uint64_t frames) {
+    {
+        std::lock_guard<std::mutex> lock(job_mutex);
+        job_cycles = cycles;
+        job_frames = frames;
+        // Start with an even split, stealing evens out whatever imbalance the ROMs cause
+        for (unsigned id = 0; id < worker_count; ++id) {
+            const uint64_t begin = instance_count * id / worker_count;
+            const uint64_t end = instance_count * (id + 1) / worker_count;
+            work[id].range.store(pack_range(begin, end), std::memory_order_relaxed);
+        }
+        workers_busy = worker_count - 1;
+        job_generation++;
+    }
+    job_started.notify_all();
+
+    drain(0);
+
+    std::unique_lock<std::mutex> lock(job_mutex);
+    job_finished.wait(lock, [this] { return workers_busy == 0; });
+}
+
+void Chip8Engine::worker_loop(unsigned id) {
+    uint64_t seen_generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(job_mutex);
+            job_started.wait(lock, [&] { return stopping || job_generation != seen_generation; });
+            if (stopping) return;
+            seen_generation = job_generation;
+        }
+
+        drain(id);
+
+        std::lock_guard<std::mutex> lock(job_mutex);
+        if (--workers_busy == 0) job_finished.notify_one();
+    }
+}
+
+void Chip8Engine::drain(unsigned id) {
+    size_t index;
+    while (take(id, index) || steal(id, index))
+        step_instance(index);
+}
+
+bool Chip8Engine::take(unsigned id, size_t &index) {
+    std::atomic<uint64_t> &range = work[id].range;
+    uint64_t current = range.load(std::memory_order_acquire);
+    while (true) {
+        const uint64_t begin = current >> 32;
+        const uint64_t end = current & 0xFFFFFFFF;
+        if (begin >= end) return false;
+        if (range.compare_exchange_weak(current, pack_range(begin + 1, end), std::memory_order_acq_rel)) {
+            index = begin;
+            return true;
+        }
+    }
+}
+
+bool Chip8Engine::steal(unsigned id, size_t &index) {
+    for (unsigned offset = 1; offset < worker_count; ++offset) {
+        std::atomic<uint64_t> &range = work[(id + offset) % worker_count].range;
+        uint64_t current = range.load(std::memory_order_acquire);
+        while (true) {
+            const uint64_t begin = current >> 32;
+            const uint64_t end = current & 0xFFFFFFFF;
+            if (begin >= end) break;
+            // Take the back half, rounding up so a single remaining instance can be stolen too
+            const uint64_t stolen = end - (end - begin + 1) / 2;
+            if (range.compare_exchange_weak(current, pack_range(begin, stolen), std::memory_order_acq_rel)) {
+                index = stolen;
+                // Our own range is empty, so nobody else is touching it; keep the rest of the stolen half
+                work[id].range.store(pack_range(stolen + 1, end), std::memory_order_release);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void Chip8Engine::step_instance(size_t index) {
+    Chip8 &chip8 = machines[index];
+    Chip8Result &result = results[index];
+    uint64_t cycles = 0;
+    uint64_t frames = 0;
+    const uint64_t skipped_before = chip8.get_skipped_cycles();
+
+    if (job_frames > 0) {
+        // A halted VM is only noticed at the end of a frame, it spins in place until then. One blocked on FX0A
+        // keeps running, its timers tick like under run_frame(), and skip_idle_frames() fast-forwards it
+        while (frames < job_frames) {
+            cycles += chip8.run_frame();
+            frames++;
+            const Chip8Halt halt = chip8.get_halt();
+            if (halt == Chip8Halt::UnknownOpcode || halt == Chip8Halt::Exited || halt == Chip8Halt::StackFault) break;
+            // Nothing feeds input during a run, so a VM idling on anything but the delay timer stays that way
+            uint64_t skipped;
+            if (chip8.skip_idle_frames(job_frames - frames, &skipped)) {
+                cycles += skipped;
+                frames = job_frames;
+            }
+        }
+    } else {
+        // run_cycles() takes 32-bit counts
+        for (uint64_t left = job_cycles; left > 0;) {
+            const uint32_t batch = std::min<uint64_t>(left, UINT32_MAX);
+            chip8.run_cycles(batch);
+            left -= batch;
+        }
+        cycles = job_cycles;
+    }
+
+    memcpy(result.gfx, chip8.get_gfx_packed(), sizeof(result.gfx));
+    memcpy(result.registers_v, chip8.get_registers(), sizeof(result.registers_v));
+    result.pc = chip8.get_pc();
+    result.idx_register = chip8.get_idx_register();
+    result.sp = chip8.get_sp();
+    result.halt = chip8.get_halt();
+    result.cycles = cycles;
+    result.skipped = chip8.get_skipped_cycles() - skipped_before;
+    result.frames = frames;
+}
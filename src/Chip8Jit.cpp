@@ -0,0 +1,550 @@
+#include "../include/Chip8Jit.h"
+
+#include <cstring>
+#include <iostream>
+#if CHIP8_JIT_NATIVE
+#include <sys/mman.h>
+#endif
+
+namespace {
+    enum Reg : int {
+        RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+        R8 = 8, R9 = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15
+    };
+    // Condition codes, as used by Jcc / SETcc / CMOVcc
+    enum Cond : uint8_t { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7 };
+    // "op r/m32, r32" opcodes
+    enum AluOp : uint8_t { ALU_ADD = 0x01, ALU_OR = 0x09, ALU_AND = 0x21, ALU_SUB = 0x29, ALU_XOR = 0x31, ALU_CMP = 0x39, ALU_MOV = 0x89 };
+    // "op r/m32, imm32" extensions of opcode 0x81
+    enum AluExt : uint8_t { EXT_ADD = 0, EXT_OR = 1, EXT_AND = 4, EXT_SUB = 5, EXT_XOR = 6, EXT_CMP = 7 };
+
+    // Host register assignment inside a block. RAX, RCX and RDX are scratch.
+    constexpr int REG_FRAME = RBX;
+    constexpr int REG_I = R12;
+    constexpr int REG_SP = R13;
+    constexpr int V_POOL[] = { RSI, RBP, R8, R9, R10, R11, R14, R15 };
+    constexpr int V_POOL_SIZE = sizeof(V_POOL) / sizeof(V_POOL[0]);
+    constexpr size_t MAX_BLOCK_CODE_SIZE = 4096; // Upper bound of a single translated block
+    constexpr size_t MAX_BLOCKS = 4096; // Dead blocks are only reclaimed by a flush
+
+    // Minimal x86-64 encoder for the handful of instructions the translator needs, all on 32-bit registers
+    class Emitter {
+        public:
+        explicit Emitter(uint8_t *out) : out(out) {}
+        [[nodiscard]] size_t size() const { return pos; }
+
+        void alu_rr(uint8_t op, int dst, int src) { rex(false, src, 0, dst); byte(op); modrm(3, src, dst); }
+        void mov_rr(int dst, int src) { alu_rr(ALU_MOV, dst, src); }
+        void alu_ri(uint8_t ext, int dst, uint32_t imm) { rex(false, 0, 0, dst); byte(0x81); modrm(3, ext, dst); dword(imm); }
+        void mov_ri(int dst, uint32_t imm) { rex(false, 0, 0, dst); byte(0xB8 + (dst & 7)); dword(imm); }
+        void shl_ri(int dst, uint8_t count) { rex(false, 0, 0, dst); byte(0xC1); modrm(3, 4, dst); byte(count); }
+        void shr_ri(int dst, uint8_t count) { rex(false, 0, 0, dst); byte(0xC1); modrm(3, 5, dst); byte(count); }
+        // Only used with AL / CL, which are addressable without REX
+        void setcc(uint8_t cc, int dst) { byte(0x0F); byte(0x90 | cc); modrm(3, 0, dst); }
+        void cmov(uint8_t cc, int dst, int src) { rex(false, dst, 0, src); byte(0x0F); byte(0x40 | cc); modrm(3, dst, src); }
+        // movzx / mov between a register and [frame + disp]
+        void load8(int dst, int32_t disp) { rex(false, dst, 0, REG_FRAME); byte(0x0F); byte(0xB6); frame_mem(dst, disp); }
+        void load16(int dst, int32_t disp) { rex(false, dst, 0, REG_FRAME); byte(0x0F); byte(0xB7); frame_mem(dst, disp); }
+        void store8(int src, int32_t disp) { rex(false, src, 0, REG_FRAME, true); byte(0x88); frame_mem(src, disp); }
+        void store16(int src, int32_t disp) { byte(0x66); rex(false, src, 0, REG_FRAME); byte(0x89); frame_mem(src, disp); }
+        // movzx / mov between a register and [frame + SP * 2 + disp]
+        void load16_stack(int dst, int32_t disp) { rex(false, dst, REG_SP, REG_FRAME); byte(0x0F); byte(0xB7); stack_mem(dst, disp); }
+        void store16_stack(int src, int32_t disp) { byte(0x66); rex(false, src, REG_SP, REG_FRAME); byte(0x89); stack_mem(src, disp); }
+        void push(int reg) { rex(false, 0, 0, reg); byte(0x50 + (reg & 7)); }
+        void pop(int reg) { rex(false, 0, 0, reg); byte(0x58 + (reg & 7)); }
+        // mov rbx, rdi
+        void load_frame_pointer() { rex(true, RDI, 0, REG_FRAME); byte(0x89); modrm(3, RDI, REG_FRAME); }
+        void ret() { byte(0xC3); }
+        // Forward conditional jump, returns the label to pass to bind() once the target is known
+        size_t jcc_forward(uint8_t cc) { byte(0x0F); byte(0x80 | cc); dword(0); return pos; }
+        void bind(size_t label) {
+            const int32_t rel = static_cast<int32_t>(pos - label);
+            memcpy(out + label - 4, &rel, 4);
+        }
+
+        private:
+        uint8_t *out;
+        size_t pos = 0;
+
+        void byte(uint8_t value) { out[pos++] = value; }
+        void dword(uint32_t value) { memcpy(out + pos, &value, 4); pos += 4; }
+        void rex(bool w, int reg, int index, int rm, bool force = false) {
+            const uint8_t prefix = 0x40 | (w ? 0x8 : 0) | ((reg & 8) ? 0x4 : 0) | ((index & 8) ? 0x2 : 0) | ((rm & 8) ? 0x1 : 0);
+            if (prefix != 0x40 || force) byte(prefix);
+        }
+        void modrm(int mod, int reg, int rm) { byte(mod << 6 | (reg & 7) << 3 | (rm & 7)); }
+        void frame_mem(int reg, int32_t disp) { modrm(2, reg, REG_FRAME); dword(disp); }
+        void stack_mem(int reg, int32_t disp) {
+            modrm(2, reg, RSP); // RSP in r/m selects a SIB byte
+            byte(1 << 6 | (REG_SP & 7) << 3 | (REG_FRAME & 7));
+            dword(disp);
+        }
+    };
+
+    enum InstructionKind { UNSUPPORTED, STRAIGHT, TERMINATOR };
+
+    // Mirrors Chip8::decode_at, anything the translator does not handle runs on the interpreter
+    InstructionKind classify(uint16_t opcode) {
+        switch (opcode & 0xF000) {
+            case 0x0000:
+                // (00EE) as decoded by the interpreter, 00E0 needs the display
+                return (opcode & 0x0F00) == 0 && (opcode & 0x000F) == 0x000E ? TERMINATOR : UNSUPPORTED;
+            case 0x1000: case 0x2000: case 0x3000: case 0x4000: case 0x5000: case 0x9000:
+                return TERMINATOR;
+            case 0x6000: case 0x7000: case 0xA000:
+                return STRAIGHT;
+            case 0x8000:
+                return (opcode & 0x000F) <= 0x7 || (opcode & 0x000F) == 0xE ? STRAIGHT : UNSUPPORTED;
+            case 0xF000:
+                switch (opcode & 0x00FF) {
+                    case 0x07: case 0x15: case 0x18: case 0x1E: case 0x29:
+                        return STRAIGHT;
+                    default:
+                        return UNSUPPORTED;
+                }
+            default:
+                return UNSUPPORTED;
+        }
+    }
+
+    // Bit mask of the V registers an instruction reads or writes
+    uint16_t registers_used(uint16_t opcode) {
+        const uint16_t x = 1 << ((opcode & 0x0F00) >> 8);
+        const uint16_t y = 1 << ((opcode & 0x00F0) >> 4);
+        switch (opcode & 0xF000) {
+            case 0x3000: case 0x4000: case 0x6000: case 0x7000:
+                return x;
+            case 0x5000: case 0x9000:
+                return x | y;
+            case 0x8000:
+                return (opcode & 0x000F) >= 0x4 ? x | y | 1 << 0xF : x | y;
+            case 0xF000:
+                return (opcode & 0x00FF) == 0x1E ? x | 1 << 0xF : x;
+            default:
+                return 0;
+        }
+    }
+}
+
+Chip8Jit::Chip8Jit(Chip8 &chip8) : chip8(chip8) {
+#if CHIP8_JIT_NATIVE
+    // Writable for now, compile() only makes it executable once a block has been emitted
+    void *memory = mmap(nullptr, CHIP8_JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory != MAP_FAILED)
+        code = static_cast<uint8_t*>(memory);
+    else
+        std::cout << "JIT code memory could not be mapped, falling back to the interpreter" << std::endl;
+#endif
+    flush();
+    chip8.code_write_hook = &Chip8Jit::on_code_write;
+    chip8.code_write_context = this;
+}
+
+Chip8Jit::~Chip8Jit() {
+    if (chip8.code_write_context == this) {
+        chip8.code_write_hook = nullptr;
+        chip8.code_write_context = nullptr;
+    }
+#if CHIP8_JIT_NATIVE
+    if (code != nullptr) munmap(code, CHIP8_JIT_CODE_SIZE);
+#endif
+}
+
+void Chip8Jit::flush() {
+    code_used = 0;
+    blocks.clear();
+    for (int32_t &index : block_at) index = NO_BLOCK;
+    memset(cover_count, 0, sizeof(cover_count));
+}
+
+bool Chip8Jit::set_code_writable(bool writable) {
+#if CHIP8_JIT_NATIVE
+    // Never writable and executable at the same time
+    return mprotect(code, CHIP8_JIT_CODE_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+#else
+    (void) writable;
+    return false;
+#endif
+}
+
+void Chip8Jit::set_verify(bool enabled) {
+    verify = enabled;
+}
+
+bool Chip8Jit::is_native() const {
+    return code != nullptr;
+}
+
+uint64_t Chip8Jit::get_native_instructions() const {
+    return native_instructions;
+}
+
+uint64_t Chip8Jit::get_interpreted_instructions() const {
+    return interpreted_instructions;
+}
+
+uint64_t Chip8Jit::get_blocks_compiled() const {
+    return blocks_compiled;
+}
+
+uint64_t Chip8Jit::get_verify_mismatches() const {
+    return verify_mismatches;
+}
+
+void Chip8Jit::load_frame() {
+    memcpy(frame.registers_v, chip8.registers_v, sizeof(frame.registers_v));
+    memcpy(frame.stack, chip8.stack, sizeof(frame.stack));
+    frame.pc = chip8.pc;
+    frame.idx_register = chip8.idx_register;
+    frame.sp = chip8.sp;
+    frame.delay_timer = chip8.delay_timer;
+    frame.sound_timer = chip8.sound_timer;
+}
+
+void Chip8Jit::store_frame() {
+    memcpy(chip8.registers_v, frame.registers_v, sizeof(frame.registers_v));
+    memcpy(chip8.stack, frame.stack, sizeof(frame.stack));
+    chip8.pc = frame.pc;
+    chip8.idx_register = frame.idx_register;
+    chip8.sp = frame.sp;
+    chip8.delay_timer = frame.delay_timer;
+    chip8.sound_timer = frame.sound_timer;
+}
+
+void Chip8Jit::interpret(uint32_t cycles) {
+    chip8.execute(cycles);
+    interpreted_instructions += cycles;
+}
+
+void Chip8Jit::run(uint32_t cycles) {
+    if (code == nullptr) {
+        interpret(cycles);
+        return;
+    }
+
+    load_frame();
+    while (cycles > 0) {
+        int32_t index = frame.pc < CHIP8_MEMORY_SIZE ? block_at[frame.pc] : INTERPRET_ONLY;
+        if (index == NO_BLOCK) {
+            index = compile(frame.pc);
+            block_at[frame.pc] = index;
+        }
+
+        uint32_t executed = 0;
+        if (index >= 0 && blocks[index].length <= cycles)
+            executed = run_block(blocks[index]);
+        if (executed == 0) {
+            // Untranslatable instruction, not enough budget left for the whole block, or a side exit
+            store_frame();
+            interpret(1);
+            load_frame();
+            executed = 1;
+        }
+        cycles -= executed;
+    }
+    store_frame();
+}
+
+uint32_t Chip8Jit::run_block(const Block &block) {
+    if (!verify) {
+        const uint32_t executed = block.entry(&frame);
+        native_instructions += executed;
+        return executed;
+    }
+
+    // Differential mode, replay the same instructions on the interpreter and compare
+    const Frame before = frame;
+    const uint32_t executed = block.entry(&frame);
+    const Frame after = frame;
+    frame = before;
+    store_frame();
+    chip8.execute(executed);
+    load_frame();
+    native_instructions += executed;
+
+    if (memcmp(&frame, &after, sizeof(Frame)) != 0) {
+        verify_mismatches++;
+        std::cout << "JIT mismatch in block 0x" << std::hex << block.start << "-0x" << block.end << std::dec
+                  << " after " << executed << " instructions" << std::endl;
+    }
+    // Either way, continue from the interpreter's state
+    return executed;
+}
+
+void Chip8Jit::on_code_write(void *context, uint16_t address, uint32_t length) {
+    static_cast<Chip8Jit*>(context)->invalidate(address, length);
+}
+
+void Chip8Jit::invalidate(uint16_t address, uint32_t length) {
+    if (length >= CHIP8_MEMORY_SIZE) {
+        flush();
+        return;
+    }
+
+    // The instruction starting one byte before the write overlaps it as well
+    const int begin = address > 0 ? address - 1 : 0;
+    const int end = address + length < CHIP8_MEMORY_SIZE ? address + length : CHIP8_MEMORY_SIZE;
+    bool covered = false;
+    for (int i = begin; i < end; ++i) {
+        if (block_at[i] == INTERPRET_ONLY) block_at[i] = NO_BLOCK;
+        if (cover_count[i] != 0) covered = true;
+    }
+    if (!covered) return;
+
+    for (Block &block : blocks) {
+        if (!block.alive || block.start >= end || block.end <= begin) continue;
+        block.alive = false;
+        block_at[block.start] = NO_BLOCK;
+        for (int i = block.start; i < block.end; ++i)
+            cover_count[i]--;
+    }
+}
+
+int32_t Chip8Jit::compile(uint16_t start) {
+#if CHIP8_JIT_NATIVE
+    // Scan the block first, so the prologue knows which V registers to bring into host registers
+    uint16_t opcodes[CHIP8_JIT_MAX_BLOCK_INSTRUCTIONS];
+    int host_register[CHIP8_REGISTER_COUNT];
+    int allocated[CHIP8_REGISTER_COUNT];
+    int allocated_count = 0;
+    int count = 0;
+    bool terminated = false;
+    for (int &reg : host_register) reg = -1;
+
+    if (code == nullptr) return INTERPRET_ONLY;
+
+    uint16_t address = start;
+    while (count < CHIP8_JIT_MAX_BLOCK_INSTRUCTIONS && address + 1 < CHIP8_MEMORY_SIZE) {
+        const uint16_t opcode = chip8.memory[address] << 8 | chip8.memory[address + 1];
+        const InstructionKind kind = classify(opcode);
+        if (kind == UNSUPPORTED) break;
+
+        const uint16_t needed = registers_used(opcode);
+        int missing = 0;
+        for (int i = 0; i < CHIP8_REGISTER_COUNT; ++i)
+            if ((needed & 1 << i) && host_register[i] < 0) missing++;
+        if (allocated_count + missing > V_POOL_SIZE) break;
+        for (int i = 0; i < CHIP8_REGISTER_COUNT; ++i) {
+            if ((needed & 1 << i) && host_register[i] < 0) {
+                host_register[i] = V_POOL[allocated_count];
+                allocated[allocated_count++] = i;
+            }
+        }
+
+        opcodes[count++] = opcode;
+        address += 2;
+        if (kind == TERMINATOR) {
+            terminated = true;
+            break;
+        }
+    }
+    if (count == 0) return INTERPRET_ONLY;
+
+    if (code_used + MAX_BLOCK_CODE_SIZE > CHIP8_JIT_CODE_SIZE || blocks.size() >= MAX_BLOCKS) flush();
+    if (!set_code_writable(true)) return INTERPRET_ONLY;
+
+    const int32_t off_v = offsetof(Frame, registers_v);
+    const int32_t off_stack = offsetof(Frame, stack);
+    const int32_t off_pc = offsetof(Frame, pc);
+    const int32_t off_idx = offsetof(Frame, idx_register);
+    const int32_t off_sp = offsetof(Frame, sp);
+    const int32_t off_delay = offsetof(Frame, delay_timer);
+    const int32_t off_sound = offsetof(Frame, sound_timer);
+
+    Emitter e(code + code_used);
+    static constexpr int SAVED[] = { RBX, RBP, R12, R13, R14, R15 };
+    for (const int reg : SAVED) e.push(reg);
+    e.load_frame_pointer();
+    e.load16(REG_I, off_idx);
+    e.load16(REG_SP, off_sp);
+    for (int i = 0; i < allocated_count; ++i)
+        e.load8(host_register[allocated[i]], off_v + allocated[i]);
+
+    // Write everything back and return; the new PC must already be in EAX
+    auto emit_exit = [&](uint32_t executed) {
+        e.store16(RAX, off_pc);
+        for (int i = 0; i < allocated_count; ++i)
+            e.store8(host_register[allocated[i]], off_v + allocated[i]);
+        e.store16(REG_I, off_idx);
+        e.store16(REG_SP, off_sp);
+        e.mov_ri(RAX, executed);
+        for (int i = 5; i >= 0; --i) e.pop(SAVED[i]);
+        e.ret();
+    };
+
+    for (int i = 0; i < count; ++i) {
+        const uint16_t opcode = opcodes[i];
+        const uint16_t pc = start + i * 2;
+        const uint8_t nn = opcode & 0x00FF;
+        const uint16_t nnn = opcode & 0x0FFF;
+        const int vx = host_register[(opcode & 0x0F00) >> 8];
+        const int vy = host_register[(opcode & 0x00F0) >> 4];
+        const int vf = host_register[0xF];
+
+        switch (opcode & 0xF000) {
+            case 0x0000: {
+                // (00EE) Return, an empty stack (or an SP past it) is left to the interpreter: SP - 1 < 16 unsigned
+                e.mov_rr(RCX, REG_SP);
+                e.alu_ri(EXT_SUB, RCX, 1);
+                e.alu_ri(EXT_CMP, RCX, CHIP8_STACK_SIZE);
+                const size_t ok = e.jcc_forward(CC_B);
+                e.mov_ri(RAX, pc);
+                emit_exit(i);
+                e.bind(ok);
+                e.alu_ri(EXT_SUB, REG_SP, 1);
+                e.load16_stack(RAX, off_stack);
+                e.alu_ri(EXT_ADD, RAX, 2);
+                e.alu_ri(EXT_AND, RAX, 0xFFFF);
+                emit_exit(i + 1);
+                break;
+            }
+            case 0x1000:
+                // (1NNN) Jump
+                e.mov_ri(RAX, nnn);
+                emit_exit(i + 1);
+                break;
+            case 0x2000: {
+                // (2NNN) Call, stack overflow is left to the interpreter
+                e.alu_ri(EXT_CMP, REG_SP, CHIP8_STACK_SIZE);
+                const size_t ok = e.jcc_forward(CC_B);
+                e.mov_ri(RAX, pc);
+                emit_exit(i);
+                e.bind(ok);
+                e.mov_ri(RAX, pc);
+                e.store16_stack(RAX, off_stack);
+                e.alu_ri(EXT_ADD, REG_SP, 1);
+                e.mov_ri(RAX, nnn);
+                emit_exit(i + 1);
+                break;
+            }
+            case 0x3000: case 0x4000: case 0x5000: case 0x9000: {
+                // (3XNN, 4XNN, 5XY0, 9XY0) Skips, pick PC + 2 or PC + 4 without branching
+                const bool registers = (opcode & 0xF000) == 0x5000 || (opcode & 0xF000) == 0x9000;
+                const bool equal = (opcode & 0xF000) == 0x3000 || (opcode & 0xF000) == 0x5000;
+                if (registers) e.alu_rr(ALU_CMP, vx, vy);
+                else e.alu_ri(EXT_CMP, vx, nn);
+                e.mov_ri(RAX, (pc + 2) & 0xFFFF);
+                e.mov_ri(RCX, (pc + 4) & 0xFFFF);
+                e.cmov(equal ? CC_E : CC_NE, RAX, RCX);
+                emit_exit(i + 1);
+                break;
+            }
+            case 0x6000:
+                // (6XNN) VX = NN
+                e.mov_ri(vx, nn);
+                break;
+            case 0x7000:
+                // (7XNN) VX += NN
+                e.alu_ri(EXT_ADD, vx, nn);
+                e.alu_ri(EXT_AND, vx, 0xFF);
+                break;
+            case 0x8000:
+                // Flags are written before the result, exactly like the interpreter, in case X or Y is F
+                switch (opcode & 0x000F) {
+                    case 0x0: e.mov_rr(vx, vy); break;
+                    case 0x1: e.alu_rr(ALU_OR, vx, vy); break;
+                    case 0x2: e.alu_rr(ALU_AND, vx, vy); break;
+                    case 0x3: e.alu_rr(ALU_XOR, vx, vy); break;
+                    case 0x4:
+                        e.mov_rr(RCX, vx);
+                        e.alu_rr(ALU_ADD, RCX, vy);
+                        e.shr_ri(RCX, 8);
+                        e.mov_rr(vf, RCX);
+                        e.alu_rr(ALU_ADD, vx, vy);
+                        e.alu_ri(EXT_AND, vx, 0xFF);
+                        break;
+                    case 0x5:
+                        e.alu_rr(ALU_XOR, RCX, RCX);
+                        e.alu_rr(ALU_CMP, vx, vy);
+                        e.setcc(CC_AE, RCX);
+                        e.mov_rr(vf, RCX);
+                        e.alu_rr(ALU_SUB, vx, vy);
+                        e.alu_ri(EXT_AND, vx, 0xFF);
+                        break;
+                    case 0x6:
+                        e.mov_rr(RCX, vx);
+                        e.alu_ri(EXT_AND, RCX, 1);
+                        e.mov_rr(vf, RCX);
+                        e.shr_ri(vx, 1);
+                        break;
+                    case 0x7:
+                        e.alu_rr(ALU_XOR, RCX, RCX);
+                        e.alu_rr(ALU_CMP, vy, vx);
+                        e.setcc(CC_AE, RCX);
+                        e.mov_rr(vf, RCX);
+                        e.mov_rr(RAX, vy);
+                        e.alu_rr(ALU_SUB, RAX, vx);
+                        e.alu_ri(EXT_AND, RAX, 0xFF);
+                        e.mov_rr(vx, RAX);
+                        break;
+                    case 0xE:
+                        e.mov_rr(RCX, vx);
+                        e.shr_ri(RCX, 7);
+                        e.mov_rr(vf, RCX);
+                        e.shl_ri(vx, 1);
+                        e.alu_ri(EXT_AND, vx, 0xFF);
+                        break;
+                }
+                break;
+            case 0xA000:
+                // (ANNN) I = NNN
+                e.mov_ri(REG_I, nnn);
+                break;
+            case 0xF000:
+                switch (opcode & 0x00FF) {
+                    case 0x07: e.load8(vx, off_delay); break;
+                    case 0x15: e.store8(vx, off_delay); break;
+                    case 0x18: e.store8(vx, off_sound); break;
+                    case 0x1E:
+                        // VF = I + VX > 0xFFF, then I += VX
+                        e.mov_rr(RCX, REG_I);
+                        e.alu_rr(ALU_ADD, RCX, vx);
+                        e.alu_rr(ALU_XOR, RAX, RAX);
+                        e.alu_ri(EXT_CMP, RCX, 0xFFF);
+                        e.setcc(CC_A, RAX);
+                        e.mov_rr(vf, RAX);
+                        e.alu_rr(ALU_ADD, REG_I, vx);
+                        e.alu_ri(EXT_AND, REG_I, 0xFFFF);
+                        break;
+                    case 0x29:
+                        // I = VX * 5
+                        e.mov_rr(RAX, vx);
+                        e.shl_ri(RAX, 2);
+                        e.alu_rr(ALU_ADD, RAX, vx);
+                        e.mov_rr(REG_I, RAX);
+                        break;
+                }
+                break;
+        }
+    }
+    if (!terminated) {
+        // Fell through into an instruction the interpreter has to run
+        e.mov_ri(RAX, address);
+        emit_exit(count);
+    }
+    if (!set_code_writable(false)) {
+        // Nothing translated can run any more, leave everything to the interpreter from now on
+        std::cout << "JIT code memory could not be made executable, falling back to the interpreter" << std::endl;
+        munmap(code, CHIP8_JIT_CODE_SIZE);
+        code = nullptr;
+        flush();
+        return INTERPRET_ONLY;
+    }
+
+    Block block;
+    block.entry = reinterpret_cast<BlockFunction>(code + code_used);
+    block.start = start;
+    block.end = address;
+    block.length = count;
+    block.alive = true;
+    code_used += e.size();
+    for (int i = block.start; i < block.end; ++i)
+        cover_count[i]++;
+    blocks.push_back(block);
+    blocks_compiled++;
+    return static_cast<int32_t>(blocks.size() - 1);
+#else
+    (void) start;
+    return INTERPRET_ONLY;
+#endif
+}
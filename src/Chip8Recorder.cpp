@@ -0,0 +1,261 @@
+#include "../include/Chip8Recorder.h"
+#include "../include/Chip8Rle.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+
+#define CHIP8_RECORDER_IDLE_SLEEP_MS 2 // Writer poll interval while the queue is empty, well under a frame
+
+Chip8Recorder::Chip8Recorder() : queue(std::make_unique<Chip8SpscQueue<QueuedFrame, CHIP8_RECORDER_QUEUE_SIZE>>()) {}
+
+Chip8Recorder::~Chip8Recorder() {
+    close();
+}
+
+bool Chip8Recorder::open(const std::string &path, int width, int height, int planes) {
+    close();
+    words = size_t(planes) * height * (width / 64);
+    if (words == 0 || words > CHIP8_RECORDING_MAX_WORDS || width % 64 != 0) return false;
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file) return false;
+
+    uint8_t header[CHIP8_RECORDING_HEADER_SIZE] = {};
+    const uint16_t version = CHIP8_RECORDING_VERSION;
+    const uint16_t w = width;
+    const uint16_t h = height;
+    memcpy(header, CHIP8_RECORDING_MAGIC, 4);
+    memcpy(header + 4, &version, sizeof(version));
+    memcpy(header + 6, &w, sizeof(w));
+    memcpy(header + 8, &h, sizeof(h));
+    header[10] = planes;
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    const size_t bytes = words * sizeof(uint64_t);
+    previous.assign(bytes, 0);
+    delta.resize(bytes);
+    encoded.resize(Chip8Rle::bound(bytes));
+    frame = 0;
+    dropped = 0;
+    has_last = false;
+    has_previous = false;
+    records_since_keyframe = 0;
+    write_failed = false;
+    stopping = false;
+    writer = std::thread(&Chip8Recorder::write_loop, this);
+    return true;
+}
+
+bool Chip8Recorder::is_open() const {
+    return writer.joinable();
+}
+
+void Chip8Recorder::record(const uint64_t *gfx, uint16_t keys) {
+    if (!is_open()) return;
+    const uint32_t index = frame++;
+    const size_t bytes = words * sizeof(uint64_t);
+    // Most frames of most games change nothing, those never leave this thread
+    if (has_last && keys == last_keys && memcmp(gfx, last_gfx, bytes) == 0) return;
+
+    QueuedFrame queued;
+    queued.frame = index;
+    queued.keys = keys;
+    memcpy(queued.gfx, gfx, bytes);
+    if (!queue->push(queued)) {
+        // The writer is a whole queue behind, drop the frame rather than wait; the next one is compared
+        // against the last frame queued, so it is not mistaken for unchanged
+        dropped++;
+        return;
+    }
+    memcpy(last_gfx, gfx, bytes);
+    last_keys = keys;
+    has_last = true;
+}
+
+uint64_t Chip8Recorder::get_frames() const {
+    return frame;
+}
+
+uint64_t Chip8Recorder::get_dropped() const {
+    return dropped;
+}
+
+bool Chip8Recorder::close() {
+    if (!is_open()) return true;
+    end_frame = frame;
+    stopping.store(true, std::memory_order_release);
+    writer.join();
+    file.close();
+    return !write_failed && !file.fail();
+}
+
+void Chip8Recorder::write_loop() {
+    while (true) {
+        if (const QueuedFrame *queued = queue->front()) {
+            write_frame(*queued);
+            queue->pop();
+            continue;
+        }
+        // Everything pushed before stopping was set is visible once it is seen set, so one more look suffices
+        if (stopping.load(std::memory_order_acquire)) {
+            if (queue->front()) continue;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(CHIP8_RECORDER_IDLE_SLEEP_MS));
+    }
+    write_record(Chip8RecordType::End, end_frame, 0, nullptr, 0);
+    file.flush();
+}
+
+void Chip8Recorder::write_frame(const QueuedFrame &queued) {
+    const size_t bytes = previous.size();
+    const uint8_t *display = reinterpret_cast<const uint8_t*>(queued.gfx);
+    const bool keyframe = !has_previous || records_since_keyframe >= CHIP8_RECORDING_KEYFRAME_INTERVAL;
+    size_t size;
+    if (keyframe) {
+        size = Chip8Rle::encode(display, bytes, encoded.data());
+        records_since_keyframe = 0;
+    } else {
+        for (size_t i = 0; i < bytes; ++i)
+            delta[i] = display[i] ^ previous[i];
+        size = Chip8Rle::encode(delta.data(), bytes, encoded.data());
+        records_since_keyframe++;
+    }
+    write_record(keyframe ? Chip8RecordType::Keyframe : Chip8RecordType::Delta, queued.frame, queued.keys,
+                 encoded.data(), size);
+    memcpy(previous.data(), display, bytes);
+    has_previous = true;
+}
+
+void Chip8Recorder::write_record(Chip8RecordType type, uint32_t frame, uint16_t keys, const uint8_t *payload, uint32_t size) {
+    uint8_t header[CHIP8_RECORDING_RECORD_HEADER_SIZE];
+    header[0] = static_cast<uint8_t>(type);
+    memcpy(header + 1, &frame, sizeof(frame));
+    memcpy(header + 5, &keys, sizeof(keys));
+    memcpy(header + 7, &size, sizeof(size));
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(payload), size);
+    if (!file) write_failed = true;
+}
+
+bool Chip8Replay::open(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    records.clear();
+    change_frames.clear();
+    if (data.size() < CHIP8_RECORDING_HEADER_SIZE || memcmp(data.data(), CHIP8_RECORDING_MAGIC, 4) != 0) return false;
+
+    uint16_t version, w, h;
+    memcpy(&version, data.data() + 4, sizeof(version));
+    memcpy(&w, data.data() + 6, sizeof(w));
+    memcpy(&h, data.data() + 8, sizeof(h));
+    if (version != CHIP8_RECORDING_VERSION) return false;
+    width = w;
+    height = h;
+    planes = data[10];
+    words = size_t(planes) * height * (width / 64);
+    if (words == 0 || words > CHIP8_RECORDING_MAX_WORDS) return false;
+
+    // A recording cut short (crash, full disk) ends at its last complete record, without an End record
+    bool ended = false;
+    size_t offset = CHIP8_RECORDING_HEADER_SIZE;
+    while (!ended && data.size() - offset >= CHIP8_RECORDING_RECORD_HEADER_SIZE) {
+        Record record;
+        uint32_t at;
+        record.type = static_cast<Chip8RecordType>(data[offset]);
+        memcpy(&at, data.data() + offset + 1, sizeof(at));
+        memcpy(&record.keys, data.data() + offset + 5, sizeof(record.keys));
+        memcpy(&record.size, data.data() + offset + 7, sizeof(record.size));
+        record.offset = offset + CHIP8_RECORDING_RECORD_HEADER_SIZE;
+        if (record.size > data.size() - record.offset) break;
+        if (!change_frames.empty() && at < change_frames.back()) return false;
+        switch (record.type) {
+            case Chip8RecordType::Keyframe:
+                record.keyframe = records.size();
+                break;
+            case Chip8RecordType::Delta:
+                if (records.empty()) return false;
+                record.keyframe = records.back().keyframe;
+                break;
+            case Chip8RecordType::End:
+                frame_count = at;
+                ended = true;
+                continue;
+            default:
+                return false;
+        }
+        records.push_back(record);
+        change_frames.push_back(at);
+        offset = record.offset + record.size;
+    }
+    if (!ended) frame_count = change_frames.empty() ? 0 : change_frames.back() + 1;
+
+    gfx.assign(words, 0);
+    delta.resize(words * sizeof(uint64_t));
+    current = records.size();
+    frame = 0;
+    return true;
+}
+
+int Chip8Replay::get_width() const {
+    return width;
+}
+
+int Chip8Replay::get_height() const {
+    return height;
+}
+
+int Chip8Replay::get_planes() const {
+    return planes;
+}
+
+uint32_t Chip8Replay::get_frame_count() const {
+    return frame_count;
+}
+
+const std::vector<uint32_t>& Chip8Replay::get_change_frames() const {
+    return change_frames;
+}
+
+bool Chip8Replay::seek(uint32_t target) {
+    if (target >= frame_count || records.empty()) return false;
+    // Last record at or before the frame, the first record is always at frame 0
+    const size_t record = std::upper_bound(change_frames.begin(), change_frames.end(), target) - change_frames.begin() - 1;
+    // Carry on from the current record if it lies between the keyframe and the target, otherwise start over
+    size_t next = records[record].keyframe;
+    if (current < records.size() && current <= record && current >= next) next = current + 1;
+    for (; next <= record; ++next) {
+        if (!apply(next)) {
+            current = records.size();
+            return false;
+        }
+        current = next;
+    }
+    frame = target;
+    return true;
+}
+
+uint32_t Chip8Replay::get_frame() const {
+    return frame;
+}
+
+const uint64_t* Chip8Replay::get_gfx_packed() const {
+    return gfx.data();
+}
+
+uint16_t Chip8Replay::get_keys() const {
+    return current < records.size() ? records[current].keys : 0;
+}
+
+bool Chip8Replay::apply(size_t index) {
+    const Record &record = records[index];
+    uint8_t *display = reinterpret_cast<uint8_t*>(gfx.data());
+    if (record.type == Chip8RecordType::Keyframe)
+        return Chip8Rle::decode(data.data() + record.offset, record.size, display, delta.size());
+    if (!Chip8Rle::decode(data.data() + record.offset, record.size, delta.data(), delta.size())) return false;
+    for (size_t i = 0; i < delta.size(); ++i)
+        display[i] ^= delta[i];
+    return true;
+}
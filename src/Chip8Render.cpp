@@ -0,0 +1,295 @@
+#include "../include/Chip8Render.h"
+
+#include <algorithm>
+#include <cstring>
+
+// SSE2 is part of x86-64, AVX2 is built next to it and used where the CPU has it. Elsewhere, WebAssembly
+// included, the plain C++ kernels run.
+#if defined(__SSE2__) || defined(_M_X64)
+#define CHIP8_RENDER_SSE2 1
+#include <emmintrin.h>
+#endif
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#define CHIP8_RENDER_AVX2 1
+#define CHIP8_RENDER_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Each pixel's plane bits pick its palette colour, plane1 is null for machines with a single plane
+template <bool two_planes>
+void expand_scalar(const uint64_t *plane0, const uint64_t *plane1, int width, const uint32_t *palette, uint32_t *out) {
+    for (int x = 0; x < width; ++x) {
+        const int shift = 63 - x % 64;
+        uint32_t index = plane0[x / 64] >> shift & 1;
+        if (two_planes) index |= (plane1[x / 64] >> shift & 1) << 1;
+        out[x] = palette[index];
+    }
+}
+
+// Dark pixels (the background colour in target) move from their shown colour towards the background, keeping
+// persistence / 256 of the distance per channel, rounded down so every fade ends. Lit pixels take their colour at
+// once. Returns whether any pixel is still fading.
+bool fade_scalar(uint32_t *shown, const uint32_t *target, int width, uint32_t background, uint8_t persistence) {
+    uint32_t fading = 0;
+    for (int x = 0; x < width; ++x) {
+        uint32_t color = target[x];
+        if (color == background) {
+            color = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                const int previous = shown[x] >> shift & 0xFF;
+                const int base = background >> shift & 0xFF;
+                const int distance = (previous > base ? previous - base : base - previous) * persistence >> 8;
+                color |= uint32_t(previous > base ? base + distance : base - distance) << shift;
+            }
+        }
+        shown[x] = color;
+        fading |= color ^ target[x];
+    }
+    return fading != 0;
+}
+
+void replicate_scalar(const uint32_t *row, int width, int scale, uint32_t *out) {
+    for (int x = 0; x < width; ++x)
+        for (int i = 0; i < scale; ++i)
+            *out++ = row[x];
+}
+
+#if CHIP8_RENDER_SSE2
+inline __m128i select_sse2(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// Four pixels per nibble: the nibble is broadcast and each lane tests its own bit, leftmost pixel in lane 0
+template <bool two_planes>
+void expand_sse2(const uint64_t *plane0, const uint64_t *plane1, int width, const uint32_t *palette, uint32_t *out) {
+    const __m128i bits = _mm_set_epi32(1, 2, 4, 8);
+    const __m128i background = _mm_set1_epi32(palette[0]);
+    const __m128i color1 = _mm_set1_epi32(palette[1]);
+    const __m128i color2 = _mm_set1_epi32(palette[2]);
+    const __m128i color3 = _mm_set1_epi32(palette[3]);
+    for (int word = 0; word < width / 64; ++word) {
+        const uint64_t bits0 = plane0[word];
+        const uint64_t bits1 = two_planes ? plane1[word] : 0;
+        for (int shift = 60; shift >= 0; shift -= 4, out += 4) {
+            const __m128i nibble0 = _mm_set1_epi32(bits0 >> shift & 0xF);
+            const __m128i mask0 = _mm_cmpeq_epi32(_mm_and_si128(nibble0, bits), bits);
+            __m128i color = select_sse2(mask0, color1, background);
+            if (two_planes) {
+                const __m128i nibble1 = _mm_set1_epi32(bits1 >> shift & 0xF);
+                const __m128i mask1 = _mm_cmpeq_epi32(_mm_and_si128(nibble1, bits), bits);
+                color = select_sse2(mask1, select_sse2(mask0, color3, color2), color);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), color);
+        }
+    }
+}
+
+// Same arithmetic as fade_scalar. The distance of each channel is one of the two saturated differences, the
+// other is 0, scaled on 16-bit lanes where it cannot overflow.
+bool fade_sse2(uint32_t *shown, const uint32_t *target, int width, uint32_t background, uint8_t persistence) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i base = _mm_set1_epi32(background);
+    const __m128i weight = _mm_set1_epi16(persistence);
+    __m128i fading = zero;
+    for (int x = 0; x < width; x += 4) {
+        const __m128i goal = _mm_loadu_si128(reinterpret_cast<const __m128i*>(target + x));
+        const __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shown + x));
+        const __m128i above = _mm_subs_epu8(previous, base);
+        const __m128i distance = _mm_or_si128(above, _mm_subs_epu8(base, previous));
+        const __m128i low = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(distance, zero), weight), 8);
+        const __m128i high = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(distance, zero), weight), 8);
+        const __m128i scaled = _mm_packus_epi16(low, high);
+        const __m128i faded = select_sse2(_mm_cmpeq_epi8(above, zero), _mm_subs_epu8(base, scaled),
+                                          _mm_adds_epu8(base, scaled));
+        const __m128i color = select_sse2(_mm_cmpeq_epi32(goal, base), faded, goal);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(shown + x), color);
+        fading = _mm_or_si128(fading, _mm_xor_si128(color, goal));
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(fading, zero)) != 0xFFFF;
+}
+
+// Scale 2 interleaves each pixel with itself. Larger scales broadcast the pixel and store it in 4 texel steps
+// that may run past its span, into the next pixel's which is written right after; only the last pixel of the row
+// stops exactly at the end.
+void replicate_sse2(const uint32_t *row, int width, int scale, uint32_t *out) {
+    if (scale == 1) {
+        memcpy(out, row, width * sizeof(uint32_t));
+        return;
+    }
+    if (scale == 2) {
+        for (int x = 0; x < width; x += 4, out += 8) {
+            const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi32(pixels, pixels));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), _mm_unpackhi_epi32(pixels, pixels));
+        }
+        return;
+    }
+    for (int x = 0; x < width - 1; ++x, out += scale) {
+        const __m128i pixel = _mm_set1_epi32(row[x]);
+        for (int i = 0; i < scale; i += 4)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), pixel);
+    }
+    for (int i = 0; i < scale; ++i)
+        out[i] = row[width - 1];
+}
+#endif
+
+#if CHIP8_RENDER_AVX2
+// Eight pixels per byte, as expand_sse2
+template <bool two_planes>
+CHIP8_RENDER_TARGET_AVX2
+void expand_avx2(const uint64_t *plane0, const uint64_t *plane1, int width, const uint32_t *palette, uint32_t *out) {
+    const __m256i bits = _mm256_set_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i background = _mm256_set1_epi32(palette[0]);
+    const __m256i color1 = _mm256_set1_epi32(palette[1]);
+    const __m256i color2 = _mm256_set1_epi32(palette[2]);
+    const __m256i color3 = _mm256_set1_epi32(palette[3]);
+    for (int word = 0; word < width / 64; ++word) {
+        const uint64_t bits0 = plane0[word];
+        const uint64_t bits1 = two_planes ? plane1[word] : 0;
+        for (int shift = 56; shift >= 0; shift -= 8, out += 8) {
+            const __m256i byte0 = _mm256_set1_epi32(bits0 >> shift & 0xFF);
+            const __m256i mask0 = _mm256_cmpeq_epi32(_mm256_and_si256(byte0, bits), bits);
+            __m256i color = _mm256_blendv_epi8(background, color1, mask0);
+            if (two_planes) {
+                const __m256i byte1 = _mm256_set1_epi32(bits1 >> shift & 0xFF);
+                const __m256i mask1 = _mm256_cmpeq_epi32(_mm256_and_si256(byte1, bits), bits);
+                color = _mm256_blendv_epi8(color, _mm256_blendv_epi8(color2, color3, mask0), mask1);
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), color);
+        }
+    }
+}
+
+// As replicate_sse2 in 8 texel steps. Scales below 8 would store mostly texels that get overwritten, those keep
+// to 4 texel steps.
+CHIP8_RENDER_TARGET_AVX2
+void replicate_avx2(const uint32_t *row, int width, int scale, uint32_t *out) {
+    if (scale == 2) {
+        for (int x = 0; x < width; x += 8, out += 16) {
+            const __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x));
+            const __m256i low = _mm256_unpacklo_epi32(pixels, pixels);
+            const __m256i high = _mm256_unpackhi_epi32(pixels, pixels);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_permute2x128_si256(low, high, 0x20));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 8), _mm256_permute2x128_si256(low, high, 0x31));
+        }
+        return;
+    }
+    if (scale < 8) {
+        replicate_sse2(row, width, scale, out);
+        return;
+    }
+    for (int x = 0; x < width - 1; ++x, out += scale) {
+        const __m256i pixel = _mm256_set1_epi32(row[x]);
+        for (int i = 0; i < scale; i += 8)
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), pixel);
+    }
+    for (int i = 0; i < scale; ++i)
+        out[i] = row[width - 1];
+}
+#endif
+
+}
+
+Chip8Renderer::Chip8Renderer(int display_width, int display_height, int display_planes, int scale)
+    : width(display_width), height(display_height), planes(display_planes), words(display_width / 64), scale(scale),
+      target(display_width), shown(size_t(display_width) * display_height) {
+    memcpy(palette, default_palette, sizeof(palette));
+    clear_shown();
+    if (!set_kernel(Chip8RenderKernel::Avx2) && !set_kernel(Chip8RenderKernel::Sse2))
+        set_kernel(Chip8RenderKernel::Scalar);
+}
+
+int Chip8Renderer::get_width() const {
+    return width * scale;
+}
+
+int Chip8Renderer::get_height() const {
+    return height * scale;
+}
+
+int Chip8Renderer::get_scale() const {
+    return scale;
+}
+
+void Chip8Renderer::set_palette(const uint32_t colors[4]) {
+    memcpy(palette, colors, sizeof(palette));
+    clear_shown();
+}
+
+void Chip8Renderer::set_persistence(uint8_t value) {
+    persistence = value;
+    clear_shown();
+}
+
+bool Chip8Renderer::set_kernel(Chip8RenderKernel value) {
+    const bool two_planes = planes > 1;
+    switch (value) {
+        case Chip8RenderKernel::Scalar:
+            expand = two_planes ? expand_scalar<true> : expand_scalar<false>;
+            fade = fade_scalar;
+            replicate = replicate_scalar;
+            break;
+#if CHIP8_RENDER_SSE2
+        case Chip8RenderKernel::Sse2:
+            expand = two_planes ? expand_sse2<true> : expand_sse2<false>;
+            fade = fade_sse2;
+            replicate = replicate_sse2;
+            break;
+#endif
+#if CHIP8_RENDER_AVX2
+        case Chip8RenderKernel::Avx2:
+            if (!__builtin_cpu_supports("avx2")) return false;
+            expand = two_planes ? expand_avx2<true> : expand_avx2<false>;
+            // A few hundred pixels per row, SSE2 is as fast as it gets
+            fade = fade_sse2;
+            replicate = replicate_avx2;
+            break;
+#endif
+        default:
+            return false;
+    }
+    kernel = value;
+    return true;
+}
+
+Chip8RenderKernel Chip8Renderer::get_kernel() const {
+    return kernel;
+}
+
+uint64_t Chip8Renderer::get_fading_rows() const {
+    return fading_rows;
+}
+
+void Chip8Renderer::render(const uint64_t *gfx, int first_row, int last_row, void *pixels, int pitch) {
+    auto *out = static_cast<uint8_t*>(pixels);
+    for (int y = first_row; y < last_row; ++y) {
+        const uint64_t *plane0 = gfx + y * words;
+        const uint64_t *plane1 = planes > 1 ? gfx + (height + y) * words : nullptr;
+        if (persistence == 0 && scale == 1) {
+            // Nothing to keep, expand straight into the output
+            expand(plane0, plane1, width, palette, reinterpret_cast<uint32_t*>(out));
+            out += pitch;
+            continue;
+        }
+        expand(plane0, plane1, width, palette, target.data());
+        const uint32_t *row = target.data();
+        if (persistence != 0) {
+            uint32_t *previous = shown.data() + y * width;
+            if (fade(previous, row, width, palette[0], persistence)) fading_rows |= 1ull << y;
+            else fading_rows &= ~(1ull << y);
+            row = previous;
+        }
+        // Every output row is written from the expanded one rather than copied from the first, which would read
+        // the output back
+        for (int i = 0; i < scale; ++i, out += pitch)
+            replicate(row, width, scale, reinterpret_cast<uint32_t*>(out));
+    }
+}
+
+void Chip8Renderer::clear_shown() {
+    std::fill(shown.begin(), shown.end(), palette[0]);
+    fading_rows = 0;
+}
@@ -0,0 +1,141 @@
+#include "../include/Chip8Rewind.h"
+#include "../include/Chip8Rle.h"
+
+#include <algorithm>
+#include <cstring>
+
+Chip8Rewind::Chip8Rewind(size_t memory_cap, uint32_t keyframe_interval)
+    : keyframe_interval(std::max<uint32_t>(keyframe_interval, 1)),
+      keyframe_state(Chip8::snapshot_size()),
+      state(Chip8::snapshot_size()),
+      delta(Chip8::snapshot_size()),
+      encoded(Chip8Rle::bound(Chip8::snapshot_size())) {
+    // Always room for at least one frame, however small the cap
+    storage.resize(std::max(memory_cap, encoded.size()));
+    // Deltas of a running game are rarely under a few hundred bytes, so this many descriptors do not run out first
+    entries.resize(std::max<size_t>(memory_cap / 256, 2 * this->keyframe_interval));
+}
+
+void Chip8Rewind::prepare(size_t state_size) {
+    if (state.size() == state_size) return;
+    clear();
+    keyframe_state.resize(state_size);
+    state.resize(state_size);
+    delta.resize(state_size);
+    encoded.resize(Chip8Rle::bound(state_size));
+    if (storage.size() < encoded.size()) storage.resize(encoded.size());
+}
+
+void Chip8Rewind::commit() {
+    bool keyframe = !keyframe_valid || next_sequence - keyframe_sequence >= keyframe_interval;
+    size_t size = encode(keyframe);
+
+    while (storage.size() - storage_used < size || entries_count == entries.size()) {
+        drop_oldest();
+        // Dropped the keyframe this frame was taken against, store it whole instead
+        if (!keyframe && !keyframe_valid) {
+            keyframe = true;
+            size = encode(keyframe);
+        }
+    }
+
+    Entry &frame = entries[(entries_tail + entries_count) % entries.size()];
+    frame.sequence = next_sequence;
+    frame.keyframe = keyframe ? next_sequence : keyframe_sequence;
+    frame.offset = storage_head;
+    frame.size = size;
+    write_ring(encoded.data(), size);
+    entries_count++;
+
+    if (keyframe) {
+        std::swap(keyframe_state, state);
+        keyframe_sequence = next_sequence;
+        keyframe_valid = true;
+    }
+    next_sequence++;
+}
+
+bool Chip8Rewind::pop() {
+    if (entries_count == 0) return false;
+    const Entry newest = entry(entries_count - 1);
+    const bool is_delta = newest.keyframe != newest.sequence;
+
+    if (is_delta && (!keyframe_valid || keyframe_sequence != newest.keyframe)) {
+        // Sequence numbers are consecutive, and a delta never outlives its keyframe
+        const Entry &base = entry(entries_count - 1 - (newest.sequence - newest.keyframe));
+        keyframe_valid = decode(base, keyframe_state);
+        if (!keyframe_valid) return false;
+        keyframe_sequence = base.sequence;
+    }
+    if (!decode(newest, state)) return false;
+    if (is_delta) {
+        for (size_t i = 0; i < state.size(); ++i)
+            state[i] ^= keyframe_state[i];
+    }
+
+    // Forget the frame, recording carries on from it
+    storage_head = newest.offset;
+    storage_used -= newest.size;
+    entries_count--;
+    next_sequence = newest.sequence;
+    if (!is_delta) keyframe_valid = false;
+    return true;
+}
+
+void Chip8Rewind::clear() {
+    storage_head = 0;
+    storage_used = 0;
+    entries_tail = 0;
+    entries_count = 0;
+    next_sequence = 0;
+    keyframe_valid = false;
+}
+
+size_t Chip8Rewind::frames() const {
+    return entries_count;
+}
+
+size_t Chip8Rewind::memory_used() const {
+    return storage_used;
+}
+
+Chip8Rewind::Entry& Chip8Rewind::entry(size_t index) {
+    return entries[(entries_tail + index) % entries.size()];
+}
+
+size_t Chip8Rewind::encode(bool keyframe) {
+    if (keyframe) return Chip8Rle::encode(state.data(), state.size(), encoded.data());
+    for (size_t i = 0; i < state.size(); ++i)
+        delta[i] = state[i] ^ keyframe_state[i];
+    return Chip8Rle::encode(delta.data(), delta.size(), encoded.data());
+}
+
+void Chip8Rewind::drop_oldest() {
+    // The oldest frame is always a keyframe, the deltas right after it go along with it
+    do {
+        const Entry &oldest = entry(0);
+        if (keyframe_valid && oldest.sequence == keyframe_sequence) keyframe_valid = false;
+        storage_used -= oldest.size;
+        entries_tail = (entries_tail + 1) % entries.size();
+        entries_count--;
+    } while (entries_count > 0 && entry(0).keyframe != entry(0).sequence);
+}
+
+void Chip8Rewind::write_ring(const uint8_t *data, size_t size) {
+    const size_t first = std::min(size, storage.size() - storage_head);
+    memcpy(storage.data() + storage_head, data, first);
+    memcpy(storage.data(), data + first, size - first);
+    storage_head = (storage_head + size) % storage.size();
+    storage_used += size;
+}
+
+void Chip8Rewind::read_ring(const Entry &frame, uint8_t *out) const {
+    const size_t first = std::min(frame.size, storage.size() - frame.offset);
+    memcpy(out, storage.data() + frame.offset, first);
+    memcpy(out + first, storage.data(), frame.size - first);
+}
+
+bool Chip8Rewind::decode(const Entry &frame, std::vector<uint8_t> &out) {
+    read_ring(frame, encoded.data());
+    return Chip8Rle::decode(encoded.data(), frame.size, out.data(), out.size());
+}
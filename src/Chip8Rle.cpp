@@ -0,0 +1,69 @@
+#include "../include/Chip8Rle.h"
+
+#include <cstring>
+
+namespace {
+    size_t put_varint(uint8_t *out, size_t value) {
+        size_t length = 0;
+        while (value >= 0x80) {
+            out[length++] = (value & 0x7F) | 0x80;
+            value >>= 7;
+        }
+        out[length++] = value;
+        return length;
+    }
+
+    bool get_varint(const uint8_t *&in, const uint8_t *end, size_t &value) {
+        value = 0;
+        for (int shift = 0; in < end && shift < 64; shift += 7) {
+            const uint8_t byte = *in++;
+            value |= static_cast<size_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) return true;
+        }
+        return false;
+    }
+}
+
+size_t Chip8Rle::bound(size_t size) {
+    return size + size / 2 + 32;
+}
+
+size_t Chip8Rle::encode(const uint8_t *in, size_t size, uint8_t *out) {
+    size_t i = 0;
+    size_t length = 0;
+    while (i < size) {
+        size_t zeros = 0;
+        while (i + zeros < size && in[i + zeros] == 0) zeros++;
+        i += zeros;
+        // Keep literals going through runs of one or two zeros, a new pair would cost more than it saves
+        size_t literals = 0;
+        while (i + literals < size) {
+            const size_t at = i + literals;
+            if (in[at] == 0 && at + 2 < size && in[at + 1] == 0 && in[at + 2] == 0) break;
+            literals++;
+        }
+        length += put_varint(out + length, zeros);
+        length += put_varint(out + length, literals);
+        memcpy(out + length, in + i, literals);
+        length += literals;
+        i += literals;
+    }
+    return length;
+}
+
+bool Chip8Rle::decode(const uint8_t *in, size_t size, uint8_t *out, size_t out_size) {
+    const uint8_t *end = in + size;
+    size_t length = 0;
+    while (in < end) {
+        size_t zeros, literals;
+        if (!get_varint(in, end, zeros) || !get_varint(in, end, literals)) return false;
+        if (zeros > out_size - length || literals > out_size - length - zeros || literals > size_t(end - in))
+            return false;
+        memset(out + length, 0, zeros);
+        length += zeros;
+        memcpy(out + length, in, literals);
+        length += literals;
+        in += literals;
+    }
+    return length == out_size;
+}
@@ -0,0 +1,269 @@
+#include "../include/Chip8RomStore.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#ifdef _WIN32
+#include <memory>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Archive layout (version 1), fields in host byte order:
+// "C8RA", uint16 version, uint16 reserved, uint32 ROM count,
+// one entry per ROM: uint64 hash, uint32 data offset, uint32 name offset, uint16 size, uint8 variant,
+//                    uint8 name length, uint32 reserved
+// then the names and the ROM contents, offsets counted from the start of the file
+
+Chip8RomStore::~Chip8RomStore() {
+    while (!mappings.empty())
+        unmap_last();
+}
+
+bool Chip8RomStore::add(const std::string &path) {
+    std::error_code error;
+    if (std::filesystem::is_directory(path, error)) return add_directory(path) > 0;
+
+    char magic[4] = {};
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == nullptr) return false;
+    const size_t read = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+    if (read == sizeof(magic) && memcmp(magic, CHIP8_ARCHIVE_MAGIC, 4) == 0) return add_archive(path);
+    return add_file(path);
+}
+
+bool Chip8RomStore::add_file(const std::string &path) {
+    size_t size;
+    const uint8_t *data = map_file(path, size);
+    if (data == nullptr) return false;
+    if (size > Chip8XoChip::max_program_size) {
+        unmap_last();
+        return false;
+    }
+    // Already have these bytes under another name, the mapping is not needed
+    if (!insert(path, data, size, hash(data, size), detect_variant(data, size))) unmap_last();
+    return true;
+}
+
+size_t Chip8RomStore::add_directory(const std::string &path) {
+    std::vector<std::string> files;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator(path, error)) {
+        if (!entry.is_regular_file(error)) continue;
+        if (entry.path().filename().string().rfind('.', 0) == 0) continue; // Hidden files
+        files.push_back(entry.path().string());
+    }
+    // Directory order is arbitrary, keep the store (and anything indexing it) reproducible
+    std::sort(files.begin(), files.end());
+
+    size_t added = 0;
+    for (const std::string &file : files)
+        if (add_file(file)) added++;
+    return added;
+}
+
+bool Chip8RomStore::add_archive(const std::string &path) {
+    size_t size;
+    const uint8_t *data = map_file(path, size);
+    if (data == nullptr) return false;
+
+    uint16_t version = 0;
+    uint32_t count = 0;
+    if (size >= CHIP8_ARCHIVE_HEADER_SIZE) {
+        memcpy(&version, data + 4, sizeof(version));
+        memcpy(&count, data + 8, sizeof(count));
+    }
+    if (size < CHIP8_ARCHIVE_HEADER_SIZE || memcmp(data, CHIP8_ARCHIVE_MAGIC, 4) != 0
+        || version != CHIP8_ARCHIVE_VERSION || count > (size - CHIP8_ARCHIVE_HEADER_SIZE) / CHIP8_ARCHIVE_ENTRY_SIZE) {
+        unmap_last();
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint8_t *entry = data + CHIP8_ARCHIVE_HEADER_SIZE + i * CHIP8_ARCHIVE_ENTRY_SIZE;
+        uint64_t rom_hash;
+        uint32_t data_offset, name_offset;
+        uint16_t rom_size;
+        memcpy(&rom_hash, entry, sizeof(rom_hash));
+        memcpy(&data_offset, entry + 8, sizeof(data_offset));
+        memcpy(&name_offset, entry + 12, sizeof(name_offset));
+        memcpy(&rom_size, entry + 16, sizeof(rom_size));
+        const uint8_t variant = entry[18];
+        const uint8_t name_length = entry[19];
+
+        // Skip entries that point outside the file, do not fit in memory or were corrupted
+        if (rom_size == 0 || rom_size > Chip8XoChip::max_program_size || data_offset > size || rom_size > size - data_offset
+            || name_offset > size || name_length > size - name_offset || variant > uint8_t(Chip8Variant::XoChip)
+            || hash(data + data_offset, rom_size) != rom_hash)
+            continue;
+        const std::string name(reinterpret_cast<const char*>(data + name_offset), name_length);
+        insert(name, data + data_offset, rom_size, rom_hash, static_cast<Chip8Variant>(variant));
+    }
+    return true;
+}
+
+bool Chip8RomStore::write_archive(const std::string &path) const {
+    std::vector<uint8_t> archive(CHIP8_ARCHIVE_HEADER_SIZE + roms.size() * CHIP8_ARCHIVE_ENTRY_SIZE);
+    const uint16_t version = CHIP8_ARCHIVE_VERSION;
+    const uint32_t count = roms.size();
+    memcpy(archive.data(), CHIP8_ARCHIVE_MAGIC, 4);
+    memcpy(archive.data() + 4, &version, sizeof(version));
+    memcpy(archive.data() + 8, &count, sizeof(count));
+
+    for (size_t i = 0; i < roms.size(); ++i) {
+        const Chip8Rom &rom = roms[i];
+        const uint8_t name_length = std::min<size_t>(rom.name.size(), UINT8_MAX);
+        const uint32_t name_offset = archive.size();
+        archive.insert(archive.end(), rom.name.begin(), rom.name.begin() + name_length);
+        const uint32_t data_offset = archive.size();
+        archive.insert(archive.end(), rom.data, rom.data + rom.size);
+
+        uint8_t *entry = archive.data() + CHIP8_ARCHIVE_HEADER_SIZE + i * CHIP8_ARCHIVE_ENTRY_SIZE;
+        const uint16_t rom_size = rom.size;
+        memcpy(entry, &rom.hash, sizeof(rom.hash));
+        memcpy(entry + 8, &data_offset, sizeof(data_offset));
+        memcpy(entry + 12, &name_offset, sizeof(name_offset));
+        memcpy(entry + 16, &rom_size, sizeof(rom_size));
+        entry[18] = static_cast<uint8_t>(rom.variant);
+        entry[19] = name_length;
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(archive.data()), archive.size());
+    return static_cast<bool>(file);
+}
+
+size_t Chip8RomStore::size() const {
+    return roms.size();
+}
+
+const Chip8Rom& Chip8RomStore::rom(size_t index) const {
+    return roms[index];
+}
+
+const Chip8Rom* Chip8RomStore::find(uint64_t hash) const {
+    const auto found = index.find(hash);
+    return found != index.end() ? &roms[found->second] : nullptr;
+}
+
+uint64_t Chip8RomStore::hash(const uint8_t *data, size_t size) {
+    uint64_t value = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+        value ^= data[i];
+        value *= 0x100000001B3ull;
+    }
+    return value;
+}
+
+Chip8Variant Chip8RomStore::detect_variant(const uint8_t *data, size_t size) {
+    // Only look at code reachable from the entry point, sprite data happily contains extension opcodes
+    bool super_chip = false;
+    bool xo_chip = false;
+    const size_t end = CHIP8_ADDR_PROGRAM_START + size;
+    std::vector<bool> visited(Chip8XoChip::memory_size);
+    std::vector<size_t> pending = {CHIP8_ADDR_PROGRAM_START};
+
+    while (!pending.empty()) {
+        size_t address = pending.back();
+        pending.pop_back();
+        // Follow straight-line code until it leaves the ROM (interpreter routines below it included), ends, or
+        // joins code already seen
+        while (address >= CHIP8_ADDR_PROGRAM_START && address + 1 < end && !visited[address]) {
+            visited[address] = true;
+            const uint8_t *bytes = data + address - CHIP8_ADDR_PROGRAM_START;
+            const uint16_t opcode = bytes[0] << 8 | bytes[1];
+            const uint16_t nnn = opcode & 0x0FFF;
+            const uint8_t nn = opcode & 0x00FF;
+            const uint8_t n = opcode & 0x000F;
+            size_t next = address + 2;
+
+            switch (opcode & 0xF000) {
+                case 0x0000:
+                    if (opcode == 0x00EE) next = end; // Return
+                    else if (opcode == 0x00FD) super_chip = true, next = end; // Exit
+                    else if ((opcode & 0xFFF0) == 0x00C0 || opcode == 0x00FB || opcode == 0x00FC || opcode == 0x00FE
+                             || opcode == 0x00FF) super_chip = true;
+                    else if ((opcode & 0xFFF0) == 0x00D0) xo_chip = true;
+                    break;
+                case 0x1000: next = nnn; break;
+                case 0x2000: pending.push_back(nnn); break;
+                case 0x5000:
+                    if (n == 2 || n == 3) xo_chip = true;
+                    pending.push_back(address + 4);
+                    break;
+                case 0x3000: case 0x4000: case 0x9000: case 0xE000: pending.push_back(address + 4); break;
+                case 0xB000: next = end; break; // Computed jump, the target is not known statically
+                case 0xD000: if (n == 0) super_chip = true; break;
+                case 0xF000:
+                    if (opcode == 0xF000) xo_chip = true, next = address + 4; // Long I load, 4 bytes
+                    else if (nn == 0x01 || opcode == 0xF002 || nn == 0x3A) xo_chip = true;
+                    else if (nn == 0x30 || nn == 0x75 || nn == 0x85) super_chip = true;
+                    break;
+            }
+            if (next >= Chip8XoChip::memory_size) break;
+            address = next;
+        }
+    }
+    if (xo_chip) return Chip8Variant::XoChip;
+    return super_chip ? Chip8Variant::SuperChip : Chip8Variant::Chip8;
+}
+
+const uint8_t* Chip8RomStore::map_file(const std::string &path, size_t &size) {
+#ifdef _WIN32
+    // No mmap here, read into a buffer the store owns instead
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) return nullptr;
+    size = static_cast<size_t>(file.tellg());
+    if (size == 0) return nullptr;
+    auto buffer = std::make_unique<uint8_t[]>(size);
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(buffer.get()), size)) return nullptr;
+    mappings.push_back({buffer.release(), size});
+#else
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+    size = info.st_size;
+    void *address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (address == MAP_FAILED) return nullptr;
+    mappings.push_back({address, size});
+#endif
+    return static_cast<const uint8_t*>(mappings.back().address);
+}
+
+void Chip8RomStore::unmap_last() {
+    const Mapping &mapping = mappings.back();
+#ifdef _WIN32
+    delete[] static_cast<uint8_t*>(mapping.address);
+#else
+    munmap(mapping.address, mapping.size);
+#endif
+    mappings.pop_back();
+}
+
+bool Chip8RomStore::insert(const std::string &name, const uint8_t *data, size_t size, uint64_t hash,
+                           Chip8Variant variant) {
+    const auto found = index.find(hash);
+    if (found != index.end()) {
+        const Chip8Rom &existing = roms[found->second];
+        if (existing.size == size && memcmp(existing.data, data, size) == 0) return false;
+    } else {
+        index.emplace(hash, roms.size());
+    }
+    // A hash collision keeps both ROMs, find() returns the first one
+    roms.push_back({name, data, size, hash, variant});
+    return true;
+}
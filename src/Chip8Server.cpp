@@ -0,0 +1,401 @@
+#include "../include/Chip8Server.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// The request header, the commands follow it
+#define CHIP8_SERVER_REQUEST_HEADER_SIZE offsetof(Chip8ServerRequest, commands)
+
+static_assert(sizeof(Chip8ServerCommand) == 8 && sizeof(Chip8ServerReply) == 16, "Wire structs are packed by hand");
+
+namespace {
+    bool socket_address(const std::string &path, sockaddr_un &address) {
+        if (path.empty() || path.size() >= sizeof(address.sun_path)) return false;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, path.c_str(), path.size());
+        return true;
+    }
+}
+
+Chip8Server::~Chip8Server() {
+    close();
+}
+
+bool Chip8Server::open(const std::string &socket_path) {
+    close();
+    sockaddr_un address;
+    if (!socket_address(socket_path, address)) return false;
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (listen_fd < 0 || epoll_fd < 0 || wake_fd < 0) {
+        close();
+        return false;
+    }
+    // A server that died leaves its socket file behind, which would fail the bind. Anything else at the path is
+    // left alone, and the bind fails on it
+    struct stat existing;
+    if (lstat(socket_path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode)) unlink(socket_path.c_str());
+    if (bind(listen_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+        || listen(listen_fd, SOMAXCONN) != 0) {
+        close();
+        return false;
+    }
+    path = socket_path;
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = listen_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+    event.data.fd = wake_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+    return true;
+}
+
+void Chip8Server::close() {
+    while (!sessions.empty())
+        close_session(*sessions.begin()->second);
+    if (listen_fd >= 0) ::close(listen_fd);
+    if (epoll_fd >= 0) ::close(epoll_fd);
+    if (wake_fd >= 0) ::close(wake_fd);
+    if (!path.empty()) unlink(path.c_str());
+    listen_fd = epoll_fd = wake_fd = -1;
+    path.clear();
+}
+
+void Chip8Server::run() {
+    epoll_event events[CHIP8_SERVER_MAX_EVENTS];
+    for (;;) {
+        const int count = epoll_wait(epoll_fd, events, CHIP8_SERVER_MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        for (int i = 0; i < count; ++i) {
+            const int fd = events[i].data.fd;
+            if (fd == wake_fd) {
+                uint64_t value;
+                if (read(wake_fd, &value, sizeof(value)) < 0) {} // Only drained, run() is over either way
+                return;
+            }
+            if (fd == listen_fd) {
+                accept_sessions();
+                continue;
+            }
+            // Closed by an earlier event of this batch
+            const auto found = sessions.find(fd);
+            if (found == sessions.end()) continue;
+            Session &session = *found->second;
+            if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                close_session(session);
+            } else if (session.has_pending) {
+                // Requests stay unread until the pending reply is out, so replies can neither be dropped nor reordered
+                if ((events[i].events & EPOLLOUT) && send_reply(session, session.pending) && !session.has_pending)
+                    read_requests(session);
+            } else {
+                read_requests(session);
+            }
+        }
+    }
+}
+
+void Chip8Server::stop() {
+    const uint64_t value = 1;
+    if (write(wake_fd, &value, sizeof(value)) < 0) {} // Only fails if already woken
+}
+
+size_t Chip8Server::get_sessions() const {
+    return sessions.size();
+}
+
+uint64_t Chip8Server::get_accepted() const {
+    return accepted;
+}
+
+uint64_t Chip8Server::get_requests() const {
+    return requests;
+}
+
+void Chip8Server::accept_sessions() {
+    for (;;) {
+        const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return; // EAGAIN once the backlog is empty, anything else drops that one connection attempt
+
+        // The region lives in a memfd the client maps too, the server's mapping outlives the descriptor
+        const int memfd = memfd_create("chip8_session", MFD_CLOEXEC);
+        void *mapping = MAP_FAILED;
+        if (memfd >= 0 && ftruncate(memfd, sizeof(Chip8SharedRegion)) == 0)
+            mapping = mmap(nullptr, sizeof(Chip8SharedRegion), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+        if (mapping == MAP_FAILED) {
+            if (memfd >= 0) ::close(memfd);
+            ::close(fd);
+            continue;
+        }
+
+        Chip8ServerHello hello = {};
+        memcpy(hello.magic, CHIP8_SERVER_MAGIC, 4);
+        hello.version = CHIP8_SERVER_VERSION;
+        hello.region_size = sizeof(Chip8SharedRegion);
+        iovec data = {&hello, sizeof(hello)};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+        msghdr message = {};
+        message.msg_iov = &data;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(header), &memfd, sizeof(int));
+        // A fresh socket always has room for the hello
+        const bool sent = sendmsg(fd, &message, MSG_NOSIGNAL) == sizeof(hello);
+        ::close(memfd);
+        if (!sent) {
+            munmap(mapping, sizeof(Chip8SharedRegion));
+            ::close(fd);
+            continue;
+        }
+
+        auto session = std::make_unique<Session>();
+        session->fd = fd;
+        session->region = static_cast<Chip8SharedRegion*>(mapping);
+        session->chip8 = std::make_unique<Chip8>();
+        session->restore_buffer = std::make_unique<uint8_t[]>(Chip8::snapshot_size());
+        publish(*session);
+
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        sessions.emplace(fd, std::move(session));
+        accepted++;
+    }
+}
+
+void Chip8Server::close_session(Session &session) {
+    const int fd = session.fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    munmap(session.region, sizeof(Chip8SharedRegion));
+    ::close(fd);
+    sessions.erase(fd);
+}
+
+void Chip8Server::read_requests(Session &session) {
+    // Level triggered: a session with more queued is picked up again by the next epoll_wait, after the others
+    for (int i = 0; i < CHIP8_SERVER_READ_BURST; ++i) {
+        Chip8ServerRequest request;
+        // MSG_TRUNC makes an oversized message report its real length rather than pass as a full request
+        const ssize_t length = recv(session.fd, &request, sizeof(request), MSG_TRUNC);
+        if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+        if (length <= 0) {
+            close_session(session);
+            return;
+        }
+        Chip8ServerReply reply = {};
+        execute(session, request, length, reply);
+        requests++;
+        if (!send_reply(session, reply) || session.has_pending) return;
+    }
+}
+
+void Chip8Server::execute(Session &session, const Chip8ServerRequest &request, size_t length, Chip8ServerReply &reply) {
+    Chip8 &chip8 = *session.chip8;
+    Chip8SharedRegion &region = *session.region;
+    reply.status = Chip8ServerStatus::Ok;
+    if (length >= sizeof(request.sequence)) reply.sequence = request.sequence;
+    if (length < CHIP8_SERVER_REQUEST_HEADER_SIZE || length > sizeof(request)
+        || (length - CHIP8_SERVER_REQUEST_HEADER_SIZE) % sizeof(Chip8ServerCommand) != 0
+        || request.count != (length - CHIP8_SERVER_REQUEST_HEADER_SIZE) / sizeof(Chip8ServerCommand)) {
+        reply.status = Chip8ServerStatus::BadRequest;
+        return;
+    }
+    chip8.take_dirty_rows();
+
+    for (uint32_t i = 0; i < request.count && reply.status == Chip8ServerStatus::Ok; ++i) {
+        const Chip8ServerCommand &command = request.commands[i];
+        switch (command.command) {
+            case Chip8Command::LoadRom:
+                if (command.value == 0 || command.value > Chip8::max_program_size) {
+                    reply.status = Chip8ServerStatus::InvalidRom;
+                    break;
+                }
+                chip8.initialize();
+                chip8.load_program(region.rom, command.value);
+                break;
+            case Chip8Command::SetKey:
+                if (command.key >= CHIP8_KEY_SIZE) {
+                    reply.status = Chip8ServerStatus::BadRequest;
+                    break;
+                }
+                chip8.set_input_key(command.key, command.pressed != 0);
+                break;
+            case Chip8Command::StepFrames: {
+                if (command.value > CHIP8_SERVER_MAX_FRAMES) {
+                    reply.status = Chip8ServerStatus::TooManyFrames;
+                    break;
+                }
+                // Same as Chip8Engine: no input arrives within one command, so an idle VM stays idle
+                uint64_t instructions = 0;
+                for (uint32_t frames = 0; frames < command.value;) {
+                    instructions += chip8.run_frame();
+                    frames++;
+                    uint64_t skipped;
+                    if (chip8.skip_idle_frames(command.value - frames, &skipped)) {
+                        instructions += skipped;
+                        frames = command.value;
+                    }
+                }
+                reply.frames += command.value;
+                reply.instructions += instructions;
+                break;
+            }
+            case Chip8Command::Reset:
+                chip8.reset_program();
+                break;
+            case Chip8Command::Snapshot:
+                region.snapshot_size = chip8.snapshot(region.snapshot, sizeof(region.snapshot));
+                break;
+            case Chip8Command::Restore:
+                if (command.value > sizeof(region.snapshot)) {
+                    reply.status = Chip8ServerStatus::InvalidSnapshot;
+                    break;
+                }
+                memcpy(session.restore_buffer.get(), region.snapshot, command.value);
+                if (!chip8.restore(session.restore_buffer.get(), command.value))
+                    reply.status = Chip8ServerStatus::InvalidSnapshot;
+                break;
+            case Chip8Command::Seed:
+                chip8.seed(command.value);
+                break;
+            default:
+                reply.status = Chip8ServerStatus::BadRequest;
+                break;
+        }
+        if (reply.status != Chip8ServerStatus::Ok) reply.failed = i;
+    }
+    publish(session);
+}
+
+bool Chip8Server::send_reply(Session &session, const Chip8ServerReply &reply) {
+    const ssize_t sent = send(session.fd, &reply, sizeof(reply), MSG_NOSIGNAL | MSG_DONTWAIT);
+    epoll_event event = {};
+    event.data.fd = session.fd;
+    if (sent == sizeof(reply)) {
+        if (session.has_pending) {
+            session.has_pending = false;
+            event.events = EPOLLIN;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, session.fd, &event);
+        }
+        return true;
+    }
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        // The client is not reading its replies, stop reading its requests until it does. Only the pending reply
+        // itself is ever sent while one is pending, it stays queued
+        if (!session.has_pending) {
+            session.pending = reply;
+            session.has_pending = true;
+            event.events = EPOLLOUT;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, session.fd, &event);
+        }
+        return true;
+    }
+    close_session(session);
+    return false;
+}
+
+void Chip8Server::publish(Session &session) {
+    Chip8 &chip8 = *session.chip8;
+    Chip8SharedRegion &region = *session.region;
+    memcpy(region.gfx, chip8.get_gfx_packed(), sizeof(region.gfx));
+    region.dirty_rows = chip8.take_dirty_rows();
+    memcpy(region.registers_v, chip8.get_registers(), sizeof(region.registers_v));
+    region.pc = chip8.get_pc();
+    region.idx_register = chip8.get_idx_register();
+    region.sp = chip8.get_sp();
+    region.input_keys = chip8.get_input_keys();
+    region.delay_timer = chip8.get_delay_timer();
+    region.sound_timer = chip8.get_sound_timer();
+    region.halt = chip8.get_halt();
+    region.idle = chip8.get_idle();
+}
+
+Chip8ServerClient::~Chip8ServerClient() {
+    close();
+}
+
+bool Chip8ServerClient::connect(const std::string &path) {
+    close();
+    sockaddr_un address;
+    if (!socket_address(path, address)) return false;
+    fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        close();
+        return false;
+    }
+
+    Chip8ServerHello hello = {};
+    iovec data = {&hello, sizeof(hello)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr message = {};
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    const ssize_t length = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+    const cmsghdr *header = CMSG_FIRSTHDR(&message);
+    if (length != sizeof(hello) || header == nullptr || header->cmsg_type != SCM_RIGHTS) {
+        close();
+        return false;
+    }
+    int memfd;
+    memcpy(&memfd, CMSG_DATA(header), sizeof(int));
+    void *mapping = MAP_FAILED;
+    if (memcmp(hello.magic, CHIP8_SERVER_MAGIC, 4) == 0 && hello.version == CHIP8_SERVER_VERSION
+        && hello.region_size == sizeof(Chip8SharedRegion))
+        mapping = mmap(nullptr, sizeof(Chip8SharedRegion), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    ::close(memfd);
+    if (mapping == MAP_FAILED) {
+        close();
+        return false;
+    }
+    region = static_cast<Chip8SharedRegion*>(mapping);
+    return true;
+}
+
+void Chip8ServerClient::close() {
+    if (region != nullptr) munmap(region, sizeof(Chip8SharedRegion));
+    if (fd >= 0) ::close(fd);
+    region = nullptr;
+    fd = -1;
+}
+
+bool Chip8ServerClient::call(const Chip8ServerCommand *commands, uint32_t count, Chip8ServerReply &reply) {
+    if (fd < 0 || count > CHIP8_SERVER_MAX_COMMANDS) return false;
+    Chip8ServerRequest request;
+    request.sequence = ++sequence;
+    request.count = count;
+    memcpy(request.commands, commands, count * sizeof(Chip8ServerCommand));
+    const size_t length = CHIP8_SERVER_REQUEST_HEADER_SIZE + count * sizeof(Chip8ServerCommand);
+    if (send(fd, &request, length, MSG_NOSIGNAL) != static_cast<ssize_t>(length)) return false;
+    ssize_t received;
+    do {
+        received = recv(fd, &reply, sizeof(reply), 0);
+    } while (received < 0 && errno == EINTR);
+    return received == sizeof(reply) && reply.sequence == sequence;
+}
+
+Chip8SharedRegion* Chip8ServerClient::get_region() const {
+    return region;
+}
@@ -0,0 +1,176 @@
+#include "../include/Chip8Trace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+namespace {
+    // Everything before the records: header, variant to instructions, V0-VF and the stack
+    constexpr size_t fixed_size = CHIP8_TRACE_HEADER_SIZE + 18 + CHIP8_REGISTER_COUNT + CHIP8_STACK_SIZE * sizeof(uint16_t);
+
+    std::string hex(uint32_t value, int digits) {
+        char text[16];
+        snprintf(text, sizeof(text), "0x%0*X", digits, value);
+        return text;
+    }
+}
+
+bool Chip8Trace::write(const std::string &path, const Chip8TraceDump &dump) {
+    std::vector<uint8_t> data(fixed_size + size_t(dump.count) * CHIP8_TRACE_RECORD_SIZE);
+    uint8_t *out = data.data();
+    auto put = [&out](const void *field, size_t size) {
+        memcpy(out, field, size);
+        out += size;
+    };
+    const uint16_t version = CHIP8_TRACE_VERSION;
+    const uint16_t reserved = 0;
+    const uint32_t size = data.size();
+
+    put(CHIP8_TRACE_MAGIC, 4);
+    put(&version, sizeof(version));
+    put(&reserved, sizeof(reserved));
+    put(&size, sizeof(size));
+    put(&dump.variant, sizeof(dump.variant));
+    put(&dump.fault, sizeof(dump.fault));
+    put(&dump.pc, sizeof(dump.pc));
+    put(&dump.sp, sizeof(dump.sp));
+    put(&dump.count, sizeof(dump.count));
+    put(&dump.instructions, sizeof(dump.instructions));
+    put(dump.registers_v, sizeof(dump.registers_v));
+    put(dump.stack, sizeof(dump.stack));
+    for (uint32_t i = 0; i < dump.count; ++i) {
+        const Chip8TraceRecord &record = dump.records[i];
+        put(&record.pc, sizeof(record.pc));
+        put(&record.opcode, sizeof(record.opcode));
+        put(&record.idx_register, sizeof(record.idx_register));
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    return static_cast<bool>(file);
+}
+
+bool Chip8Trace::read(const std::string &path, Chip8TraceDump &dump) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+    const std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (data.size() < fixed_size || memcmp(data.data(), CHIP8_TRACE_MAGIC, 4) != 0) return false;
+    uint16_t version;
+    uint32_t size;
+    memcpy(&version, data.data() + 4, sizeof(version));
+    memcpy(&size, data.data() + 8, sizeof(size));
+    if (version != CHIP8_TRACE_VERSION || size != data.size()) return false;
+
+    const uint8_t *in = data.data() + CHIP8_TRACE_HEADER_SIZE;
+    auto get = [&in](void *field, size_t field_size) {
+        memcpy(field, in, field_size);
+        in += field_size;
+    };
+    get(&dump.variant, sizeof(dump.variant));
+    get(&dump.fault, sizeof(dump.fault));
+    get(&dump.pc, sizeof(dump.pc));
+    get(&dump.sp, sizeof(dump.sp));
+    get(&dump.count, sizeof(dump.count));
+    get(&dump.instructions, sizeof(dump.instructions));
+    get(dump.registers_v, sizeof(dump.registers_v));
+    get(dump.stack, sizeof(dump.stack));
+    if (dump.variant > Chip8Variant::XoChip || dump.fault >= Chip8Fault::Count || dump.count > CHIP8_TRACE_SIZE
+        || size != fixed_size + size_t(dump.count) * CHIP8_TRACE_RECORD_SIZE) return false;
+    for (uint32_t i = 0; i < dump.count; ++i) {
+        Chip8TraceRecord &record = dump.records[i];
+        get(&record.pc, sizeof(record.pc));
+        get(&record.opcode, sizeof(record.opcode));
+        get(&record.idx_register, sizeof(record.idx_register));
+    }
+    return true;
+}
+
+// Same groups as Chip8::decode_at, so anything shown as DW stalled the interpreter
+std::string Chip8Trace::disassemble(uint16_t opcode, Chip8Variant variant) {
+    const bool super_chip = variant == Chip8Variant::SuperChip || variant == Chip8Variant::XoChip;
+    const bool xo_chip = variant == Chip8Variant::XoChip;
+    const std::string x = "V" + std::string(1, "0123456789ABCDEF"[(opcode & 0x0F00) >> 8]);
+    const std::string y = "V" + std::string(1, "0123456789ABCDEF"[(opcode & 0x00F0) >> 4]);
+    const std::string n = std::to_string(opcode & 0x000F);
+    const std::string nn = hex(opcode & 0x00FF, 2);
+    const std::string nnn = hex(opcode & 0x0FFF, 3);
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if (super_chip && (opcode & 0xFFF0) == 0x00C0) return "SCD " + n;
+            if (xo_chip && (opcode & 0xFFF0) == 0x00D0) return "SCU " + n;
+            if (super_chip && opcode == 0x00FB) return "SCR";
+            if (super_chip && opcode == 0x00FC) return "SCL";
+            if (super_chip && opcode == 0x00FD) return "EXIT";
+            if (super_chip && opcode == 0x00FE) return "LOW";
+            if (super_chip && opcode == 0x00FF) return "HIGH";
+            if (opcode == 0x00E0) return "CLS";
+            if (opcode == 0x00EE) return "RET";
+            break;
+        case 0x1000: return "JP " + nnn;
+        case 0x2000: return "CALL " + nnn;
+        case 0x3000: return "SE " + x + ", " + nn;
+        case 0x4000: return "SNE " + x + ", " + nn;
+        case 0x5000:
+            if (xo_chip && (opcode & 0x000F) == 0x2) return "SAVE " + x + " - " + y;
+            if (xo_chip && (opcode & 0x000F) == 0x3) return "LOAD " + x + " - " + y;
+            return "SE " + x + ", " + y;
+        case 0x6000: return "LD " + x + ", " + nn;
+        case 0x7000: return "ADD " + x + ", " + nn;
+        case 0x8000:
+            switch (opcode & 0x000F) {
+                case 0x0: return "LD " + x + ", " + y;
+                case 0x1: return "OR " + x + ", " + y;
+                case 0x2: return "AND " + x + ", " + y;
+                case 0x3: return "XOR " + x + ", " + y;
+                case 0x4: return "ADD " + x + ", " + y;
+                case 0x5: return "SUB " + x + ", " + y;
+                case 0x6: return "SHR " + x;
+                case 0x7: return "SUBN " + x + ", " + y;
+                case 0xE: return "SHL " + x;
+            }
+            break;
+        case 0x9000: return "SNE " + x + ", " + y;
+        case 0xA000: return "LD I, " + nnn;
+        case 0xB000: return (variant == Chip8Variant::SuperChip ? "JP " + x + ", " : "JP V0, ") + nnn;
+        case 0xC000: return "RND " + x + ", " + nn;
+        case 0xD000: return "DRW " + x + ", " + y + ", " + n;
+        case 0xE000:
+            if ((opcode & 0x00FF) == 0x9E) return "SKP " + x;
+            if ((opcode & 0x00FF) == 0xA1) return "SKNP " + x;
+            break;
+        case 0xF000:
+            if (xo_chip && opcode == 0xF000) return "LD I, long";
+            if (xo_chip && opcode == 0xF002) return "AUDIO";
+            switch (opcode & 0x00FF) {
+                case 0x01: if (xo_chip) return "PLANE " + std::to_string((opcode & 0x0F00) >> 8); break;
+                case 0x3A: if (xo_chip) return "PITCH " + x; break;
+                case 0x30: if (super_chip) return "LD HF, " + x; break;
+                case 0x75: if (super_chip) return "LD R, " + x; break;
+                case 0x85: if (super_chip) return "LD " + x + ", R"; break;
+                case 0x07: return "LD " + x + ", DT";
+                case 0x0A: return "LD " + x + ", K";
+                case 0x15: return "LD DT, " + x;
+                case 0x18: return "LD ST, " + x;
+                case 0x1E: return "ADD I, " + x;
+                case 0x29: return "LD F, " + x;
+                case 0x33: return "LD B, " + x;
+                case 0x55: return "LD [I], " + x;
+                case 0x65: return "LD " + x + ", [I]";
+            }
+            break;
+    }
+    return "DW " + hex(opcode, 4);
+}
+
+const char* Chip8Trace::fault_name(Chip8Fault fault) {
+    switch (fault) {
+        case Chip8Fault::None: return "none";
+        case Chip8Fault::UnknownOpcode: return "unknown opcode";
+        case Chip8Fault::StackOverflow: return "stack overflow";
+        case Chip8Fault::StackUnderflow: return "stack underflow";
+        case Chip8Fault::AddressOverflow: return "address overflow";
+        default: return "?";
+    }
+}
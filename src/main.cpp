@@ -1,45 +1,136 @@
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
 
 #include "../include/Chip8.h"
+#include "../include/Chip8Audio.h"
+#include "../include/Chip8Recorder.h"
+#include "../include/Chip8Render.h"
+#include "../include/Chip8Rewind.h"
+#include "../include/Chip8RomStore.h"
+#include "../include/Chip8SpscQueue.h"
+#include "../include/Chip8Trace.h"
+#include "../include/Chip8TripleBuffer.h"
 #include <iostream>
 #include <SDL.h>
 
 #define CPU_CYCLE_HZ 1000
-#define TIMER_HZ 60
+#define MAX_LATE_FRAMES 2 // Frames the loop may fall behind and still catch up, beyond that the backlog is dropped
+#define AUDIO_SAMPLE_RATE 48000
+#define AUDIO_BUFFER_SAMPLES 256 // About 5 ms per callback
+#define KEY_QUEUE_SIZE 64 // Key events on their way to the emulation thread
+#define DEFAULT_TRACE_PATH "chip8_fault.c8tr"
 
 // SDL graphics and input initialization
 SDL_Window *window = nullptr;
 SDL_Renderer *renderer = nullptr;
 SDL_Texture *texture = nullptr;
-constexpr int WINDOW_WIDTH = 64;
-constexpr int WINDOW_HEIGHT = 32;
+SDL_AudioDeviceID audio_device = 0;
+Chip8Audio audio(AUDIO_SAMPLE_RATE, AUDIO_BUFFER_SAMPLES);
+constexpr int WINDOW_WIDTH = 640;
+constexpr int WINDOW_HEIGHT = 320;
 
-void initializeSDL() {
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+// How the display is turned into texels, from the command line
+struct DisplayOptions {
+    int scale = 1; // Done on the CPU, above 1 the window is sized to the scaled display
+    uint32_t palette[4] = {Chip8Renderer::default_palette[0], Chip8Renderer::default_palette[1],
+                           Chip8Renderer::default_palette[2], Chip8Renderer::default_palette[3]};
+    uint8_t persistence = 0; // Phosphor, see Chip8Renderer::set_persistence()
+};
+
+// The emulation thread runs the machine and publishes frames, the main thread (SDL wants it there) polls input
+// and presents, so neither vsync waits nor compositor hiccups reach the emulation timing
+std::atomic<bool> running{true};
+// Held with Backspace, steps back through the recorded frames instead of running
+std::atomic<bool> rewinding{false};
+
+struct KeyEvent {
+    uint8_t key;
+    bool is_pressed;
+};
+Chip8SpscQueue<KeyEvent, KEY_QUEUE_SIZE> key_events;
+
+// A completed frame, handed from the emulation thread to the render thread
+template <typename Machine>
+struct Frame {
+    uint64_t gfx[Machine::display_planes * Machine::display_height * Machine::words_per_row];
+    double emulation_fps; // Measured over the last second
+    double emulation_ms; // Mean time spent emulating one frame, sleeping not included
+};
+
+void audioCallback(void *userdata, Uint8 *stream, int length) {
+    static_cast<Chip8Audio*>(userdata)->render(reinterpret_cast<int16_t*>(stream), length / sizeof(int16_t));
+}
+
+// The texture has one texel per pixel of the display the renderer outputs. Unscaled displays are stretched to the
+// default window size by the GPU, scaled ones get a window of their own size
+void initializeSDL(int texture_width, int texture_height, bool scaled) {
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
         std::cout << "SDL Initialization failed: " << SDL_GetError() << std::endl;
         exit(1);
     }
-    window = SDL_CreateWindow("Chip-8 Emulator", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WINDOW_WIDTH * 10, WINDOW_HEIGHT* 10, SDL_WINDOW_SHOWN);
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
-    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, WINDOW_WIDTH, WINDOW_HEIGHT);
+    window = SDL_CreateWindow("Chip-8 Emulator", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, scaled ? texture_width : WINDOW_WIDTH,
+                              scaled ? texture_height : WINDOW_HEIGHT, SDL_WINDOW_SHOWN);
+    // Presents are paced by the display refresh
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, texture_width, texture_height);
+
+    // No changes allowed, SDL converts if the device wants another format, so render() always gets what it expects
+    SDL_AudioSpec wanted = {};
+    wanted.freq = AUDIO_SAMPLE_RATE;
+    wanted.format = AUDIO_S16SYS;
+    wanted.channels = 1;
+    wanted.samples = AUDIO_BUFFER_SAMPLES;
+    wanted.callback = audioCallback;
+    wanted.userdata = &audio;
+    SDL_AudioSpec obtained;
+    audio_device = SDL_OpenAudioDevice(nullptr, 0, &wanted, &obtained, 0);
+    if (audio_device == 0) std::cout << "No audio: " << SDL_GetError() << std::endl;
+    else SDL_PauseAudioDevice(audio_device, 0);
 }
 
-void renderSDL(const uint8_t* gfx) {
-    uint32_t pixel_buffer[WINDOW_HEIGHT][WINDOW_WIDTH];
+// Renders the rows set in dirty_rows, and those still fading, straight into the locked texture and presents. Does
+// nothing if there are none
+template <typename Machine>
+void renderSDL(Chip8Renderer &display, const uint64_t* gfx, uint64_t dirty_rows) {
+    dirty_rows |= display.get_fading_rows();
+    if (dirty_rows == 0) return;
+    constexpr int height = Machine::display_height;
+    const int scale = display.get_scale();
 
-    for (int y = 0; y < WINDOW_HEIGHT; ++y) {
-        for (int x = 0; x < WINDOW_WIDTH; ++x) {
-            uint8_t pixel_value = gfx[y * WINDOW_WIDTH + x];
-            pixel_buffer[y][x] = (pixel_value == 1) ? 0xFFFFFFFF : 0x000000FF;
+    int y = 0;
+    while (y < height) {
+        if ((dirty_rows & (1ull << y)) == 0) {
+            ++y;
+            continue;
         }
+        // Lock each run of consecutive dirty rows once
+        const int first_row = y;
+        while (y < height && (dirty_rows & (1ull << y)) != 0) ++y;
+        const SDL_Rect rows = {0, first_row * scale, display.get_width(), (y - first_row) * scale};
+        void *pixels;
+        int pitch;
+        if (SDL_LockTexture(texture, &rows, &pixels, &pitch) != 0) continue;
+        display.render(gfx, first_row, y, pixels, pitch);
+        SDL_UnlockTexture(texture);
     }
 
-    SDL_UpdateTexture(texture, nullptr, pixel_buffer, WINDOW_WIDTH * sizeof(uint32_t));
     SDL_RenderClear(renderer);
     SDL_RenderCopy(renderer, texture, nullptr, nullptr);
     SDL_RenderPresent(renderer);
 }
 
+void sendKey(uint8_t key, bool is_pressed) {
+    // Only fills up if the emulation thread stalls, and a lost release would leave the key held
+    while (!key_events.push({key, is_pressed}))
+        std::this_thread::yield();
+}
 
 /**
 * The original keypad:
@@ -53,77 +144,284 @@ void renderSDL(const uint8_t* gfx) {
 * QWER
 * ASDF
 * ZXCV
+*
+* Hold Backspace to rewind.
  */
-void handleSDLEvents(Chip8 &chip8) {
+void handleSDLEvents() {
     SDL_Event event;
     while (SDL_PollEvent(&event)) {
-        if (event.type == SDL_QUIT) exit(0);
+        if (event.type == SDL_QUIT) running = false;
         if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
             bool is_pressed = event.type == SDL_KEYDOWN;
             switch (event.key.keysym.sym) {
                 // 1st row
-                case SDLK_1: chip8.set_input_key(0x1, is_pressed); break;
-                case SDLK_2: chip8.set_input_key(0x2, is_pressed); break;
-                case SDLK_3: chip8.set_input_key(0x3, is_pressed); break;
-                case SDLK_4: chip8.set_input_key(0xC, is_pressed); break;
+                case SDLK_1: sendKey(0x1, is_pressed); break;
+                case SDLK_2: sendKey(0x2, is_pressed); break;
+                case SDLK_3: sendKey(0x3, is_pressed); break;
+                case SDLK_4: sendKey(0xC, is_pressed); break;
                 // 2nd row
-                case SDLK_q: chip8.set_input_key(0x4, is_pressed); break;
-                case SDLK_w: chip8.set_input_key(0x5, is_pressed); break;
-                case SDLK_e: chip8.set_input_key(0x6, is_pressed); break;
-                case SDLK_r: chip8.set_input_key(0xD, is_pressed); break;
+                case SDLK_q: sendKey(0x4, is_pressed); break;
+                case SDLK_w: sendKey(0x5, is_pressed); break;
+                case SDLK_e: sendKey(0x6, is_pressed); break;
+                case SDLK_r: sendKey(0xD, is_pressed); break;
                 // 3rd row
-                case SDLK_a: chip8.set_input_key(0x7, is_pressed); break;
-                case SDLK_s: chip8.set_input_key(0x8, is_pressed); break;
-                case SDLK_d: chip8.set_input_key(0x9, is_pressed); break;
-                case SDLK_f: chip8.set_input_key(0xE, is_pressed); break;
+                case SDLK_a: sendKey(0x7, is_pressed); break;
+                case SDLK_s: sendKey(0x8, is_pressed); break;
+                case SDLK_d: sendKey(0x9, is_pressed); break;
+                case SDLK_f: sendKey(0xE, is_pressed); break;
                 // 4th row
-                case SDLK_z: chip8.set_input_key(0xA, is_pressed); break;
-                case SDLK_x: chip8.set_input_key(0x0, is_pressed); break;
-                case SDLK_c: chip8.set_input_key(0xB, is_pressed); break;
-                case SDLK_v: chip8.set_input_key(0xF, is_pressed); break;
+                case SDLK_z: sendKey(0xA, is_pressed); break;
+                case SDLK_x: sendKey(0x0, is_pressed); break;
+                case SDLK_c: sendKey(0xB, is_pressed); break;
+                case SDLK_v: sendKey(0xF, is_pressed); break;
+                // Rewind
+                case SDLK_BACKSPACE: rewinding = is_pressed; break;
             }
         }
     }
 }
 
-Chip8 chip8;
+// Emulation thread: runs a frame every 1/60 s and publishes it, until the window is closed
+template <typename Machine>
+void emulate(Machine &chip8, Chip8TripleBuffer<Frame<Machine>> &frames, Chip8Recorder &recorder, const std::string &trace_path) {
+    Chip8Rewind rewinder;
+    auto fault_trace = std::make_unique<Chip8TraceDump>();
 
+    // Frame deadlines advance by a fixed period from where they were, not from when we woke up, so sleep
+    // overshoot does not accumulate into drift
+    using Clock = std::chrono::steady_clock;
+    constexpr auto frame_period = std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(1000000000 / CHIP8_TIMER_HZ));
+    auto next_frame = Clock::now();
+    uint64_t frame = 0;
+    // Statistics for the window title, restarted every second
+    auto stats_begin = next_frame;
+    Clock::duration busy{0};
+    uint64_t stats_frames = 0;
+    double emulation_fps = 0;
+    double emulation_ms = 0;
 
-int main(int argc, char* argv[]) {
+    while (running) {
+        const auto begin = Clock::now();
+        while (const KeyEvent *event = key_events.front()) {
+            chip8.set_input_key(event->key, event->is_pressed);
+            key_events.pop();
+        }
+        if (rewinding) {
+            // One recorded frame per frame, so rewinding plays back at normal speed
+            rewinder.step_back(chip8);
+        } else {
+            // A ROM spinning until a key event needs no emulation at all, only its timers tick
+            if (!chip8.skip_idle_frames(1)) chip8.run_frame();
+            rewinder.record(chip8);
+        }
+        audio.update(chip8, frame++);
+        recorder.record(chip8);
+        // Faults are rare, writing the trace here costs the one frame it happens in
+        if (chip8.take_fault_trace(*fault_trace)) {
+            std::cout << "ROM fault: " << Chip8Trace::fault_name(fault_trace->fault) << " at 0x" << std::hex << fault_trace->pc
+                      << std::dec;
+            if (Chip8Trace::write(trace_path, *fault_trace)) std::cout << ", trace written to " << trace_path << std::endl;
+            else std::cout << ", failed to write trace " << trace_path << std::endl;
+        }
+        const auto end = Clock::now();
+        busy += end - begin;
+        stats_frames++;
+
+        bool stats_changed = false;
+        if (end - stats_begin >= std::chrono::seconds(1)) {
+            const double seconds = std::chrono::duration<double>(end - stats_begin).count();
+            emulation_fps = stats_frames / seconds;
+            emulation_ms = std::chrono::duration<double, std::milli>(busy).count() / stats_frames;
+            stats_begin = end;
+            busy = Clock::duration::zero();
+            stats_frames = 0;
+            stats_changed = true;
+        }
+        // Unchanged frames are not handed over, the render thread keeps showing the last one
+        if (chip8.take_dirty_rows() != 0 || stats_changed) {
+            Frame<Machine> &out = frames.back();
+            memcpy(out.gfx, chip8.get_gfx_packed(), sizeof(out.gfx));
+            out.emulation_fps = emulation_fps;
+            out.emulation_ms = emulation_ms;
+            frames.publish();
+        }
 
+        next_frame += frame_period;
+        const auto now = Clock::now();
+        if (now - next_frame > frame_period * MAX_LATE_FRAMES) {
+            // Too far behind (process suspended...), skip ahead rather than fast-forwarding
+            next_frame = now;
+        } else if (next_frame > now) {
+            std::this_thread::sleep_until(next_frame);
+        }
+        // Otherwise slightly late, run the next frame right away to catch up
+    }
+}
+
+// Runs the ROM on the machine variant it was written for, until the window is closed
+template <typename Machine>
+int runEmulator(const Chip8Rom &rom, const std::string &record_path, const std::string &trace_path, Chip8Timing timing,
+                const DisplayOptions &options) {
+    // On the heap, the XO-CHIP machine carries 64 KB of memory plus its decode cache
+    auto machine = std::make_unique<Machine>();
+    Machine &chip8 = *machine;
+
+    // Games should play out differently on every launch, the core itself is deterministic
+    chip8.seed(std::random_device()());
     chip8.initialize();
-    if(argc < 2)
-    {
-        std::cout << "Usage: chip8_emulator chip8RomFile.(ch8|c8)" << std::endl << std::endl;
+    if (!chip8.load_program(rom.data, rom.size)) {
+        std::cout << "ROM " << rom.name << " does not fit in memory" << std::endl;
         return 1;
     }
-    chip8.load_program(argv[1]);
-    initializeSDL();
-
-    auto cpuCycleBeginTime = std::chrono::high_resolution_clock::now();
-    auto timerBeginTime = std::chrono::high_resolution_clock::now();
-    constexpr float cpu_cycle_period_micro = (1000.0f / CPU_CYCLE_HZ * 1000);
-    constexpr float timer_period_micro = (1000.0f / TIMER_HZ * 1000);
-    while (true) {
-        auto now = std::chrono::high_resolution_clock::now();
-        auto elapsed_cpu_time = std::chrono::duration_cast<std::chrono::microseconds>(now - cpuCycleBeginTime).count();
-        auto elapsed_timer_time = std::chrono::duration_cast<std::chrono::microseconds>(now-timerBeginTime).count();
-
-        if (elapsed_cpu_time >= cpu_cycle_period_micro) {
-            chip8.run();
-            cpuCycleBeginTime = now;
-        }
+    // Every frame shown, rewinds included, goes to the recording
+    Chip8Recorder recorder;
+    if (!record_path.empty() && !recorder.open<Machine>(record_path)) {
+        std::cout << "Failed to create recording " << record_path << std::endl;
+        return 1;
+    }
+    Chip8Renderer display(Machine::display_width, Machine::display_height, Machine::display_planes, options.scale);
+    display.set_palette(options.palette);
+    display.set_persistence(options.persistence);
+    initializeSDL(display.get_width(), display.get_height(), options.scale > 1);
+
+    chip8.set_timing(timing);
+    if (timing == Chip8Timing::Instructions) chip8.set_cpu_hz(CPU_CYCLE_HZ);
 
-        if (elapsed_timer_time >= timer_period_micro) {
-            handleSDLEvents(chip8);
-            chip8.update_timers();
-            timerBeginTime = now;
+    // Three frames of display state, one each for the two threads and one in between
+    auto frames = std::make_unique<Chip8TripleBuffer<Frame<Machine>>>();
+    std::thread emulation(emulate<Machine>, std::ref(chip8), std::ref(*frames), std::ref(recorder), std::cref(trace_path));
+
+    using Clock = std::chrono::steady_clock;
+    constexpr size_t rows = Machine::display_height;
+    constexpr size_t row_words = Machine::words_per_row;
+    uint64_t shown[Machine::display_planes * rows * row_words] = {}; // What the texture holds
+    bool uploaded = false; // The texture starts out undefined, the first frame is rendered whole
+    auto stats_begin = Clock::now();
+    Clock::duration presenting{0};
+    uint64_t presents = 0;
+    while (running) {
+        handleSDLEvents();
+        uint64_t dirty_rows = 0;
+        if (frames->take()) {
+            // Frames skipped in between are gone, so render the rows that differ from what is on screen
+            const uint64_t *gfx = frames->front().gfx;
+            dirty_rows = uploaded ? 0 : Machine::all_rows_dirty;
+            uploaded = true;
+            for (size_t plane = 0; plane < Machine::display_planes; ++plane) {
+                for (size_t y = 0; y < rows; ++y) {
+                    const size_t at = (plane * rows + y) * row_words;
+                    if (memcmp(gfx + at, shown + at, row_words * sizeof(uint64_t)) != 0) dirty_rows |= 1ull << y;
+                }
+            }
+            memcpy(shown, gfx, sizeof(shown));
+        } else if (display.get_fading_rows() == 0) {
+            // Nothing new, check for input again shortly
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
         }
+        // Phosphor keeps presenting while rows fade, the display may not have changed at all
+        const Frame<Machine> &frame = frames->front();
+        const bool presented = (dirty_rows | display.get_fading_rows()) != 0;
 
-        if (chip8.draw_gfx)
-            renderSDL(chip8.get_gfx());
-        chip8.draw_gfx = false;
+        const auto begin = Clock::now();
+        renderSDL<Machine>(display, shown, dirty_rows);
+        const auto end = Clock::now();
+        if (presented) {
+            presenting += end - begin;
+            presents++;
+        }
+        if (end - stats_begin >= std::chrono::seconds(1)) {
+            // Both sides measured on their own: emulation speed and cost, and how often and how long presenting takes
+            const double seconds = std::chrono::duration<double>(end - stats_begin).count();
+            const double present_ms = presents > 0 ? std::chrono::duration<double, std::milli>(presenting).count() / presents : 0;
+            char title[128];
+            snprintf(title, sizeof(title), "Chip-8 Emulator - emulation %.0f fps, %.3f ms/frame - display %.0f fps, %.2f ms/present",
+                     frame.emulation_fps, frame.emulation_ms, presents / seconds, present_ms);
+            SDL_SetWindowTitle(window, title);
+            stats_begin = end;
+            presenting = Clock::duration::zero();
+            presents = 0;
+        }
     }
 
+    emulation.join();
+    if (recorder.is_open()) {
+        const uint64_t dropped = recorder.get_dropped();
+        if (!recorder.close()) std::cout << "Failed to write recording " << record_path << std::endl;
+        else if (dropped > 0) std::cout << dropped << " frames could not be recorded in time" << std::endl;
+    }
+    // The callback reads the global Chip8Audio, stop it before that goes away
+    if (audio_device != 0) SDL_CloseAudioDevice(audio_device);
+    SDL_Quit();
     return 0;
 }
+
+// Up to four RRGGBB colours separated by commas, for the plane bits 0 to 3; those not given keep their default
+bool parsePalette(const std::string &text, uint32_t palette[4]) {
+    size_t begin = 0;
+    for (int i = 0; i < 4 && begin <= text.size(); ++i) {
+        const size_t end = std::min(text.find(',', begin), text.size());
+        const std::string color = text.substr(begin, end - begin);
+        if (color.size() != 6 || color.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) return false;
+        palette[i] = std::stoul(color, nullptr, 16) << 8 | 0xFF;
+        begin = end + 1;
+    }
+    return begin > text.size();
+}
+
+int main(int argc, char* argv[]) {
+    std::string rom_path;
+    std::string record_path;
+    std::string trace_path = DEFAULT_TRACE_PATH;
+    Chip8Timing timing = Chip8Timing::Instructions;
+    DisplayOptions display;
+    bool usage_error = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--record" && i + 1 < argc) record_path = argv[++i];
+        else if (arg == "--trace" && i + 1 < argc) trace_path = argv[++i];
+        else if (arg == "--vip") timing = Chip8Timing::CosmacVip;
+        else if (arg == "--scale" && i + 1 < argc) {
+            display.scale = std::stoi(argv[++i]);
+            usage_error |= display.scale < 1 || display.scale > CHIP8_RENDER_MAX_SCALE;
+        } else if (arg == "--palette" && i + 1 < argc) usage_error |= !parsePalette(argv[++i], display.palette);
+        else if (arg == "--phosphor" && i + 1 < argc) {
+            const double persistence = std::stod(argv[++i]);
+            usage_error |= persistence < 0 || persistence >= 1;
+            display.persistence = std::min(int(persistence * 256 + 0.5), 255);
+        }
+        else if (rom_path.empty() && arg.rfind("--", 0) != 0) rom_path = arg;
+        else usage_error = true;
+    }
+    if (rom_path.empty() || usage_error)
+    {
+        std::cout << "Usage: chip8_emulator [--record recording.c8rf] [--trace fault.c8tr] [--vip] [--scale N]" << std::endl
+                  << "                      [--palette RRGGBB,RRGGBB[,RRGGBB,RRGGBB]] [--phosphor F] chip8RomFile.(ch8|c8)"
+                  << std::endl
+                  << std::endl
+                  << "  --record P  Record every frame to P, see chip8_gif" << std::endl
+                  << "  --trace P   Where the trace of a ROM fault is written (default " DEFAULT_TRACE_PATH "), see chip8_trace"
+                  << std::endl
+                  << "  --vip       Run at the speed of the COSMAC VIP, from the machine cycles each instruction took on it"
+                  << std::endl
+                  << "  --scale N   Scale the display N times on the CPU (1 to " << CHIP8_RENDER_MAX_SCALE
+                  << "), the window takes its size" << std::endl
+                  << "  --palette   Colours of the background, plane 1, plane 2 and both planes, from the first" << std::endl
+                  << "  --phosphor F Pixels that go dark fade out, keeping F (0 to 1) of their colour every frame" << std::endl
+                  << std::endl;
+        return 1;
+    }
+    Chip8RomStore store;
+    if (!store.add_file(rom_path)) {
+        std::cout << "Failed to load ROM " << rom_path << std::endl;
+        return 1;
+    }
+
+    // Pick the instruction set from the opcodes the ROM actually uses
+    const Chip8Rom &rom = store.rom(0);
+    switch (rom.variant) {
+        case Chip8Variant::SuperChip: return runEmulator<Chip8SuperChip>(rom, record_path, trace_path, timing, display);
+        case Chip8Variant::XoChip: return runEmulator<Chip8XoChip>(rom, record_path, trace_path, timing, display);
+        default: return runEmulator<Chip8>(rom, record_path, trace_path, timing, display);
+    }
+}
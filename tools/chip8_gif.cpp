@@ -0,0 +1,255 @@
+#include "../include/Chip8Recorder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define GIF_MAX_CODES 4096 // LZW codes are at most 12 bits wide
+#define GIF_MIN_DELAY 2 // Centiseconds, most viewers slow down frames shown for less
+
+// Plane bits to colour, the same as the desktop build: background, plane 1, plane 2, both
+const uint8_t PALETTE[4][3] = {{0x00, 0x00, 0x00}, {0xFF, 0xFF, 0xFF}, {0xAA, 0xAA, 0xAA}, {0x55, 0x55, 0x55}};
+
+struct GifOptions {
+    int scale = 5; // Output pixels per display pixel, 320x160 for the original display
+    uint32_t from = 0; // First frame to convert
+    uint32_t to = 0; // One past the last frame to convert, 0 means the end of the recording
+    std::string recording;
+    std::string output_path;
+};
+
+void printUsage() {
+    std::cout << "Usage: chip8_gif [--scale N] [--from F] [--to F] recording.c8rf out.gif" << std::endl
+              << std::endl
+              << "Converts a recording made with chip8_emulator --record into an animated GIF." << std::endl
+              << "  --scale N   Output pixels per display pixel (default 5)" << std::endl
+              << "  --from F    Start at frame F (default 0)" << std::endl
+              << "  --to F      Stop before frame F (default the end of the recording)" << std::endl;
+}
+
+bool parseOptions(int argc, char* argv[], GifOptions &options) {
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--scale" && has_value) {
+            options.scale = std::stoi(argv[++i]);
+        } else if (arg == "--from" && has_value) {
+            options.from = std::stoul(argv[++i]);
+        } else if (arg == "--to" && has_value) {
+            options.to = std::stoul(argv[++i]);
+        } else if (arg.rfind("--", 0) == 0) {
+            return false;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.size() != 2) return false;
+    options.recording = paths[0];
+    options.output_path = paths[1];
+    return options.scale > 0 && options.scale <= 16;
+}
+
+// Packs variable width LZW codes LSB first into the 255 byte sub-blocks GIF image data is made of
+class GifCodeWriter {
+    public:
+    explicit GifCodeWriter(std::vector<uint8_t> &out) : out(out) {}
+
+    void put(uint32_t code, int width) {
+        bits |= code << bit_count;
+        bit_count += width;
+        while (bit_count >= 8) {
+            put_byte(bits & 0xFF);
+            bits >>= 8;
+            bit_count -= 8;
+        }
+    }
+
+    void finish() {
+        if (bit_count > 0) put_byte(bits & 0xFF);
+        if (!block.empty()) flush_block();
+        out.push_back(0); // Block terminator
+    }
+
+    private:
+    std::vector<uint8_t> &out;
+    std::vector<uint8_t> block;
+    uint32_t bits = 0;
+    int bit_count = 0;
+
+    void put_byte(uint8_t byte) {
+        block.push_back(byte);
+        if (block.size() == 255) flush_block();
+    }
+
+    void flush_block() {
+        out.push_back(block.size());
+        out.insert(out.end(), block.begin(), block.end());
+        block.clear();
+    }
+};
+
+// LZW compresses 2 bit colour indices, starting over with a clear code whenever the 12 bit table fills up
+void compressImage(const std::vector<uint8_t> &indices, std::vector<uint8_t> &out) {
+    constexpr int min_code_size = 2;
+    constexpr uint32_t clear_code = 1 << min_code_size;
+    constexpr uint32_t end_code = clear_code + 1;
+    out.push_back(min_code_size);
+    GifCodeWriter writer(out);
+
+    // next[code][index]: code of the string `code` followed by `index`, 0 if not in the table yet
+    std::vector<uint16_t> next(GIF_MAX_CODES * 4);
+    uint32_t next_code = end_code + 1;
+    int width = min_code_size + 1;
+    writer.put(clear_code, width);
+
+    uint32_t prefix = indices[0];
+    for (size_t i = 1; i < indices.size(); ++i) {
+        const uint8_t index = indices[i];
+        uint16_t &entry = next[prefix * 4 + index];
+        if (entry != 0) {
+            prefix = entry;
+            continue;
+        }
+        writer.put(prefix, width);
+        if (next_code < GIF_MAX_CODES) {
+            entry = next_code++;
+            // Decoders widen the codes once the table reaches the next power of two
+            if (next_code > (1u << width) && width < 12) width++;
+        } else {
+            writer.put(clear_code, width);
+            std::fill(next.begin(), next.end(), 0);
+            next_code = end_code + 1;
+            width = min_code_size + 1;
+        }
+        prefix = index;
+    }
+    writer.put(prefix, width);
+    writer.put(end_code, width);
+    writer.finish();
+}
+
+void put16(std::vector<uint8_t> &out, uint16_t value) {
+    out.push_back(value & 0xFF);
+    out.push_back(value >> 8);
+}
+
+void writeHeader(std::vector<uint8_t> &out, int width, int height) {
+    const char signature[] = "GIF89a";
+    out.insert(out.end(), signature, signature + 6);
+    put16(out, width);
+    put16(out, height);
+    out.push_back(0xF1); // Global colour table of 4 entries, 8 bits per primary
+    out.push_back(0); // Background colour
+    out.push_back(0); // Square pixels
+    for (const auto &colour : PALETTE) out.insert(out.end(), colour, colour + 3);
+    // Loop forever
+    const char netscape[] = "NETSCAPE2.0";
+    out.insert(out.end(), {0x21, 0xFF, 11});
+    out.insert(out.end(), netscape, netscape + 11);
+    out.insert(out.end(), {3, 1, 0, 0, 0});
+}
+
+void writeFrame(std::vector<uint8_t> &out, const std::vector<uint8_t> &indices, int width, int height, uint16_t delay) {
+    out.insert(out.end(), {0x21, 0xF9, 4, 0x04}); // Graphic control, keep the frame in place
+    put16(out, delay);
+    out.insert(out.end(), {0, 0});
+    out.push_back(0x2C); // Image descriptor covering the whole screen, global colours
+    put16(out, 0);
+    put16(out, 0);
+    put16(out, width);
+    put16(out, height);
+    out.push_back(0);
+    compressImage(indices, out);
+}
+
+// One colour index per output pixel, each display pixel repeated scale x scale times
+void renderFrame(const Chip8Replay &replay, int scale, std::vector<uint8_t> &indices) {
+    const int width = replay.get_width();
+    const int height = replay.get_height();
+    const int words = width / 64;
+    const uint64_t *gfx = replay.get_gfx_packed();
+    indices.resize(size_t(width) * scale * height * scale);
+    for (int y = 0; y < height; ++y) {
+        uint8_t *row = indices.data() + size_t(y) * scale * width * scale;
+        for (int x = 0; x < width; ++x) {
+            uint8_t value = 0;
+            for (int plane = 0; plane < replay.get_planes(); ++plane)
+                value |= ((gfx[(plane * height + y) * words + x / 64] >> (63 - x % 64)) & 1) << plane;
+            std::fill(row + x * scale, row + (x + 1) * scale, value);
+        }
+        for (int copy = 1; copy < scale; ++copy)
+            std::copy(row, row + width * scale, row + size_t(copy) * width * scale);
+    }
+}
+
+// Time of a frame from the start, in centiseconds, without accumulating rounding error
+uint32_t centiseconds(uint32_t frame) {
+    return uint32_t(uint64_t(frame) * 100 / CHIP8_TIMER_HZ);
+}
+
+int main(int argc, char* argv[]) {
+    GifOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+    Chip8Replay replay;
+    if (!replay.open(options.recording)) {
+        std::cout << "Failed to read recording " << options.recording << std::endl;
+        return 1;
+    }
+    const uint32_t end = options.to == 0 ? replay.get_frame_count() : std::min(options.to, replay.get_frame_count());
+    if (options.from >= end) {
+        std::cout << "No frames in [" << options.from << ", " << end << ")" << std::endl;
+        return 1;
+    }
+
+    const int width = replay.get_width() * options.scale;
+    const int height = replay.get_height() * options.scale;
+    std::vector<uint8_t> gif;
+    writeHeader(gif, width, height);
+
+    // Only frames where the display changed become GIF frames, held until the next change. An image replaced
+    // again before GIF_MIN_DELAY is over is dropped, and the one replacing it is shown from its start instead.
+    std::vector<uint32_t> changes = {options.from};
+    for (const uint32_t frame : replay.get_change_frames())
+        if (frame > options.from && frame < end) changes.push_back(frame);
+    changes.push_back(end);
+
+    std::vector<uint8_t> pending;
+    std::vector<uint8_t> indices;
+    uint32_t pending_start = 0;
+    size_t frames = 0;
+    for (size_t i = 0; i + 1 < changes.size(); ++i) {
+        if (!replay.seek(changes[i])) {
+            std::cout << "Recording damaged at frame " << changes[i] << std::endl;
+            return 1;
+        }
+        renderFrame(replay, options.scale, indices);
+        if (!pending.empty() && indices == pending) continue; // Only the keys changed
+        const uint32_t start = centiseconds(changes[i] - options.from);
+        if (!pending.empty() && start - pending_start >= GIF_MIN_DELAY) {
+            writeFrame(gif, pending, width, height, start - pending_start);
+            frames++;
+            pending_start = start;
+        }
+        pending.swap(indices);
+    }
+    const uint32_t stop = centiseconds(end - options.from);
+    writeFrame(gif, pending, width, height, std::max<uint32_t>(stop - pending_start, GIF_MIN_DELAY));
+    frames++;
+    gif.push_back(0x3B); // Trailer
+
+    std::ofstream file(options.output_path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(gif.data()), gif.size());
+    if (!file) {
+        std::cout << "Failed to write " << options.output_path << std::endl;
+        return 1;
+    }
+    std::cout << frames << " GIF frames from " << end - options.from << " recorded frames" << std::endl;
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include "../include/Chip8Server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct LoadOptions {
+    uint32_t clients = 8;
+    double seconds = 5;
+    uint32_t frames = 1; // Per request
+    bool snapshot = false;
+    std::string socket_path;
+    std::string rom;
+};
+
+struct ClientResult {
+    bool failed = false;
+    uint64_t frames = 0;
+    std::vector<uint32_t> latencies; // Nanoseconds, one per request
+};
+
+void printUsage() {
+    std::cout << "Usage: chip8_loadgen [--clients N] [--seconds S] [--frames N] [--snapshot] socket rom.ch8" << std::endl
+              << std::endl
+              << "Drives chip8_server with N concurrent sessions and reports requests/sec and latency." << std::endl
+              << "  --clients N  Sessions, each on its own thread sending one request at a time (default 8)" << std::endl
+              << "  --seconds S  How long to run (default 5)" << std::endl
+              << "  --frames N   Frames each request steps, after pressing or releasing a random key (default 1)" << std::endl
+              << "  --snapshot   Also take a snapshot in every request" << std::endl;
+}
+
+bool parseOptions(int argc, char* argv[], LoadOptions &options) {
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--clients" && i + 1 < argc) {
+            options.clients = std::stoul(argv[++i]);
+        } else if (arg == "--seconds" && i + 1 < argc) {
+            options.seconds = std::stod(argv[++i]);
+        } else if (arg == "--frames" && i + 1 < argc) {
+            options.frames = std::stoul(argv[++i]);
+        } else if (arg == "--snapshot") {
+            options.snapshot = true;
+        } else if (arg.rfind("--", 0) == 0) {
+            return false;
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() != 2 || options.clients == 0) return false;
+    options.socket_path = positional[0];
+    options.rom = positional[1];
+    return true;
+}
+
+void runClient(const LoadOptions &options, const std::vector<uint8_t> &rom, uint32_t seed,
+               const std::atomic<bool> &stopping, ClientResult &result) {
+    Chip8ServerClient client;
+    Chip8ServerReply reply;
+    Chip8ServerCommand commands[3] = {};
+    if (!client.connect(options.socket_path)) {
+        result.failed = true;
+        return;
+    }
+    std::copy(rom.begin(), rom.end(), client.get_region()->rom);
+    commands[0].command = Chip8Command::Seed;
+    commands[0].value = seed;
+    commands[1].command = Chip8Command::LoadRom;
+    commands[1].value = rom.size();
+    if (!client.call(commands, 2, reply) || reply.status != Chip8ServerStatus::Ok) {
+        result.failed = true;
+        return;
+    }
+
+    commands[1].command = Chip8Command::StepFrames;
+    commands[1].value = options.frames;
+    commands[2].command = Chip8Command::Snapshot;
+    const uint32_t count = options.snapshot ? 3 : 2;
+    uint32_t rng = seed;
+    while (!stopping.load(std::memory_order_relaxed)) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        commands[0].command = Chip8Command::SetKey;
+        commands[0].key = rng & 0xF;
+        commands[0].pressed = rng >> 4 & 1;
+        const auto begin = std::chrono::steady_clock::now();
+        if (!client.call(commands, count, reply) || reply.status != Chip8ServerStatus::Ok) {
+            result.failed = true;
+            return;
+        }
+        const auto end = std::chrono::steady_clock::now();
+        result.latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+        result.frames += reply.frames;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    LoadOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+    std::ifstream file(options.rom, std::ios::binary);
+    const std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (rom.empty() || rom.size() > Chip8::max_program_size) {
+        std::cout << "Failed to load " << options.rom << std::endl;
+        return 1;
+    }
+
+    std::atomic<bool> stopping{false};
+    std::vector<ClientResult> results(options.clients);
+    std::vector<std::thread> threads;
+    const auto begin = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < options.clients; ++i)
+        threads.emplace_back(runClient, std::cref(options), std::cref(rom), i + 1, std::cref(stopping), std::ref(results[i]));
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+    stopping = true;
+    for (std::thread &thread : threads)
+        thread.join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::vector<uint32_t> latencies;
+    uint64_t frames = 0;
+    uint32_t failed = 0;
+    for (const ClientResult &result : results) {
+        latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+        frames += result.frames;
+        failed += result.failed;
+    }
+    if (failed > 0) std::cout << failed << " of " << options.clients << " sessions failed" << std::endl;
+    if (latencies.empty()) return 1;
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double fraction) {
+        return latencies[std::min<size_t>(latencies.size() - 1, size_t(fraction * latencies.size()))] / 1000.0;
+    };
+
+    char line[160];
+    snprintf(line, sizeof(line), "%u clients, %zu requests in %.2f s: %.0f requests/s, %.0f frames/s", options.clients,
+             latencies.size(), seconds, latencies.size() / seconds, frames / seconds);
+    std::cout << line << std::endl;
+    snprintf(line, sizeof(line), "latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f", percentile(0.5),
+             percentile(0.9), percentile(0.99), percentile(0.999), latencies.back() / 1000.0);
+    std::cout << line << std::endl;
+    return failed > 0 ? 1 : 0;
+}
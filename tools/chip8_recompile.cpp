@@ -0,0 +1,461 @@
+#include "../include/Chip8.h"
+#include "../include/Chip8Aot.h"
+#include "../include/Chip8RomStore.h"
+#include "../include/Chip8Trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define MAX_BLOCK_INSTRUCTIONS 16 // Longer runs are split, so a block still fits in one frame's budget at 1000 Hz
+
+struct RecompileOptions {
+    std::string output_path; // Standard output if empty
+    std::string name; // C++ identifier of the program, derived from the ROM file name if empty
+    bool listing = false; // Print the disassembly and the blocks instead of generating code
+    std::string rom;
+};
+
+enum InstructionKind {
+    STRAIGHT, // Translated, execution continues with the next instruction
+    TERMINATOR, // Translated, ends the block (jumps, calls, returns, skips)
+    INTERPRETED // Left to the interpreter
+};
+
+// Basic block of translated instructions, [start, end)
+struct Block {
+    uint32_t start;
+    uint32_t end;
+    uint32_t length; // Instructions, including the terminator
+    bool terminated; // Ends with a terminator, otherwise execution continues at end
+};
+
+struct Analysis {
+    std::vector<bool> reachable = std::vector<bool>(CHIP8_MEMORY_SIZE); // An instruction starts here
+    std::vector<bool> leader = std::vector<bool>(CHIP8_MEMORY_SIZE); // Execution may arrive here other than from the previous instruction
+    std::vector<int> block_at = std::vector<int>(CHIP8_MEMORY_SIZE, -1); // Index of the block starting here
+    std::vector<Block> blocks;
+    size_t instructions = 0;
+    size_t translated = 0;
+};
+
+void printUsage() {
+    std::cout << "Usage: chip8_recompile [-o file.cpp] [--name identifier] [--listing] rom.ch8" << std::endl
+              << std::endl
+              << "Translates the reachable code of a CHIP-8 ROM into a C++ translation unit for Chip8Aot." << std::endl
+              << "  -o P        Write the translation unit to P instead of stdout" << std::endl
+              << "  --name N    C++ identifier of the program (chip8_aot_N), default from the file name" << std::endl
+              << "  --listing   Print the disassembly of every reachable instruction and its block instead" << std::endl;
+}
+
+bool parseOptions(int argc, char* argv[], RecompileOptions &options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "-o" && has_value) {
+            options.output_path = argv[++i];
+        } else if (arg == "--name" && has_value) {
+            options.name = argv[++i];
+        } else if (arg == "--listing") {
+            options.listing = true;
+        } else if (arg.rfind("-", 0) == 0 || !options.rom.empty()) {
+            return false;
+        } else {
+            options.rom = arg;
+        }
+    }
+    return !options.rom.empty();
+}
+
+std::string hex(uint32_t value, int digits) {
+    char text[16];
+    snprintf(text, sizeof(text), "0x%0*X", digits, value);
+    return text;
+}
+
+// Same groups as Chip8::decode_at for the original instruction set
+InstructionKind classify(uint16_t opcode) {
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            // (00EE) as decoded by the interpreter, 00E0 needs the display
+            return (opcode & 0x0F00) == 0 && (opcode & 0x000F) == 0x000E ? TERMINATOR : INTERPRETED;
+        case 0x1000: case 0x2000: case 0x3000: case 0x4000: case 0x5000: case 0x9000:
+            return TERMINATOR;
+        case 0x6000: case 0x7000: case 0xA000:
+            return STRAIGHT;
+        case 0xE000:
+            return (opcode & 0x00FF) == 0x9E || (opcode & 0x00FF) == 0xA1 ? TERMINATOR : INTERPRETED;
+        case 0x8000:
+            return (opcode & 0x000F) <= 0x7 || (opcode & 0x000F) == 0xE ? STRAIGHT : INTERPRETED;
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x07: case 0x15: case 0x18: case 0x1E: case 0x29:
+                    return STRAIGHT;
+                default:
+                    return INTERPRETED;
+            }
+        default:
+            return INTERPRETED;
+    }
+}
+
+// Where execution can continue after the instruction, BNNN and halting instructions have no known successor
+std::vector<uint32_t> successors(uint16_t opcode, uint32_t address) {
+    const uint32_t next = address + 2;
+    const uint32_t skipped = address + 4;
+    const uint32_t nnn = opcode & 0x0FFF;
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            if ((opcode & 0x0F00) != 0) return {};
+            if ((opcode & 0x000F) == 0x0000) return {next};
+            return {}; // Returns go wherever the stack says, anything else halts
+        case 0x1000: return {nnn};
+        case 0x2000: return {nnn, next};
+        case 0x3000: case 0x4000: case 0x5000: case 0x9000: return {next, skipped};
+        case 0x8000: return (opcode & 0x000F) <= 0x7 || (opcode & 0x000F) == 0xE ? std::vector<uint32_t>{next} : std::vector<uint32_t>{};
+        case 0xB000: return {};
+        case 0xE000: return (opcode & 0x00FF) == 0x9E || (opcode & 0x00FF) == 0xA1 ? std::vector<uint32_t>{next, skipped} : std::vector<uint32_t>{};
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x07: case 0x0A: case 0x15: case 0x18: case 0x1E: case 0x29: case 0x33: case 0x55: case 0x65:
+                    return {next};
+                default:
+                    return {};
+            }
+        default:
+            return {next};
+    }
+}
+
+// Follows every path from the entry point, then cuts the reachable code into blocks at each leader
+Analysis analyze(const Chip8Rom &rom) {
+    const uint32_t end = CHIP8_ADDR_PROGRAM_START + rom.size;
+    auto in_rom = [&](uint32_t address) { return address >= CHIP8_ADDR_PROGRAM_START && address + 1 < end; };
+    auto opcode_at = [&](uint32_t address) {
+        const uint8_t *bytes = rom.data + address - CHIP8_ADDR_PROGRAM_START;
+        return static_cast<uint16_t>(bytes[0] << 8 | bytes[1]);
+    };
+
+    Analysis analysis;
+    std::vector<uint32_t> pending = {CHIP8_ADDR_PROGRAM_START};
+    analysis.leader[CHIP8_ADDR_PROGRAM_START] = true;
+    while (!pending.empty()) {
+        uint32_t address = pending.back();
+        pending.pop_back();
+        while (in_rom(address) && !analysis.reachable[address]) {
+            analysis.reachable[address] = true;
+            analysis.instructions++;
+            const uint16_t opcode = opcode_at(address);
+            if (classify(opcode) == STRAIGHT) {
+                address += 2;
+                continue;
+            }
+            // Control flow, or an instruction the runtime hands to the interpreter and picks up again after
+            for (const uint32_t next : successors(opcode, address)) {
+                if (next >= CHIP8_MEMORY_SIZE) continue;
+                analysis.leader[next] = true;
+                pending.push_back(next);
+            }
+            break;
+        }
+    }
+
+    // Ascending, so a leader added by splitting a long run is reached later in the same pass
+    for (uint32_t start = CHIP8_ADDR_PROGRAM_START; start < end; ++start) {
+        if (!analysis.leader[start] || !analysis.reachable[start] || classify(opcode_at(start)) == INTERPRETED) continue;
+        Block block = {start, start, 0, false};
+        while (in_rom(block.end)) {
+            const InstructionKind kind = classify(opcode_at(block.end));
+            if (kind == INTERPRETED) break;
+            block.length++;
+            block.end += 2;
+            if (kind == TERMINATOR) {
+                block.terminated = true;
+                break;
+            }
+            if (analysis.leader[block.end]) break;
+            if (block.length == MAX_BLOCK_INSTRUCTIONS) {
+                analysis.leader[block.end] = true;
+                break;
+            }
+        }
+        analysis.block_at[start] = static_cast<int>(analysis.blocks.size());
+        analysis.blocks.push_back(block);
+        analysis.translated += block.length;
+    }
+    return analysis;
+}
+
+class Generator {
+    public:
+    Generator(const Chip8Rom &rom, const Analysis &analysis, std::ostream &os) : rom(rom), analysis(analysis), os(os) {}
+
+    void generate(const std::string &name) {
+        os << "// Translated from " << rom.name << " by chip8_recompile, do not edit." << std::endl
+           << "// " << analysis.blocks.size() << " blocks covering " << analysis.translated << " of "
+           << analysis.instructions << " reachable instructions, the rest runs on the interpreter." << std::endl
+           << "#include \"Chip8Aot.h\"" << std::endl
+           << std::endl
+           << "namespace {" << std::endl;
+
+        os << "    const uint8_t rom[] = {";
+        for (size_t i = 0; i < rom.size; ++i)
+            os << (i % 16 == 0 ? "\n        " : " ") << hex(rom.data[i], 2) << ",";
+        os << std::endl << "    };" << std::endl << std::endl;
+
+        // An array cannot be empty, a program without blocks still gets one that is never looked at
+        os << "    const Chip8AotBlock blocks[] = {" << std::endl;
+        for (const Block &block : analysis.blocks)
+            os << "        {" << hex(block.start, 3) << ", " << hex(block.end, 3) << "}," << std::endl;
+        if (analysis.blocks.empty()) os << "        {0, 0}," << std::endl;
+        os << "    };" << std::endl << std::endl;
+
+        os << "    uint32_t run(Chip8AotFrame *f, const uint8_t *live, uint32_t cycles) {" << std::endl;
+        if (analysis.blocks.empty()) {
+            os << "        (void) f;" << std::endl
+               << "        (void) live;" << std::endl
+               << "        (void) cycles;" << std::endl
+               << "        return 0;" << std::endl;
+        } else {
+            // Only returns come back to the switch, their target is not known until run time
+            const bool returns = std::any_of(analysis.blocks.begin(), analysis.blocks.end(), [&](const Block &block) {
+                return block.terminated && (opcode_at(block.end - 2) & 0xF000) == 0x0000;
+            });
+            os << "        uint8_t *const v = f->registers_v;" << std::endl
+               << "        uint32_t executed = 0;" << std::endl;
+            if (returns) os << "    dispatch:" << std::endl;
+            os << "        switch (f->pc) {" << std::endl;
+            for (const Block &block : analysis.blocks)
+                os << "            case " << hex(block.start, 3) << ": goto " << label(block.start) << ";" << std::endl;
+            os << "            default: return executed;" << std::endl
+               << "        }" << std::endl;
+            for (size_t i = 0; i < analysis.blocks.size(); ++i)
+                generate_block(i);
+        }
+        os << "    }" << std::endl
+           << "}" << std::endl
+           << std::endl;
+
+        os << "extern const Chip8AotProgram chip8_aot_" << name << " = {" << std::endl
+           << "    CHIP8_AOT_ABI_VERSION, \"" << escape(rom.name) << "\", rom, sizeof(rom), " << hex_u64(rom.hash) << "," << std::endl
+           << "    blocks, " << analysis.blocks.size() << ", run" << std::endl
+           << "};" << std::endl
+           << std::endl
+           << "// Entry point when built as a module, see chip8_add_aot() in CMakeLists.txt" << std::endl
+           << "#if CHIP8_AOT_MODULE" << std::endl
+           << "extern \"C\" const Chip8AotProgram* " << CHIP8_AOT_ENTRY << "() {" << std::endl
+           << "    return &chip8_aot_" << name << ";" << std::endl
+           << "}" << std::endl
+           << "#endif" << std::endl;
+    }
+
+    private:
+    const Chip8Rom &rom;
+    const Analysis &analysis;
+    std::ostream &os;
+
+    static std::string label(uint32_t address) {
+        return "block_" + hex(address, 3);
+    }
+
+    static std::string hex_u64(uint64_t value) {
+        char text[32];
+        snprintf(text, sizeof(text), "0x%016llXull", static_cast<unsigned long long>(value));
+        return text;
+    }
+
+    static std::string escape(const std::string &value) {
+        std::string escaped;
+        for (const char c : value) {
+            if (c == '"' || c == '\\') escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    uint16_t opcode_at(uint32_t address) const {
+        const uint8_t *bytes = rom.data + address - CHIP8_ADDR_PROGRAM_START;
+        return static_cast<uint16_t>(bytes[0] << 8 | bytes[1]);
+    }
+
+    // Continue at the block starting at address, or leave it to the interpreter if there is none
+    std::string jump(uint32_t address) const {
+        const uint32_t pc = address & 0xFFFF;
+        if (pc < CHIP8_MEMORY_SIZE && analysis.block_at[pc] >= 0) return "goto " + label(pc) + ";";
+        return "{ f->pc = " + hex(pc, 3) + "; return executed; }";
+    }
+
+    void comment(uint32_t address, uint16_t opcode) const {
+        os << " // " << hex(address, 3) << ": " << hex(opcode, 4).substr(2) << "  " << Chip8Trace::disassemble(opcode, Chip8Variant::Chip8) << std::endl;
+    }
+
+    void generate_block(size_t index) {
+        const Block &block = analysis.blocks[index];
+        os << "    " << label(block.start) << ":" << std::endl
+           << "        if (!live[" << index << "] || cycles - executed < " << block.length << ") { f->pc = "
+           << hex(block.start, 3) << "; return executed; }" << std::endl;
+
+        uint32_t address = block.start;
+        for (uint32_t i = 0; i + (block.terminated ? 1 : 0) < block.length; ++i, address += 2)
+            generate_straight(address, opcode_at(address));
+        os << "        executed += " << block.length << ";" << std::endl;
+        if (block.terminated) generate_terminator(address, opcode_at(address));
+        else os << "        " << jump(block.end) << std::endl;
+    }
+
+    // Statement for statement what the interpreter does, so flags come out the same when X or Y is F
+    void generate_straight(uint32_t address, uint16_t opcode) const {
+        const std::string vx = "v[" + hex((opcode & 0x0F00) >> 8, 1) + "]";
+        const std::string vy = "v[" + hex((opcode & 0x00F0) >> 4, 1) + "]";
+        const std::string nn = hex(opcode & 0x00FF, 2);
+        std::string code;
+        switch (opcode & 0xF000) {
+            case 0x6000: code = vx + " = " + nn + ";"; break;
+            case 0x7000: code = vx + " += " + nn + ";"; break;
+            case 0x8000:
+                switch (opcode & 0x000F) {
+                    case 0x0: code = vx + " = " + vy + ";"; break;
+                    case 0x1: code = vx + " |= " + vy + ";"; break;
+                    case 0x2: code = vx + " &= " + vy + ";"; break;
+                    case 0x3: code = vx + " ^= " + vy + ";"; break;
+                    case 0x4: code = "v[0xF] = " + vy + " > 0xFF - " + vx + "; " + vx + " += " + vy + ";"; break;
+                    case 0x5:
+                        // Subtracting a register from itself never borrows, spelled out so the compiler has nothing to warn about
+                        if (vx == vy) code = "v[0xF] = 1; " + vx + " = 0;";
+                        else code = "v[0xF] = !(" + vy + " > " + vx + "); " + vx + " -= " + vy + ";";
+                        break;
+                    case 0x6: code = "v[0xF] = " + vx + " & 0x1; " + vx + " >>= 1;"; break;
+                    case 0x7:
+                        if (vx == vy) code = "v[0xF] = 1; " + vx + " = 0;";
+                        else code = "v[0xF] = !(" + vx + " > " + vy + "); " + vx + " = " + vy + " - " + vx + ";";
+                        break;
+                    case 0xE: code = "v[0xF] = " + vx + " >> 7; " + vx + " <<= 1;"; break;
+                }
+                break;
+            case 0xA000: code = "f->idx_register = " + hex(opcode & 0x0FFF, 3) + ";"; break;
+            case 0xF000:
+                switch (opcode & 0x00FF) {
+                    case 0x07: code = vx + " = f->delay_timer;"; break;
+                    case 0x15: code = "f->delay_timer = " + vx + ";"; break;
+                    case 0x18: code = "f->sound_timer = " + vx + ";"; break;
+                    case 0x1E: code = "v[0xF] = f->idx_register + " + vx + " > 0xFFF; f->idx_register += " + vx + ";"; break;
+                    case 0x29: code = "f->idx_register = " + vx + " * 5;"; break;
+                }
+                break;
+        }
+        os << "        " << code;
+        comment(address, opcode);
+    }
+
+    void generate_terminator(uint32_t address, uint16_t opcode) const {
+        const std::string vx = "v[" + hex((opcode & 0x0F00) >> 8, 1) + "]";
+        const std::string vy = "v[" + hex((opcode & 0x00F0) >> 4, 1) + "]";
+        const std::string nn = hex(opcode & 0x00FF, 2);
+        const uint32_t nnn = opcode & 0x0FFF;
+        // Stack overflow and underflow, or an SP past the stack, are left to the interpreter without counting the
+        // instruction, which faults on them
+        const std::string bail = "{ f->pc = " + hex(address, 3) + "; return executed - 1; }";
+        std::string condition;
+        switch (opcode & 0xF000) {
+            case 0x0000:
+                os << "        if (f->sp - 1u >= CHIP8_STACK_SIZE) " << bail;
+                comment(address, opcode);
+                os << "        f->pc = f->stack[--f->sp] + 2;" << std::endl
+                   << "        goto dispatch;" << std::endl;
+                return;
+            case 0x1000:
+                os << "        " << jump(nnn);
+                comment(address, opcode);
+                return;
+            case 0x2000:
+                os << "        if (f->sp >= CHIP8_STACK_SIZE) " << bail;
+                comment(address, opcode);
+                os << "        f->stack[f->sp++] = " << hex(address, 3) << ";" << std::endl
+                   << "        " << jump(nnn) << std::endl;
+                return;
+            case 0x3000: condition = vx + " == " + nn; break;
+            case 0x4000: condition = vx + " != " + nn; break;
+            case 0x5000: condition = vx + " == " + vy; break;
+            case 0x9000: condition = vx + " != " + vy; break;
+            case 0xE000:
+                // Only the low nibble of VX picks the key, as in the interpreter
+                os << "        if (f->input_keys[" << vx << " & 0xF] " << ((opcode & 0x00FF) == 0x9E ? "!=" : "==") << " 0) "
+                   << jump(address + 4);
+                comment(address, opcode);
+                os << "        " << jump(address + 2) << std::endl;
+                return;
+        }
+        if (((opcode & 0xF000) == 0x5000 || (opcode & 0xF000) == 0x9000) && vx == vy) {
+            // Comparing a register with itself, the outcome is known
+            os << "        " << jump((opcode & 0xF000) == 0x5000 ? address + 4 : address + 2);
+            comment(address, opcode);
+            return;
+        }
+        os << "        if (" << condition << ") " << jump(address + 4);
+        comment(address, opcode);
+        os << "        " << jump(address + 2) << std::endl;
+    }
+};
+
+void printListing(const Chip8Rom &rom, const Analysis &analysis, std::ostream &os) {
+    os << analysis.instructions << " reachable instructions, " << analysis.translated << " translated into "
+       << analysis.blocks.size() << " blocks" << std::endl;
+    const uint32_t end = CHIP8_ADDR_PROGRAM_START + rom.size;
+    for (uint32_t address = CHIP8_ADDR_PROGRAM_START; address + 1 < end; ++address) {
+        if (!analysis.reachable[address]) continue;
+        const uint8_t *bytes = rom.data + address - CHIP8_ADDR_PROGRAM_START;
+        const uint16_t opcode = bytes[0] << 8 | bytes[1];
+        std::string text = Chip8Trace::disassemble(opcode, Chip8Variant::Chip8);
+        text.resize(std::max<size_t>(text.size(), 18), ' ');
+        os << hex(address, 3) << "  " << hex(opcode, 4).substr(2) << "  " << text;
+        if (analysis.block_at[address] >= 0) os << "  block " << analysis.block_at[address];
+        else if (classify(opcode) == INTERPRETED) os << "  interpreter";
+        os << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    RecompileOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+
+    Chip8RomStore store;
+    if (!store.add_file(options.rom)) {
+        std::cout << "Failed to load " << options.rom << std::endl;
+        return 1;
+    }
+    const Chip8Rom &rom = store.rom(0);
+    if (rom.variant != Chip8Variant::Chip8) {
+        // Chip8Aot runs on the original machine, whose interpreter would not understand the rest anyway
+        std::cout << rom.name << " uses SUPER-CHIP or XO-CHIP instructions, only CHIP-8 ROMs can be translated" << std::endl;
+        return 1;
+    }
+
+    std::string name = options.name;
+    if (name.empty()) {
+        const size_t slash = rom.name.find_last_of("/\\");
+        name = rom.name.substr(slash == std::string::npos ? 0 : slash + 1);
+        name = name.substr(0, name.find('.'));
+    }
+    for (char &c : name)
+        if (!isalnum(static_cast<unsigned char>(c))) c = '_';
+
+    const Analysis analysis = analyze(rom);
+    std::ofstream file;
+    if (!options.output_path.empty()) {
+        file.open(options.output_path);
+        if (!file) {
+            std::cout << "Failed to open output file " << options.output_path << std::endl;
+            return 1;
+        }
+    }
+    std::ostream &os = options.output_path.empty() ? std::cout : file;
+    if (options.listing) printListing(rom, analysis, os);
+    else Generator(rom, analysis, os).generate(name);
+    return os ? 0 : 1;
+}
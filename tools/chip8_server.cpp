@@ -0,0 +1,44 @@
+#include "../include/Chip8Server.h"
+
+#include <csignal>
+#include <iostream>
+#include <string>
+
+#define DEFAULT_SOCKET_PATH "/tmp/chip8.sock"
+
+Chip8Server server;
+
+void handleSignal(int) {
+    server.stop();
+}
+
+void printUsage() {
+    std::cout << "Usage: chip8_server [--socket P]" << std::endl
+              << std::endl
+              << "Serves headless CHIP-8 sessions to other processes over a Unix domain socket." << std::endl
+              << "  --socket P  Path of the socket (default " DEFAULT_SOCKET_PATH ")" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    std::string path = DEFAULT_SOCKET_PATH;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) {
+            path = argv[++i];
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+    if (!server.open(path)) {
+        std::cout << "Failed to listen on " << path << std::endl;
+        return 1;
+    }
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+    std::cout << "Listening on " << path << std::endl;
+    server.run();
+    std::cout << "Served " << server.get_requests() << " requests to " << server.get_accepted() << " sessions"
+              << std::endl;
+    return 0;
+}
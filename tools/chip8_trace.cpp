@@ -0,0 +1,81 @@
+#include "../include/Chip8Trace.h"
+
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+
+struct TraceOptions {
+    uint32_t last = 0; // Records printed, counted back from the fault; 0 prints all of them
+    std::string path;
+};
+
+void printUsage() {
+    std::cout << "Usage: chip8_trace [--last N] trace.c8tr" << std::endl
+              << std::endl
+              << "Disassembles a trace dump written by chip8_emulator when a ROM faults." << std::endl
+              << "  --last N    Only print the N instructions leading up to the fault" << std::endl;
+}
+
+bool parseOptions(int argc, char* argv[], TraceOptions &options) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--last" && i + 1 < argc) {
+            options.last = std::stoul(argv[++i]);
+        } else if (arg.rfind("--", 0) == 0 || !options.path.empty()) {
+            return false;
+        } else {
+            options.path = arg;
+        }
+    }
+    return !options.path.empty();
+}
+
+const char* variantName(Chip8Variant variant) {
+    switch (variant) {
+        case Chip8Variant::SuperChip: return "SUPER-CHIP";
+        case Chip8Variant::XoChip: return "XO-CHIP";
+        default: return "CHIP-8";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    TraceOptions options;
+    if (!parseOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+    // Too large for the stack with its records
+    auto dump = std::make_unique<Chip8TraceDump>();
+    if (!Chip8Trace::read(options.path, *dump)) {
+        std::cout << "Failed to read trace " << options.path << std::endl;
+        return 1;
+    }
+
+    char line[96];
+    snprintf(line, sizeof(line), "%s trace, %s at %03X after %llu instructions", variantName(dump->variant),
+             Chip8Trace::fault_name(dump->fault), dump->pc, static_cast<unsigned long long>(dump->instructions));
+    std::cout << line << std::endl << std::endl;
+    const uint32_t first = options.last != 0 && options.last < dump->count ? dump->count - options.last : 0;
+    for (uint32_t i = first; i < dump->count; ++i) {
+        const Chip8TraceRecord &record = dump->records[i];
+        const uint64_t number = dump->instructions - dump->count + i;
+        const std::string text = Chip8Trace::disassemble(record.opcode, dump->variant);
+        snprintf(line, sizeof(line), "%10llu  %03X: %04X  %-18s I=%03X", static_cast<unsigned long long>(number),
+                 record.pc, record.opcode, text.c_str(), record.idx_register);
+        std::cout << line << std::endl;
+    }
+
+    std::cout << std::endl;
+    for (int i = 0; i < CHIP8_REGISTER_COUNT; ++i) {
+        snprintf(line, sizeof(line), "V%X=%02X%s", i, dump->registers_v[i], i % 8 == 7 ? "\n" : " ");
+        std::cout << line;
+    }
+    std::cout << "Stack (SP " << dump->sp << "):";
+    for (int i = 0; i < dump->sp && i < CHIP8_STACK_SIZE; ++i) {
+        snprintf(line, sizeof(line), " %03X", dump->stack[i]);
+        std::cout << line;
+    }
+    std::cout << std::endl;
+    return 0;
+}